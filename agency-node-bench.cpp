@@ -0,0 +1,1572 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "helper-immut.h"
+
+#include "node-conditions.h"
+#include "node-intern.h"
+#include "node-json.h"
+#include "node-memory.h"
+#include "node-overlay.h"
+#include "node-path.h"
+#include "node-plan.h"
+#include "node-reclaimer.h"
+#include "node-root.h"
+#include "node-ttl.h"
+#include "node-work-pool.h"
+#include "node.h"
+#include "store.h"
+#include "test-helper.h"
+
+using namespace std::string_literals;
+
+namespace {
+
+using path_vector = std::vector<std::string>;
+
+node::path_slice to_path_slice(path_vector const& path) {
+  using element = immut_list<std::string>::element<std::string>;
+  auto head = immut_list<std::string>::element_pointer{};
+  for (auto it = path.rbegin(); it != path.rend(); ++it) {
+    auto next = std::make_shared<element>(*it);
+    next->next = std::move(head);
+    head = std::move(next);
+  }
+  return node::path_slice{std::move(head)};
+}
+
+// splits an agency path into one string per segment
+path_vector split_path(std::string_view path) {
+  path_vector result;
+  while (!path.empty()) {
+    auto const end = std::min(path.find('/'), path.size());
+    if (end > 0) {
+      result.emplace_back(path.substr(0, end));
+    }
+    path.remove_prefix(std::min(end + 1, path.size()));
+  }
+  return result;
+}
+
+struct container_stats {
+  std::size_t compact_objects = 0;
+  std::size_t large_objects = 0;
+  std::size_t compact_arrays = 0;
+  std::size_t large_arrays = 0;
+  std::size_t leaves = 0;
+};
+
+/*
+ * Walks the tree, counts the container representations and collects the
+ * paths to all leaves.
+ */
+void walk(node const& n, path_vector& current, container_stats& stats,
+          std::vector<path_vector>& leaves) {
+  n.visit(visitor{
+      [&](node_object const& o) {
+        (o.is_compact() ? stats.compact_objects : stats.large_objects) += 1;
+        o.visit_members([&](auto const& c) {
+          for (auto const& member : c) {
+            current.push_back(member.first.str());
+            walk(*member.second, current, stats, leaves);
+            current.pop_back();
+          }
+        });
+      },
+      [&](node_array const& a) {
+        (a.is_compact() ? stats.compact_arrays : stats.large_arrays) += 1;
+        for (std::size_t i = 0; i < a.size(); i++) {
+          current.push_back(std::to_string(i));
+          walk(*a.at(i), current, stats, leaves);
+          current.pop_back();
+        }
+      },
+      [&](auto const&) {
+        stats.leaves += 1;
+        leaves.push_back(current);
+      },
+  });
+}
+
+void print_per_op(char const* name, std::chrono::steady_clock::duration dur,
+                  std::uint64_t cycles, std::size_t n) {
+  std::cout << name << " avg "
+            << std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(dur).count() / n
+            << "ns, " << cycles / n << " cycles" << std::endl;
+}
+
+/*
+ * Memory and latency of the container representations. Compare builds with
+ * different AGENCY_NODE_SMALL_CONTAINER_LIMIT values.
+ */
+void containers_bench(std::string const& filename) {
+  std::cout << "small container limit " << node_small_container_limit << std::endl;
+
+  auto const rss_before = resident_set_size();
+  auto p = node_from_file(filename);
+  auto const rss_after = resident_set_size();
+  std::cout << "rss  " << rss_before / 1024 << "KiB -> " << rss_after / 1024
+            << "KiB" << std::endl;
+
+  container_stats stats;
+  std::vector<path_vector> leaves;
+  {
+    path_vector current;
+    walk(*p, current, stats, leaves);
+  }
+  std::cout << "objects " << stats.compact_objects << " compact, "
+            << stats.large_objects << " large" << std::endl;
+  std::cout << "arrays  " << stats.compact_arrays << " compact, "
+            << stats.large_arrays << " large" << std::endl;
+  std::cout << "leaves  " << stats.leaves << std::endl;
+
+  std::vector<node::path_slice> paths;
+  for (auto const& leaf : leaves) {
+    paths.push_back(to_path_slice(leaf));
+  }
+  if (paths.empty()) {
+    return;
+  }
+
+  auto const rounds = std::max<std::size_t>(1, 1'000'000 / paths.size());
+  auto const n = rounds * paths.size();
+
+  std::size_t found = 0;
+  auto cycles = cycle_counter();
+  auto dur = timed([&] {
+    for (std::size_t r = 0; r < rounds; r++) {
+      for (auto const& path : paths) {
+        found += p->get(path) != nullptr;
+      }
+    }
+  });
+  print_per_op("get", dur, cycle_counter() - cycles, n);
+  if (found != n) {
+    std::cout << "missing paths: " << n - found << std::endl;
+  }
+
+  auto const value = node::value_node(12.0);
+  cycles = cycle_counter();
+  dur = timed([&] {
+    for (std::size_t r = 0; r < rounds; r++) {
+      for (auto const& path : paths) {
+        p = p->set(path, value);
+      }
+    }
+  });
+  print_per_op("set", dur, cycle_counter() - cycles, n);
+}
+
+/*
+ * Cost of using a whole snapshot as `new` payload of a set operation, eagerly
+ * converted to nodes versus kept as node_slice, and of writing the result
+ * back into a builder.
+ */
+void payload_bench(std::string const& filename) {
+  std::stringstream ss;
+  ss << std::ifstream(filename).rdbuf();
+  auto const payload = Parser::fromJson(ss.str());
+  auto const path = node::path_slice{"arango"s, "Target"s, "payload"s};
+  auto const n = 100;
+
+  auto run = [&](char const* name, auto&& make_node) {
+    auto p = node::empty_object();
+    auto cycles = cycle_counter();
+    auto dur = timed([&] {
+      for (int i = 0; i < n; i++) {
+        p = p->set(path, make_node(payload->slice()));
+      }
+    });
+    std::cout << name << " ";
+    print_per_op("set", dur, cycle_counter() - cycles, n);
+
+    std::size_t bytes = 0;
+    cycles = cycle_counter();
+    dur = timed([&] {
+      for (int i = 0; i < n; i++) {
+        Builder builder;
+        p->into_builder(builder);
+        bytes += builder.size();
+      }
+    });
+    std::cout << name << " ";
+    print_per_op("into_builder", dur, cycle_counter() - cycles, n);
+    if (bytes == 0) {
+      std::cout << "empty result" << std::endl;
+    }
+  };
+
+  run("eager", [](Slice s) { return node::from_slice(s); });
+  run("lazy ", [](Slice s) { return node::lazy_from_slice(s); });
+}
+
+/*
+ * Extract of 50 paths, whole collections, single attributes and missing
+ * paths, compared to one get and set per path.
+ */
+void extract_bench(std::string const& filename) {
+  auto const base = node_from_file(filename);
+
+  container_stats stats;
+  std::vector<path_vector> leaves;
+  {
+    path_vector current;
+    walk(*base, current, stats, leaves);
+  }
+
+  std::vector<node::path_slice> paths;
+  for (std::size_t i = 0; paths.size() < 50; i++) {
+    auto path = leaves[(i * 7919) % leaves.size()];
+    switch (i % 5) {
+      case 0:  // a whole collection or database entry
+        path.resize(std::min<std::size_t>(path.size(), 5));
+        break;
+      case 1:  // does not exist
+        path.back() += "-missing";
+        break;
+      default:
+        break;
+    }
+    paths.push_back(to_path_slice(path));
+  }
+  paths.push_back(node::path_slice{"arango"s, "Plan"s, "Version"s});
+
+  auto const n = 10'000;
+  node_ptr trie, sequential;
+
+  auto cycles = cycle_counter();
+  auto dur = timed([&] {
+    for (int i = 0; i < n; i++) {
+      trie = base->extract(paths);
+    }
+  });
+  std::cout << paths.size() << " paths, trie       ";
+  print_per_op("extract", dur, cycle_counter() - cycles, n);
+
+  cycles = cycle_counter();
+  dur = timed([&] {
+    for (int i = 0; i < n; i++) {
+      sequential = node::empty_object();
+      for (auto const& path : paths) {
+        sequential = sequential->set(path, base->get(path));
+      }
+    }
+  });
+  std::cout << paths.size() << " paths, sequential ";
+  print_per_op("extract", dur, cycle_counter() - cycles, n);
+
+  if (!(*trie == *sequential)) {
+    std::cout << "DIFFERENT RESULT" << std::endl;
+  }
+}
+
+/*
+ * Parsing agency paths and reading and writing leaves with node_path
+ * compared to path_slice.
+ */
+void path_bench(std::string const& filename) {
+  auto const base = node_from_file(filename);
+
+  container_stats stats;
+  std::vector<path_vector> leaves;
+  {
+    path_vector current;
+    walk(*base, current, stats, leaves);
+  }
+
+  std::vector<std::string> strings;
+  std::vector<node::path_slice> slices;
+  std::vector<node_path> paths;
+  for (std::size_t i = 0; i < 1000; i++) {
+    auto const& leaf = leaves[(i * 7919) % leaves.size()];
+    std::string str;
+    for (auto const& segment : leaf) {
+      str += '/';
+      str += segment;
+    }
+    strings.push_back(str);
+    slices.push_back(to_path_slice(leaf));
+    paths.push_back(node_path::parse(str));
+  }
+
+  auto const n = 100;
+  std::size_t found = 0;
+
+  auto cycles = cycle_counter();
+  auto dur = timed([&] {
+    for (int i = 0; i < n; i++) {
+      for (auto const& str : strings) {
+        found += node_path::parse(str).size();
+      }
+    }
+  });
+  print_per_op("parse node_path ", dur, cycle_counter() - cycles, n * strings.size());
+
+  cycles = cycle_counter();
+  dur = timed([&] {
+    for (int i = 0; i < n; i++) {
+      for (auto const& str : strings) {
+        found += !to_path_slice(split_path(str)).empty();
+      }
+    }
+  });
+  print_per_op("parse path_slice", dur, cycle_counter() - cycles, n * strings.size());
+
+  cycles = cycle_counter();
+  dur = timed([&] {
+    for (int i = 0; i < n; i++) {
+      for (auto const& path : paths) {
+        found += base->get(path) != nullptr;
+      }
+    }
+  });
+  print_per_op("get node_path   ", dur, cycle_counter() - cycles, n * paths.size());
+
+  cycles = cycle_counter();
+  dur = timed([&] {
+    for (int i = 0; i < n; i++) {
+      for (auto const& path : slices) {
+        found += base->get(path) != nullptr;
+      }
+    }
+  });
+  print_per_op("get path_slice  ", dur, cycle_counter() - cycles, n * slices.size());
+
+  auto const value = node::value_node(1.0);
+  cycles = cycle_counter();
+  dur = timed([&] {
+    for (int i = 0; i < n; i++) {
+      for (auto const& path : paths) {
+        found += base->set(path, value) != nullptr;
+      }
+    }
+  });
+  print_per_op("set node_path   ", dur, cycle_counter() - cycles, n * paths.size());
+
+  cycles = cycle_counter();
+  dur = timed([&] {
+    for (int i = 0; i < n; i++) {
+      for (auto const& path : slices) {
+        found += base->set(path, value) != nullptr;
+      }
+    }
+  });
+  print_per_op("set path_slice  ", dur, cycle_counter() - cycles, n * slices.size());
+
+  std::cout << "(" << found << ")" << std::endl;
+}
+
+/*
+ * JSON dump of the whole tree through a velocypack builder and streamed
+ * directly from the nodes.
+ */
+void json_bench(std::string const& filename) {
+  auto const p = node_from_file(filename);
+  auto const n = 20;
+
+  auto run = [&](char const* name, auto&& dump) {
+    std::size_t bytes = 0;
+    auto const cycles = cycle_counter();
+    auto const dur = timed([&] {
+      for (int i = 0; i < n; i++) {
+        bytes += dump().size();
+      }
+    });
+    std::cout << name << " " << bytes / n << " bytes, ";
+    print_per_op("dump", dur, cycle_counter() - cycles, n);
+  };
+
+  auto const via_builder = [&] {
+    Builder builder;
+    p->into_builder(builder);
+    return builder.toJson();
+  };
+  auto const limit = node_vpack_cache::limit();
+  node_vpack_cache::set_limit(0);
+  run("builder, toJson ", via_builder);
+  node_vpack_cache::set_limit(limit);
+  run("builder, cached ", via_builder);
+  run("writer, sorted  ", [&] { return to_json(*p, node_json_options{true, false}); });
+  run("writer, unsorted", [&] { return to_json(*p); });
+  run("writer, pretty  ", [&] { return to_json(*p, node_json_options{true, true}); });
+}
+
+/*
+ * Parallel snapshot import with an increasing number of threads, checks that
+ * the result equals the serial import.
+ */
+void import_bench(std::string const& filename, std::size_t max_threads) {
+  std::stringstream ss;
+  ss << std::ifstream(filename).rdbuf();
+  auto const snapshot = Parser::fromJson(ss.str());
+
+  node_ptr serial;
+  auto dur = timed([&] { serial = node::from_slice(snapshot->slice()); });
+  std::cout << "serial     "
+            << std::chrono::duration_cast<std::chrono::duration<double>>(dur).count()
+            << "s" << std::endl;
+
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    node_work_pool pool{threads};
+    node_ptr parallel;
+    dur = timed([&] { parallel = node::from_slice(snapshot->slice(), pool); });
+    std::cout << "threads " << std::setw(2) << threads << " "
+              << std::chrono::duration_cast<std::chrono::duration<double>>(dur).count()
+              << "s" << (*parallel == *serial ? "" : " DIFFERENT RESULT") << std::endl;
+  }
+}
+
+struct chain_stats {
+  std::size_t objects = 0;
+  std::size_t single_member_objects = 0;
+  // runs of nested objects with a single member
+  std::size_t chains = 0;
+  std::size_t longest_chain = 0;
+  std::size_t leaves = 0;
+  std::size_t depth_sum = 0;
+  std::size_t collapsed_depth_sum = 0;
+  // the single member objects and their member's key
+  std::vector<std::pair<node_ptr, node_path>> singles;
+};
+
+/*
+ * `run` is the number of single member objects directly above `n`, they
+ * would be collapsed into a single node by path compression. Each of them
+ * saves a level: its key is merged into the one of its member.
+ */
+void walk_chains(node const& n, std::size_t depth, std::size_t collapsed_depth,
+                 std::size_t run, chain_stats& stats) {
+  auto const end_run = [&] {
+    if (run >= 1) {
+      stats.chains += 1;
+      stats.longest_chain = std::max(stats.longest_chain, run);
+    }
+  };
+  n.visit(visitor{
+      [&](node_object const& o) {
+        stats.objects += 1;
+        auto const single = o.size() == 1;
+        stats.single_member_objects += single;
+        if (!single) {
+          end_run();
+        }
+        if (single) {
+          o.visit_members([&](auto const& c) {
+            for (auto const& member : c) {
+              stats.singles.emplace_back(node_ptr{&n}, node_path::from_segments({member.first.str()}));
+            }
+          });
+        }
+        o.visit_members([&](auto const& c) {
+          for (auto const& member : c) {
+            auto const collapsed = single ? collapsed_depth : collapsed_depth + 1;
+            walk_chains(*member.second, depth + 1, collapsed, single ? run + 1 : 0, stats);
+          }
+        });
+      },
+      [&](node_array const& a) {
+        end_run();
+        for (std::size_t i = 0; i < a.size(); i++) {
+          walk_chains(*a.at(i), depth + 1, collapsed_depth + 1, 0, stats);
+        }
+      },
+      [&](auto const&) {
+        end_run();
+        stats.leaves += 1;
+        stats.depth_sum += depth;
+        stats.collapsed_depth_sum += collapsed_depth;
+      },
+  });
+}
+
+/*
+ * How much path compression, i.e. collapsing objects with a single member
+ * into the node of that member, would shorten the paths of a snapshot, what
+ * the level it saves costs, and the get and set latency by depth. There is
+ * no such representation: on agency dumps it saves about one level per
+ * path, mostly the root, and that level costs a few percent of a get or
+ * set. Run this on other dumps before reconsidering it.
+ */
+void chains_bench(std::string const& filename) {
+  auto const base = node_from_file(filename);
+
+  chain_stats chains;
+  walk_chains(*base, 0, 0, 0, chains);
+  std::cout << "objects " << chains.objects << ", " << chains.single_member_objects
+            << " with a single member" << std::endl;
+  std::cout << "chains " << chains.chains << ", longest " << chains.longest_chain << std::endl;
+  std::cout << "mean leaf depth " << double(chains.depth_sum) / chains.leaves
+            << ", with collapsed chains " << double(chains.collapsed_depth_sum) / chains.leaves
+            << std::endl;
+
+  // the cost of the level a collapsed object would save
+  {
+    auto const n = 1000;
+    std::size_t found = 0;
+    auto cycles = cycle_counter();
+    auto dur = timed([&] {
+      for (int i = 0; i < n; i++) {
+        for (auto const& [object, key] : chains.singles) {
+          found += object->get(key) != nullptr;
+        }
+      }
+    });
+    std::cout << "single member level, ";
+    print_per_op("get", dur, cycle_counter() - cycles, n * chains.singles.size());
+    auto const value = node::value_node(1.0);
+    cycles = cycle_counter();
+    dur = timed([&] {
+      for (int i = 0; i < n; i++) {
+        for (auto const& [object, key] : chains.singles) {
+          found += object->set(key, value) != nullptr;
+        }
+      }
+    });
+    std::cout << "single member level, ";
+    print_per_op("set", dur, cycle_counter() - cycles, n * chains.singles.size());
+    std::cout << "(" << found << ")" << std::endl;
+  }
+
+  container_stats stats;
+  std::vector<path_vector> leaves;
+  {
+    path_vector current;
+    walk(*base, current, stats, leaves);
+  }
+
+  std::map<std::size_t, std::vector<node_path>> by_depth;
+  for (std::size_t i = 0; i < leaves.size(); i++) {
+    auto const& leaf = leaves[(i * 7919) % leaves.size()];
+    auto& paths = by_depth[leaf.size()];
+    if (paths.size() < 1000) {
+      node_path path;
+      for (auto const& segment : leaf) {
+        path.push_back(segment);
+      }
+      paths.push_back(std::move(path));
+    }
+  }
+
+  auto const n = 100;
+  std::size_t found = 0;
+  for (auto const& [depth, paths] : by_depth) {
+    auto cycles = cycle_counter();
+    auto dur = timed([&] {
+      for (int i = 0; i < n; i++) {
+        for (auto const& path : paths) {
+          found += base->get(path) != nullptr;
+        }
+      }
+    });
+    std::cout << "depth " << std::setw(2) << depth << ", " << std::setw(4) << paths.size()
+              << " paths, ";
+    print_per_op("get", dur, cycle_counter() - cycles, n * paths.size());
+
+    auto const value = node::value_node(1.0);
+    cycles = cycle_counter();
+    dur = timed([&] {
+      for (int i = 0; i < n; i++) {
+        for (auto const& path : paths) {
+          found += base->set(path, value) != nullptr;
+        }
+      }
+    });
+    std::cout << "depth " << std::setw(2) << depth << ", " << std::setw(4) << paths.size()
+              << " paths, ";
+    print_per_op("set", dur, cycle_counter() - cycles, n * paths.size());
+  }
+  std::cout << "(" << found << ")" << std::endl;
+}
+
+/*
+ * Overlay of a snapshot by the delta of `k` modified leaves and by the
+ * modified snapshot itself, which shares most of its HAMT nodes with the
+ * base. Reads of a modified leaf through a node_overlay_view, compared to
+ * merging first.
+ */
+void overlay_bench(std::string const& filename) {
+  auto const base = node_from_file(filename);
+
+  container_stats stats;
+  std::vector<path_vector> leaves;
+  {
+    path_vector current;
+    walk(*base, current, stats, leaves);
+  }
+
+  for (std::size_t k : {1, 10, 100, 1000}) {
+    auto changed = base;
+    for (std::size_t i = 0; i < k; i++) {
+      auto const& leaf = leaves[(i * 7919) % leaves.size()];
+      changed = changed->set(to_path_slice(leaf), node::value_node(double(i)));
+    }
+    auto const delta = node::diff(base, changed).delta;
+    node_path read;
+    for (auto const& segment : leaves[0]) {
+      read.push_back(segment);
+    }
+
+    auto run = [&](char const* name, auto&& f) {
+      auto const n = 100;
+      auto const cycles = cycle_counter();
+      auto const dur = timed([&] {
+        for (int i = 0; i < n; i++) {
+          f();
+        }
+      });
+      std::cout << "changed " << std::setw(4) << k << " leaves, ";
+      print_per_op(name, dur, cycle_counter() - cycles, n);
+    };
+    run("overlay delta     ", [&] { return base->overlay(delta); });
+    run("overlay version   ", [&] { return base->overlay(changed); });
+    run("merge and read    ", [&] { return base->overlay(delta)->get(read); });
+    run("view read         ", [&] { return node_overlay_view{base, delta}.get(read); });
+  }
+}
+
+/*
+ * Snapshot import with and without hash-consing, memory of the result and
+ * of a second import of the same snapshot, which is shared completely up to
+ * the large subtrees when interned.
+ */
+void intern_bench(std::string const& filename) {
+  std::stringstream ss;
+  ss << std::ifstream(filename).rdbuf();
+  auto const snapshot = Parser::fromJson(ss.str());
+
+  auto run = [&](char const* name) {
+    node_ptr first, second;
+    auto const dur = timed([&] { first = node::from_slice(snapshot->slice()); });
+    second = node::from_slice(snapshot->slice());
+    auto const one = first->memory_usage();
+    auto const both = account_memory({first, second});
+    std::cout << name << " "
+              << std::chrono::duration_cast<std::chrono::duration<double>>(dur).count()
+              << "s, " << one.nodes << " nodes, " << one.bytes() / 1024 << "KiB, two imports "
+              << both.total.bytes() / 1024 << "KiB, "
+              << node_intern_table::size() << " interned" << std::endl;
+  };
+
+  run("plain   ");
+  node_intern_table::set_limit(1u << 24);
+  run("interned");
+  auto const dur = timed([&] { node_intern_table::sweep(); });
+  std::cout << "sweep " << std::chrono::duration_cast<std::chrono::microseconds>(dur).count()
+            << "us, " << node_intern_table::size() << " left" << std::endl;
+  node_intern_table::set_limit(0);
+}
+
+/*
+ * Comparison of two equal but separately imported snapshots, and of two
+ * snapshots differing in a single leaf. The first comparison computes the
+ * hashes, later ones use the cached hashes.
+ */
+void equality_bench(std::string const& filename) {
+  std::stringstream ss;
+  ss << std::ifstream(filename).rdbuf();
+  auto const snapshot = Parser::fromJson(ss.str());
+
+  auto const left = node::from_slice(snapshot->slice());
+  auto const right = node::from_slice(snapshot->slice());
+  auto const changed = right->set({"arango"s, "Plan"s, "Version"s}, node::value_node(1.0));
+
+  auto compare = [&](char const* name, node_ptr const& other, int n) {
+    bool equal = false;
+    auto const cycles = cycle_counter();
+    auto const dur = timed([&] {
+      for (int i = 0; i < n; i++) {
+        equal = *left == *other;
+      }
+    });
+    std::cout << name << (equal ? " (equal) " : " (unequal) ");
+    print_per_op("compare", dur, cycle_counter() - cycles, n);
+  };
+
+  compare("equal, cold    ", right, 1);
+  compare("equal, warm    ", right, 100);
+  compare("unequal, cold  ", changed, 1);
+  compare("unequal, warm  ", changed, 1'000'000);
+  std::cout << "root hash " << std::hex << left->hash() << std::dec << std::endl;
+}
+
+/*
+ * Set semantics on large arrays, e.g. `in` conditions and `erase` operations
+ * on lists of server ids. The first query builds the element index, the
+ * linear scan is what a query costs without it.
+ */
+void sets_bench(std::string const& filename) {
+  container_stats stats;
+  {
+    path_vector current;
+    std::vector<path_vector> leaves;
+    walk(*node_from_file(filename), current, stats, leaves);
+  }
+  std::cout << "large arrays in snapshot " << stats.large_arrays << std::endl;
+
+  auto const id = [](std::size_t i) {
+    return node::value_node("PRMR-" + std::to_string(i * 7919 % 1'000'003));
+  };
+  for (std::size_t size : {16, 256, 4096, 65536}) {
+    node_array array;
+    for (std::size_t i = 0; i < size; i++) {
+      array = array.push(id(i));
+    }
+    auto const hit = id(size / 2);
+    auto const miss = id(size + 1);
+    std::cout << "size " << size << std::endl;
+
+    auto const n = 1'000'000 / size + 1;
+    bool found = false;
+    auto cycles = cycle_counter();
+    auto dur = timed([&] {
+      for (std::size_t i = 0; i < n; i++) {
+        found = array.visit_elements([&](auto const& c) {
+          return std::any_of(c.begin(), c.end(), [&](node_ptr const& e) { return *e == *hit; });
+        });
+      }
+    });
+    print_per_op("  linear scan     ", dur, cycle_counter() - cycles, n);
+
+    // the derived arrays maintain the index of `array` once it is built
+    auto const push_and_shift = [&](char const* name) {
+      auto const cycles = cycle_counter();
+      auto const dur = timed([&] {
+        auto copy = array.push(miss);
+        for (std::size_t i = 0; i < n; i++) {
+          copy = copy.push(id(size + 2 + i)).shift();
+        }
+      });
+      print_per_op(name, dur, cycle_counter() - cycles, n);
+    };
+    push_and_shift("  push and shift  ");
+
+    cycles = cycle_counter();
+    dur = timed([&] { found = array.contains(miss); });
+    print_per_op("  first contains  ", dur, cycle_counter() - cycles, 1);
+
+    for (auto const& [name, needle] : {std::pair{"  contains hit    ", hit},
+                                       std::pair{"  contains miss   ", miss}}) {
+      cycles = cycle_counter();
+      dur = timed([&] {
+        for (int i = 0; i < 1'000'000; i++) {
+          found = array.contains(needle);
+        }
+      });
+      print_per_op(name, dur, cycle_counter() - cycles, 1'000'000);
+    }
+
+    std::size_t erased = 0;
+    for (auto const& [name, needle] : {std::pair{"  erase hit       ", hit},
+                                       std::pair{"  erase miss      ", miss}}) {
+      cycles = cycle_counter();
+      dur = timed([&] {
+        for (std::size_t i = 0; i < n; i++) {
+          erased += array.size() - array.erase(needle).size();
+        }
+      });
+      print_per_op(name, dur, cycle_counter() - cycles, n);
+    }
+
+    push_and_shift("  indexed p and s ");
+    static_cast<void>(found);
+    static_cast<void>(erased);
+  }
+}
+
+/*
+ * Latency of writes while some of them remove a large subtree, like dropping
+ * a database. Publishing the new root drops the last reference to the old
+ * version, which frees the subtree on the write path unless a reclaimer
+ * takes it.
+ */
+void reclaim_bench(std::string const& filename) {
+  auto const base = node_from_file(filename);
+  auto const removed = node_path::parse("arango/Current");
+  auto const target = node_path::parse("bench/removed");
+  auto const version = node_path::parse("arango/Plan/Version");
+
+  Builder subtree;
+  base->get(removed)->into_builder(subtree);
+
+  auto const percentile = [](std::vector<std::chrono::steady_clock::duration>& v, double p) {
+    std::sort(v.begin(), v.end());
+    auto const d = v[std::min(v.size() - 1, static_cast<std::size_t>(p * v.size()))];
+    return std::chrono::duration_cast<std::chrono::duration<double, std::micro>>(d).count();
+  };
+
+  auto run = [&](char const* name, node_reclaimer* reclaimer) {
+    std::vector<std::chrono::steady_clock::duration> small;
+    std::vector<std::chrono::steady_clock::duration> removing;
+    auto root = base;
+    auto const publish = [&](node_ptr next) {
+      if (reclaimer != nullptr) {
+        reclaimer->retire(std::exchange(root, std::move(next)));
+      } else {
+        root = std::move(next);
+      }
+    };
+
+    for (int round = 0; round < 20; round++) {
+      // a fresh copy, nothing of it is shared with other versions
+      publish(root->set(target, node::from_slice(subtree.slice())));
+      for (int i = 0; i < 50; i++) {
+        small.push_back(timed([&] {
+          publish(root->set(version, node::value_node(static_cast<double>(i))));
+        }));
+      }
+      removing.push_back(timed([&] { publish(root->set(target, nullptr)); }));
+    }
+    if (reclaimer != nullptr) {
+      reclaimer->drain();
+    }
+
+    std::cout << name << " small p50 " << percentile(small, 0.5) << "us, p99 "
+              << percentile(small, 0.99) << "us, removing p50 " << percentile(removing, 0.5)
+              << "us, max " << percentile(removing, 1.0) << "us" << std::endl;
+  };
+
+  run("inline   ", nullptr);
+  node_reclaimer reclaimer;
+  run("reclaimer", &reclaimer);
+  std::cout << "reclaimer freed " << reclaimer.freed_nodes() << " nodes" << std::endl;
+}
+
+/*
+ * Read throughput of 1 to `max_threads` readers while a writer publishes new
+ * versions continuously. A read takes a snapshot of the root and looks at its
+ * top level, which touches no reference count below the root. `shared_mutex`
+ * is how the store published its root before `node_root`.
+ */
+void readers_bench(std::string const& filename, std::size_t max_threads) {
+  auto const base = node_from_file(filename);
+  auto const version = node_path::parse("arango/Plan/Version");
+  auto const top_level = [](node const& n) {
+    return n.visit(visitor{[](node_object const& o) { return o.size(); },
+                           [](auto const&) { return std::size_t{0}; }});
+  };
+
+  struct locked_root {
+    mutable std::shared_mutex mutex;
+    node_ptr root;
+  };
+
+  auto run = [&](char const* name, std::size_t threads, auto const& read, auto const& write) {
+    // readers stop by themselves, a writer starved by the shared_mutex would
+    // never tell them
+    auto const start = std::chrono::steady_clock::now();
+    auto const deadline = start + std::chrono::milliseconds{200};
+    std::atomic<std::size_t> reads = 0;
+    std::atomic<std::size_t> checksum = 0;
+    std::size_t writes = 0;
+    std::vector<std::thread> readers;
+    for (std::size_t t = 0; t < threads; t++) {
+      readers.emplace_back([&] {
+        std::size_t count = 0;
+        std::size_t sum = 0;
+        while (count % 256 != 0 || std::chrono::steady_clock::now() < deadline) {
+          sum += read();
+          count += 1;
+        }
+        reads.fetch_add(count, std::memory_order_relaxed);
+        checksum.fetch_add(sum, std::memory_order_relaxed);
+      });
+    }
+
+    while (std::chrono::steady_clock::now() < deadline) {
+      write(static_cast<double>(writes++));
+    }
+    for (auto& t : readers) {
+      t.join();
+    }
+    auto const secs = std::chrono::duration_cast<std::chrono::duration<double>>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    std::cout << name << " threads " << std::setw(2) << threads << " "
+              << std::setw(8) << static_cast<std::size_t>(reads / secs / 1000)
+              << "k reads/s " << std::setw(6) << static_cast<std::size_t>(writes / secs)
+              << " writes/s" << std::endl;
+  };
+
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    locked_root locked{{}, base};
+    run("shared_mutex", threads,
+        [&] {
+          std::shared_lock guard(locked.mutex);
+          auto const root = locked.root;
+          guard.unlock();
+          return top_level(*root);
+        },
+        [&](double v) {
+          auto const current = [&] {
+            std::shared_lock guard(locked.mutex);
+            return locked.root;
+          }();
+          auto next = current->set(version, node::value_node(double{v}));
+          std::unique_lock guard(locked.mutex);
+          locked.root = std::move(next);
+        });
+
+    node_root root{base};
+    auto const write = [&](double v) {
+      root.store(root.load()->set(version, node::value_node(double{v})));
+    };
+    run("load        ", threads, [&] { return top_level(*root.load()); }, write);
+    run("pin         ", threads, [&] { return top_level(*root.pin()); }, write);
+  }
+}
+
+/*
+ * Write throughput of 1 to `max_threads` writers, each incrementing a
+ * counter of its own under the precondition that it exists. `mutex` applies
+ * and publishes every transaction alone, like the store did before group
+ * commit.
+ */
+void writers_bench(std::string const& filename, std::size_t max_threads) {
+  auto const base = node_from_file(filename);
+
+  struct mutex_store {
+    std::mutex mutex;
+    node_root root;
+
+    node_ptr transact(std::vector<node::fold_action<bool>> const& preconditions,
+                      std::vector<node::transform_action> const& operations) {
+      std::unique_lock guard(mutex);
+      auto const current = root.load();
+      auto const holds = std::all_of(preconditions.begin(), preconditions.end(), [&](auto const& p) {
+        return p.second(current->get(p.first));
+      });
+      if (!holds) {
+        return nullptr;
+      }
+      auto next = current->transform(operations);
+      root.store(next);
+      return next;
+    }
+  };
+
+  auto run = [&](char const* name, std::size_t threads, auto& store) {
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{200};
+    std::atomic<std::size_t> writes = 0;
+    std::atomic<std::size_t> failed = 0;
+    std::vector<std::thread> writers;
+    for (std::size_t t = 0; t < threads; t++) {
+      writers.emplace_back([&, t] {
+        auto const counter = node::path_slice{"bench"s, "writers"s, std::to_string(t)};
+        std::size_t count = 0;
+        while (std::chrono::steady_clock::now() < deadline) {
+          auto const result = store.transact(
+              {{counter, is_empty_condition{true}}},
+              {{counter, increment_operator{}}});
+          failed.fetch_add(result == nullptr ? 1 : 0, std::memory_order_relaxed);
+          count += 1;
+        }
+        writes.fetch_add(count, std::memory_order_relaxed);
+      });
+    }
+    for (auto& t : writers) {
+      t.join();
+    }
+    std::cout << name << " threads " << std::setw(2) << threads << " " << std::setw(8)
+              << writes * 5 / 1000 << "k writes/s"
+              << (failed == 0 ? "" : " PRECONDITION FAILED") << std::endl;
+  };
+
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    std::vector<node::transform_action> counters;
+    for (std::size_t t = 0; t < threads; t++) {
+      counters.emplace_back(node::path_slice{"bench"s, "writers"s, std::to_string(t)},
+                            set_operator{node::value_node(0.0)});
+    }
+    auto const start = base->transform(counters);
+
+    mutex_store locked{{}, node_root{start}};
+    run("mutex       ", threads, locked);
+    store_base grouped{start};
+    run("group commit", threads, grouped);
+  }
+}
+
+/*
+ * Writers with an expensive precondition: each compares a subtree of its own
+ * with a value that is freshly read from velocypack, like the `old` of a
+ * request, and increments a counter next to it. `combiner` evaluates the
+ * preconditions while committing, `optimistic` before queueing the write.
+ * The hot writer has no preconditions and waits for the combiner only.
+ */
+void optimistic_bench(std::string const& filename, std::size_t max_threads) {
+  auto const base = node_from_file(filename);
+
+  Builder expected;
+  {
+    ObjectBuilder object(&expected);
+    for (int i = 0; i < 200; i++) {
+      expected.add(std::to_string(i), Value(static_cast<double>(i)));
+    }
+  }
+
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    std::vector<node::transform_action> setup;
+    for (std::size_t t = 0; t < threads; t++) {
+      setup.emplace_back(node::path_slice{"bench"s, "optimistic"s, std::to_string(t), "data"s},
+                         set_operator{node::from_slice(expected.slice())});
+      setup.emplace_back(node::path_slice{"bench"s, "optimistic"s, std::to_string(t), "counter"s},
+                         set_operator{node::value_node(0.0)});
+    }
+    auto const start = base->transform(setup);
+
+    auto run = [&](char const* name, bool optimistic) {
+      store_base store{start};
+      auto const deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds{200};
+      std::atomic<std::size_t> writes = 0;
+      std::atomic<std::size_t> failed = 0;
+      std::vector<std::thread> writers;
+      for (std::size_t t = 0; t < threads; t++) {
+        writers.emplace_back([&, t] {
+          auto const data = node::path_slice{"bench"s, "optimistic"s, std::to_string(t), "data"s};
+          auto const counter = node::path_slice{"bench"s, "optimistic"s, std::to_string(t), "counter"s};
+          std::vector<node::transform_action> const operations{{counter, increment_operator{}}};
+          std::size_t count = 0;
+          while (std::chrono::steady_clock::now() < deadline) {
+            std::vector<node::fold_action<bool>> const preconditions{
+                {data, equal_condition{node::from_slice(expected.slice())}}};
+            auto const result = optimistic ? store.transact_optimistic(preconditions, operations)
+                                           : store.transact(preconditions, operations);
+            failed.fetch_add(result == nullptr ? 1 : 0, std::memory_order_relaxed);
+            count += 1;
+          }
+          writes.fetch_add(count, std::memory_order_relaxed);
+        });
+      }
+      // a writer without preconditions next to them
+      std::size_t hot_writes = 0;
+      auto const hot = node::path_slice{"bench"s, "hot"s};
+      while (std::chrono::steady_clock::now() < deadline) {
+        store.write({{hot, increment_operator{}}});
+        hot_writes += 1;
+      }
+      for (auto& t : writers) {
+        t.join();
+      }
+      std::cout << name << " threads " << std::setw(2) << threads << " " << std::setw(8)
+                << writes * 5 / 1000 << "k writes/s, hot writer " << std::setw(6)
+                << hot_writes * 5 / 1000 << "k writes/s, " << store.optimistic_conflicts()
+                << " conflicts" << (failed == 0 ? "" : " PRECONDITION FAILED") << std::endl;
+    };
+    run("combiner  ", false);
+    run("optimistic", true);
+  }
+}
+
+/*
+ * Transactions with `k` preconditions on attributes of collections in the
+ * plan and one operation per precondition, checked by one lookup per
+ * precondition up to the first that fails and by a cached plan, the cost of
+ * looking the plan up is shown on its own. Failing transactions fail either
+ * on their first or on their last precondition.
+ */
+void plan_bench(std::string const& filename) {
+  auto const base = node_from_file(filename);
+
+  std::vector<std::string> collections;
+  base->get({"arango"s, "Plan"s, "Collections"s})->visit(visitor{
+      [&](node_object const& databases) {
+        databases.visit_members([&](auto const& dbs) {
+          for (auto const& db : dbs) {
+            db.second->visit(visitor{
+                [&](node_object const& colls) {
+                  colls.visit_members([&](auto const& cs) {
+                    for (auto const& c : cs) {
+                      collections.push_back("arango/Plan/Collections/" + db.first.str() + "/" +
+                                            c.first.str());
+                    }
+                  });
+                },
+                [](auto const&) {}});
+          }
+        });
+      },
+      [](auto const&) {}});
+  if (collections.empty()) {
+    std::cout << "no collections in /arango/Plan/Collections" << std::endl;
+    return;
+  }
+
+  auto const attributes = std::vector<std::string>{"status", "waitForSync", "replicationFactor",
+                                                   "cacheEnabled"};
+  auto const value = node::value_node(4.0);
+  auto const assign = node::transformation{[&](node_ptr const&) { return value; }};
+  auto const version = node_path::parse("arango/Plan/Version");
+
+  enum class failure { none, first, last };
+  for (std::size_t k : {10, 50, 100, 200}) {
+    for (auto const failing : {failure::none, failure::first, failure::last}) {
+      node_transaction_plan::precondition_list preconditions;
+      node_transaction_plan::operation_list operations;
+      preconditions.emplace_back(
+          version, equal_condition{failing == failure::first ? node::value_node(-1.0)
+                                                             : base->get(version)});
+      for (std::size_t i = 0; i + 1 < k; i++) {
+        auto const path = node_path::parse(
+            collections[(i / attributes.size() * 7919) % collections.size()] + "/" +
+            attributes[i % attributes.size()]);
+        auto const current = base->get(path);
+        if (failing == failure::last && i + 2 == k) {
+          preconditions.emplace_back(path, equal_condition{node::value_node(-1.0)});
+        } else if (current == nullptr) {
+          preconditions.emplace_back(path, is_empty_condition{false});
+        } else {
+          preconditions.emplace_back(path, equal_condition{current});
+        }
+        operations.emplace_back(path, assign);
+      }
+
+      auto const label = failing == failure::none    ? "               "
+                         : failing == failure::first ? ", failing first"
+                                                     : ", failing last ";
+      auto const n = std::max<std::size_t>(1, 20'000 / k);
+      node_ptr looked_up, planned;
+      auto cycles = cycle_counter();
+      auto dur = timed([&] {
+        for (std::size_t i = 0; i < n; i++) {
+          auto const holds =
+              std::all_of(preconditions.begin(), preconditions.end(), [&](auto const& p) {
+                return p.second(base->get(p.first));
+              });
+          looked_up = holds ? base->transform(operations) : nullptr;
+        }
+      });
+      std::cout << std::setw(3) << k << " preconditions" << label << ", lookups ";
+      print_per_op("transaction", dur, cycle_counter() - cycles, n);
+
+      // the store looks the plan up before the transaction is queued, only
+      // `execute` runs while holding up other writers
+      node_plan_cache cache;
+      std::shared_ptr<node_transaction_plan const> plan;
+      cycles = cycle_counter();
+      dur = timed([&] {
+        for (std::size_t i = 0; i < n; i++) {
+          plan = cache.get(preconditions);
+        }
+      });
+      std::cout << std::setw(3) << k << " preconditions" << label << ", lookup  ";
+      print_per_op("plan", dur, cycle_counter() - cycles, n);
+
+      std::optional<std::size_t> failed;
+      cycles = cycle_counter();
+      dur = timed([&] {
+        for (std::size_t i = 0; i < n; i++) {
+          auto result = plan->execute(base, preconditions, operations);
+          planned = std::move(result.root);
+          failed = result.failed_precondition;
+        }
+      });
+      std::cout << std::setw(3) << k << " preconditions" << label << ", plan    ";
+      print_per_op("transaction", dur, cycle_counter() - cycles, n);
+
+      auto const expected_failure = failing == failure::first ? std::optional<std::size_t>{0}
+                                    : failing == failure::last ? std::optional<std::size_t>{k - 1}
+                                                               : std::nullopt;
+      if ((looked_up == nullptr) != (planned == nullptr) ||
+          (planned != nullptr && !(*looked_up == *planned)) || failed != expected_failure) {
+        std::cout << "DIFFERENT RESULT" << std::endl;
+      }
+      if (cache.hits() + 1 != n || cache.misses() != 1) {
+        std::cout << "PLAN NOT CACHED" << std::endl;
+      }
+    }
+  }
+}
+
+/*
+ * Expiry of `n` paths with a time to live of up to ten minutes in ticks of
+ * 100ms: setting, refreshing and removing them and advancing the wheel
+ * tick by tick, in comparison to the linear list the store used before.
+ * Then paths in a store that expire within a second, removed by one write
+ * per tick.
+ */
+void ttl_bench(std::string const& filename) {
+  auto const base = node_from_file(filename);
+
+  auto const key = [](std::size_t i) { return "/bench/ttl/" + std::to_string(i); };
+  auto const expiry = [](std::size_t i) -> node_ttl_wheel::tick_type {
+    return 1 + (i * 7919) % 6000;
+  };
+
+  for (std::size_t n : {10'000, 1'000'000}) {
+    std::vector<std::string> keys;
+    for (std::size_t i = 0; i < n; i++) {
+      keys.push_back(key(i));
+    }
+
+    node_ttl_wheel wheel;
+    auto cycles = cycle_counter();
+    auto dur = timed([&] {
+      for (std::size_t i = 0; i < n; i++) {
+        wheel.set(keys[i], expiry(i));
+      }
+    });
+    std::cout << std::setw(7) << n << " keys, wheel  ";
+    print_per_op("set    ", dur, cycle_counter() - cycles, n);
+
+    cycles = cycle_counter();
+    dur = timed([&] {
+      for (std::size_t i = 0; i < n; i++) {
+        wheel.set(keys[i], expiry(i + 1));
+      }
+    });
+    std::cout << std::setw(7) << n << " keys, wheel  ";
+    print_per_op("refresh", dur, cycle_counter() - cycles, n);
+
+    cycles = cycle_counter();
+    dur = timed([&] {
+      for (std::size_t i = 0; i < n; i += 10) {
+        wheel.remove(keys[i]);
+      }
+    });
+    std::cout << std::setw(7) << n << " keys, wheel  ";
+    print_per_op("remove ", dur, cycle_counter() - cycles, n / 10);
+
+    std::size_t expired_count = 0;
+    std::size_t largest_batch = 0;
+    std::vector<std::string> expired;
+    cycles = cycle_counter();
+    dur = timed([&] {
+      for (node_ttl_wheel::tick_type t = 1; t <= 6001; t++) {
+        expired.clear();
+        wheel.advance(t, expired);
+        expired_count += expired.size();
+        largest_batch = std::max(largest_batch, expired.size());
+      }
+    });
+    std::cout << std::setw(7) << n << " keys, wheel  ";
+    print_per_op("expire ", dur, cycle_counter() - cycles, expired_count);
+    std::cout << "  " << expired_count << " expired in 6000 ticks, at most " << largest_batch
+              << " per tick" << (expired_count + wheel.size() == n - n / 10 ? "" : " LOST KEYS")
+              << std::endl;
+
+    if (n > 10'000) {
+      continue;
+    }
+    // a linear search per set and a scan per tick
+    struct ttl_entry {
+      std::string path;
+      node_ttl_wheel::tick_type expiry;
+    };
+    std::vector<ttl_entry> list;
+    cycles = cycle_counter();
+    dur = timed([&] {
+      for (std::size_t i = 0; i < n; i++) {
+        auto at = std::find_if(list.begin(), list.end(),
+                               [&](ttl_entry const& e) { return e.path == keys[i]; });
+        if (at == list.end()) {
+          list.push_back({keys[i], expiry(i)});
+        } else {
+          at->expiry = expiry(i);
+        }
+      }
+    });
+    std::cout << std::setw(7) << n << " keys, list   ";
+    print_per_op("set    ", dur, cycle_counter() - cycles, n);
+
+    cycles = cycle_counter();
+    dur = timed([&] {
+      for (node_ttl_wheel::tick_type t = 1; t <= 600; t++) {
+        list.erase(std::remove_if(list.begin(), list.end(),
+                                  [&](ttl_entry const& e) { return e.expiry <= t; }),
+                   list.end());
+      }
+    });
+    std::cout << std::setw(7) << n << " keys, list   ";
+    print_per_op("tick   ", dur, cycle_counter() - cycles, 600);
+  }
+
+  std::size_t const n = 100'000;
+  auto const tick = std::chrono::milliseconds{10};
+  std::vector<node::transform_action> setup;
+  for (std::size_t i = 0; i < n; i++) {
+    setup.emplace_back(node::path_slice{"bench"s, "ttl"s, std::to_string(i)},
+                       set_operator{node::value_node(double(i))});
+  }
+  store_base store{base->transform(setup), tick};
+  auto const start = store_base::clock_type::now();
+  for (std::size_t i = 0; i < n; i++) {
+    store.set_ttl(key(i), tick * (1 + (i * 7919) % 100));
+  }
+
+  std::size_t writes = 0;
+  std::size_t removed = 0;
+  auto const cycles = cycle_counter();
+  auto const dur = timed([&] {
+    // setting the keys took some ticks of their own
+    for (std::size_t t = 1; store.ttl_count() > 0 && t < 1000; t++) {
+      auto const count = store.expire_ttl(start + t * tick);
+      writes += count == 0 ? 0 : 1;
+      removed += count;
+    }
+  });
+  std::cout << std::setw(7) << n << " keys, store  " << removed << " removed by " << writes
+            << " writes, ";
+  print_per_op("per key", dur, cycle_counter() - cycles, removed);
+  if (removed != n || store.read()->get({"bench"s, "ttl"s, "0"s}) != nullptr) {
+    std::cout << "KEYS LEFT" << std::endl;
+  }
+}
+
+/*
+ * Diff between a snapshot and a version with `k` modified leaves, in
+ * comparison to walking the whole tree.
+ */
+void diff_bench(std::string const& filename) {
+  auto const base = node_from_file(filename);
+
+  container_stats stats;
+  std::vector<path_vector> leaves;
+  {
+    path_vector current;
+    walk(*base, current, stats, leaves);
+  }
+
+  auto dur = timed([&] {
+    path_vector current;
+    container_stats unused;
+    std::vector<path_vector> unused_leaves;
+    walk(*base, current, unused, unused_leaves);
+  });
+  std::cout << "full walk " << std::chrono::duration_cast<std::chrono::microseconds>(dur).count()
+            << "us" << std::endl;
+
+  node_work_pool pool;
+  for (std::size_t k : {1, 10, 100, 1000}) {
+    auto changed = base;
+    for (std::size_t i = 0; i < k; i++) {
+      auto const& leaf = leaves[(i * 7919) % leaves.size()];
+      changed = changed->set(to_path_slice(leaf), node::value_node(double(i)));
+    }
+
+    auto const n = 100;
+    std::size_t operations = 0;
+    auto const cycles = cycle_counter();
+    dur = timed([&] {
+      for (int i = 0; i < n; i++) {
+        operations = node::diff(base, changed, pool).operations.size();
+      }
+    });
+    std::cout << "changed " << std::setw(4) << k << " leaves, " << std::setw(4)
+              << operations << " operations, ";
+    print_per_op("diff", dur, cycle_counter() - cycles, n);
+  }
+}
+
+/*
+ * Agency style transactions of `k` operations, each touching a few
+ * attributes of collections in the plan and increasing the plan version,
+ * applied by the batched transform and by one set per operation.
+ */
+void transform_bench(std::string const& filename) {
+  auto const base = node_from_file(filename);
+
+  std::vector<std::pair<std::string, std::string>> collections;
+  base->get({"arango"s, "Plan"s, "Collections"s})->visit(visitor{
+      [&](node_object const& databases) {
+        databases.visit_members([&](auto const& dbs) {
+          for (auto const& db : dbs) {
+            db.second->visit(visitor{
+                [&](node_object const& colls) {
+                  colls.visit_members([&](auto const& cs) {
+                    for (auto const& c : cs) {
+                      collections.emplace_back(db.first.str(), c.first.str());
+                    }
+                  });
+                },
+                [](auto const&) {}});
+          }
+        });
+      },
+      [](auto const&) {}});
+  if (collections.empty()) {
+    std::cout << "no collections in /arango/Plan/Collections" << std::endl;
+    return;
+  }
+
+  auto const attributes = std::vector<std::string>{"status", "waitForSync", "replicationFactor",
+                                                   "cacheEnabled"};
+  auto const value = node::value_node(4.0);
+  auto const increment = node::transformation{[](node_ptr const& n) {
+    auto version = 0.0;
+    if (n != nullptr) {
+      n->visit(visitor{[&](node_double const& d) { version = d.value; }, [](auto const&) {}});
+    }
+    return node::value_node(version + 1.0);
+  }};
+  auto const assign = node::transformation{[&](node_ptr const&) { return value; }};
+
+  for (std::size_t k : {10, 50, 100, 200}) {
+    std::vector<std::pair<node::path_slice, node::transformation>> operations;
+    for (std::size_t i = 0; i + 1 < k; i++) {
+      auto const& [db, coll] = collections[(i / attributes.size() * 7919) % collections.size()];
+      operations.emplace_back(
+          node::path_slice{"arango"s, "Plan"s, "Collections"s, db, coll,
+                           attributes[i % attributes.size()]},
+          assign);
+    }
+    operations.emplace_back(node::path_slice{"arango"s, "Plan"s, "Version"s}, increment);
+
+    auto const n = std::max<std::size_t>(1, 20'000 / k);
+    node_ptr batched, sequential;
+
+    auto cycles = cycle_counter();
+    auto dur = timed([&] {
+      for (std::size_t i = 0; i < n; i++) {
+        batched = base->transform(operations);
+      }
+    });
+    std::cout << std::setw(3) << k << " operations, batched    ";
+    print_per_op("transaction", dur, cycle_counter() - cycles, n);
+
+    cycles = cycle_counter();
+    dur = timed([&] {
+      for (std::size_t i = 0; i < n; i++) {
+        sequential = base;
+        for (auto const& [path, op] : operations) {
+          sequential = sequential->set(path, op(sequential->get(path)));
+        }
+      }
+    });
+    std::cout << std::setw(3) << k << " operations, sequential ";
+    print_per_op("transaction", dur, cycle_counter() - cycles, n);
+
+    if (!(*batched == *sequential)) {
+      std::cout << "DIFFERENT RESULT" << std::endl;
+    }
+  }
+}
+
+/*
+ * Full serialization of the tree after a single write, with and without the
+ * serialization cache.
+ */
+void serialize_bench(std::string const& filename) {
+  auto const base = node_from_file(filename);
+
+  container_stats stats;
+  std::vector<path_vector> leaves;
+  {
+    path_vector current;
+    walk(*base, current, stats, leaves);
+  }
+  std::vector<node::path_slice> paths;
+  for (std::size_t i = 0; i < 1000; i++) {
+    paths.push_back(to_path_slice(leaves[(i * 7919) % leaves.size()]));
+  }
+
+  auto run = [&](char const* name) {
+    auto p = base;
+    std::size_t bytes = 0;
+    auto const cycles = cycle_counter();
+    auto const dur = timed([&] {
+      for (std::size_t i = 0; i < paths.size(); i++) {
+        p = p->set(paths[i], node::value_node(double(i)));
+        Builder builder;
+        p->into_builder(builder);
+        bytes += builder.size();
+      }
+    });
+    std::cout << name << " ";
+    print_per_op("write and read", dur, cycle_counter() - cycles, paths.size());
+    std::cout << name << " " << bytes / paths.size() << " bytes per read, "
+              << node_vpack_cache::used() / 1024 << "KiB cached" << std::endl;
+  };
+
+  auto const limit = node_vpack_cache::limit();
+  node_vpack_cache::set_limit(0);
+  run("uncached");
+  node_vpack_cache::set_limit(limit);
+  run("cached  ");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc > 2) {
+    auto const bench = std::string{argv[1]};
+    if (bench == "chains") {
+      chains_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "containers") {
+      containers_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "diff") {
+      diff_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "equality") {
+      equality_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "extract") {
+      extract_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "intern") {
+      intern_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "json") {
+      json_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "import") {
+      auto const max_threads = argc > 3 ? std::stoul(argv[3])
+                                        : std::max(1u, std::thread::hardware_concurrency());
+      import_bench(argv[2], max_threads);
+      return EXIT_SUCCESS;
+    } else if (bench == "path") {
+      path_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "optimistic") {
+      auto const max_threads = argc > 3 ? std::stoul(argv[3]) : 32;
+      optimistic_bench(argv[2], max_threads);
+      return EXIT_SUCCESS;
+    } else if (bench == "overlay") {
+      overlay_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "payload") {
+      payload_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "plan") {
+      plan_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "sets") {
+      sets_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "readers") {
+      auto const max_threads = argc > 3 ? std::stoul(argv[3]) : 64;
+      readers_bench(argv[2], max_threads);
+      return EXIT_SUCCESS;
+    } else if (bench == "reclaim") {
+      reclaim_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "ttl") {
+      ttl_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "writers") {
+      auto const max_threads = argc > 3 ? std::stoul(argv[3]) : 32;
+      writers_bench(argv[2], max_threads);
+      return EXIT_SUCCESS;
+    } else if (bench == "serialize") {
+      serialize_bench(argv[2]);
+      return EXIT_SUCCESS;
+    } else if (bench == "transform") {
+      transform_bench(argv[2]);
+      return EXIT_SUCCESS;
+    }
+  }
+
+  std::cerr << "usage: " << argv[0] << " chains|containers|diff|equality|extract|import|intern|json|optimistic|overlay|path|payload|plan|readers|reclaim|serialize|sets|transform|ttl|writers <snapshot.json> [max threads]" << std::endl;
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,83 @@
+#include <iomanip>
+#include <iostream>
+
+#include "node-editor.h"
+#include "node-memory.h"
+#include "node-path.h"
+#include "node.h"
+#include "test-helper.h"
+
+namespace {
+
+void print_usage(std::string const& name, node_memory_usage const& usage) {
+  std::cout << name << " " << usage.nodes << " nodes, " << usage.bytes() / 1024
+            << "KiB (" << usage.unique_bytes / 1024 << "KiB unique, "
+            << usage.shared_bytes / 1024 << "KiB shared)" << std::endl;
+}
+
+/*
+ * The second version is built from the first one by applying the changes,
+ * like the store does. Loading it separately would share nothing.
+ */
+node_ptr next_version(node_ptr const& v1, std::string const& filename) {
+  auto const other = node_from_file(filename);
+  node_editor editor{v1};
+  for (auto const& op : node::diff(v1, other).operations) {
+    editor.set(op.path, op.value);
+  }
+  return std::move(editor).finish();
+}
+
+// without a second snapshot a leaf is written below each heavy path
+node_ptr next_version(node_ptr const& v1, std::vector<node_memory_path> const& heaviest) {
+  node_editor editor{v1};
+  for (auto const& p : heaviest) {
+    auto path = node_path::parse(p.path);
+    path.push_back("mem-report");
+    editor.set(path, node::value_node(true));
+  }
+  return std::move(editor).finish();
+}
+
+void mem_report(std::string const& filename, std::string const& other,
+                std::size_t count, std::size_t max_depth) {
+  auto const v1 = node_from_file(filename);
+
+  std::vector<node_memory_path> heaviest;
+  auto const dur = timed([&] { heaviest = heaviest_paths(v1, count, max_depth); });
+  std::cout << "heaviest paths ("
+            << std::chrono::duration_cast<std::chrono::milliseconds>(dur).count()
+            << "ms)" << std::endl;
+  for (auto const& p : heaviest) {
+    std::cout << std::setw(10) << p.bytes / 1024 << "KiB " << std::setw(10)
+              << p.nodes << " nodes  " << p.path << std::endl;
+  }
+
+  auto const v2 = other.empty() ? next_version(v1, heaviest) : next_version(v1, other);
+
+  node_memory_report report;
+  auto const account_dur = timed([&] { report = account_memory({v1, v2}); });
+  std::cout << "two versions ("
+            << std::chrono::duration_cast<std::chrono::milliseconds>(account_dur).count()
+            << "ms)" << std::endl;
+  print_usage("v1   ", report.roots[0]);
+  print_usage("v2   ", report.roots[1]);
+  print_usage("total", report.total);
+  std::cout << "sharing ratio " << std::setprecision(3) << report.sharing_ratio()
+            << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc > 1) {
+    auto const other = argc > 2 ? std::string{argv[2]} : std::string{};
+    auto const count = argc > 3 ? std::stoul(argv[3]) : 20;
+    auto const max_depth = argc > 4 ? std::stoul(argv[4]) : 4;
+    mem_report(argv[1], other == "-" ? std::string{} : other, count, max_depth);
+    return EXIT_SUCCESS;
+  }
+
+  std::cerr << "usage: " << argv[0] << " <snapshot.json> [<other snapshot.json>|-] [top n] [max depth]" << std::endl;
+  return EXIT_FAILURE;
+}
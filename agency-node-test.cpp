@@ -1,10 +1,18 @@
+#include <chrono>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <stdexcept>
+#include <thread>
 
 #include "helper-immut.h"
 
 #include "node-conditions.h"
+#include "node-editor.h"
+#include "node-intern.h"
+#include "node-json.h"
+#include "node-ttl.h"
 #include "node-operations.h"
 #include "store.h"
 
@@ -188,6 +196,271 @@ void store_test() {
   std::cout << store << std::endl;
 }
 
+void transform_test() {
+  std::cout << "transform" << std::endl;
+  auto n = node::from_buffer_ptr(R"=({"a":{"b":1,"c":[1,2]},"d":2})="_vpack);
+
+  // every action sees the result of the previous ones, like one transform per action
+  auto const check = [&](std::vector<node::transform_action> const& actions) {
+    auto result = n->transform(actions);
+    auto sequential = n;
+    for (auto const& action : actions) {
+      sequential = sequential->transform({action});
+    }
+    std::cout << *result << " " << std::boolalpha << (*result == *sequential) << std::endl;
+  };
+
+  check({
+      {{"a"s, "b"s}, increment_operator{}},
+      {{"a"s, "b"s}, increment_operator{}},
+  });
+  check({
+      {{"a"s}, set_operator{node::empty_object()}},
+      {{"a"s, "x"s}, set_operator{node::value_node(1.0)}},
+  });
+  check({
+      {{"a"s, "c"s, "0"s}, set_operator{node::value_node(7.0)}},
+      {{"a"s, "c"s}, pop_operator{}},
+  });
+  check({
+      {{"a"s, "c"s}, push_operator{node::value_node(3.0)}},
+      {{"a"s, "c"s, "2"s}, increment_operator{}},
+      {{"d"s}, remove_operator{}},
+  });
+  check({
+      {{"a"s, "c"s, "1"s, "x"s}, set_operator{node::value_node(true)}},
+      {{"a"s, "b"s, "y"s}, set_operator{node::value_node(false)}},
+      {{"e"s, "f"s}, increment_operator{}},
+  });
+}
+
+void extract_test() {
+  std::cout << "extract" << std::endl;
+  auto n = node::from_buffer_ptr(R"=({"a":{"b":1,"c":{"d":2,"e":[3]}},"f":[4,5],"g":"h"})="_vpack);
+
+  auto const extract = [&](std::vector<node::path_slice> const& paths) {
+    auto result = n->extract(paths);
+    std::cout << *result << std::endl;
+    return result;
+  };
+
+  // a requested subtree is shared with the source
+  auto shared = extract({{"a"s, "c"s}, {"g"s}});
+  std::cout << std::boolalpha
+            << (shared->get({"a"s, "c"s}).get() == n->get({"a"s, "c"s}).get()) << std::endl;
+  // a path covered by a shorter one does not matter, whatever the order
+  extract({{"a"s, "c"s, "d"s}, {"a"s}, {"a"s, "c"s}});
+  extract({{"a"s}, {"a"s, "c"s, "d"s}});
+  // missing paths are omitted, their parents are created
+  extract({{"x"s, "y"s}, {"a"s, "z"s}, {"f"s, "0"s}});
+  extract({{"g"s}, {"a"s, "b"s}, {"g"s}});
+  extract({});
+}
+
+void json_test() {
+  std::cout << "json" << std::endl;
+  auto const buffer = R"=({"a\"b\\c":"x\u0001\n\t\u001f/\u00e9\u20ac\ud83d\ude00","e":[],"o":{},
+      "n":[{},[],-1.5,1e300,0.1,12345678901234,-7,true,null],"deep":{"x":{"y":[[{"z":null}]]}}})="_vpack;
+  auto const slice = Slice(buffer.data());
+
+  // sorted keys and the same layout as velocypack, for the node and for a lazy node
+  for (auto const& n : {node::from_slice(slice), node::lazy_from_slice(slice)}) {
+    for (bool const pretty : {false, true}) {
+      Builder builder;
+      n->into_builder(builder);
+      Options options;
+      options.prettyPrint = pretty;
+      auto const expected = builder.slice().toJson(&options);
+      auto const json = to_json(*n, node_json_options{true, pretty});
+      std::cout << std::boolalpha << (json == expected) << std::endl;
+    }
+  }
+  std::cout << to_json(*node::from_slice(slice), node_json_options{true, false}) << std::endl;
+}
+
+void path_test() {
+  std::cout << "path" << std::endl;
+  // slashes at the ends and empty segments are dropped
+  for (auto const text : {"", "/", "//", "a", "/a/b", "a/b/", "//a///b//", "/arango/Plan/0/00/-1"}) {
+    auto const path = node_path::parse(text);
+    std::cout << std::quoted(text) << " " << path.size() << " " << path.to_string();
+    for (auto const& segment : path) {
+      std::cout << " " << segment.name();
+      if (segment.is_index()) {
+        std::cout << "#" << segment.index;
+      }
+    }
+    std::cout << std::endl;
+  }
+
+  std::cout << std::boolalpha << (node_path::parse("//a///b/") == node_path::from_segments({"a", "b"}))
+            << " " << (node_path::parse("/a/b") == node_path::parse("/a/b/c")) << std::endl;
+
+  // a copy shares the parsed text, appending to it leaves the original alone
+  auto const original = node_path::parse("/a/b");
+  auto extended = original;
+  extended.push_back("c");
+  std::cout << original.to_string() << " " << extended.to_string() << std::endl;
+
+  // lookups do not depend on how the path was written
+  auto n = node::from_buffer_ptr(R"=({"a":{"b":[1,{"c":2}]}})="_vpack);
+  std::cout << *n->get(node_path::parse("a//b/1/c/")) << " "
+            << (n->get(node_path::parse("/a/b/01")) == nullptr) << std::endl;
+}
+
+void group_commit_test() {
+  std::cout << "group commit" << std::endl;
+  store_base store{node::empty_object()};
+
+  // the first transaction holds up the combiner until the others are queued,
+  // they are committed as one group
+  std::promise<void> started, queued;
+  auto first = std::async(std::launch::async, [&] {
+    return store.write({{{"a"s}, [&](node_ptr const&) {
+                           started.set_value();
+                           queued.get_future().wait();
+                           return node::value_node(1.0);
+                         }}});
+  });
+  started.get_future().wait();
+
+  auto second = store.write_async({{{"b"s}, set_operator{node::value_node(2.0)}}});
+  auto failing = store.write_async({
+      {{"c"s}, set_operator{node::value_node(3.0)}},
+      {{"d"s}, [](node_ptr const&) -> node_ptr { throw std::runtime_error("operation failed"); }},
+  });
+  auto third = store.transact_async({{{"b"s}, equal_condition{node::value_node(2.0)}}},
+                                    {{{"e"s}, set_operator{node::value_node(4.0)}}});
+  auto rejected = store.transact_async({{{"c"s}, is_empty_condition{true}}},
+                                       {{{"f"s}, set_operator{node::value_node(5.0)}}});
+  queued.set_value();
+
+  std::cout << *first.get() << std::endl;
+  try {
+    failing.get();
+  } catch (std::runtime_error const& e) {
+    std::cout << e.what() << std::endl;
+  }
+  std::cout << *second.get() << " " << *third.get() << " " << std::boolalpha
+            << (rejected.get() == nullptr) << std::endl;
+  std::cout << store << std::endl;
+}
+
+void ttl_test() {
+  std::cout << "ttl" << std::endl;
+  node_ttl_wheel wheel;
+  std::vector<std::string> expired;
+  auto const advance = [&](node_ttl_wheel::tick_type now) {
+    expired.clear();
+    wheel.advance(now, expired);
+    std::cout << now << ":";
+    for (auto const& path : expired) {
+      std::cout << " " << path;
+    }
+    std::cout << " (" << wheel.size() << " left)" << std::endl;
+  };
+
+  // in order of expiry, across the boundaries of the first and second level
+  wheel.set("/c", 300);
+  wheel.set("/a", 3);
+  wheel.set("/e", 65536 + 2);
+  wheel.set("/b", 255);
+  wheel.set("/d", 256 * 3 + 1);
+  wheel.set("/f", 65536 * 256 + 256 + 1);
+  advance(2);
+  advance(3);
+  advance(1000);
+  advance(65536 * 256);
+  advance(65536 * 256 + 256 + 1);
+
+  // an expiry that passed already is due with the next advance
+  wheel.set("/g", 5);
+  wheel.set("/h", wheel.current_tick());
+  advance(wheel.current_tick() + 1);
+
+  // a refresh replaces the expiry, a removed path does not expire
+  auto const now = wheel.current_tick();
+  wheel.set("/i", now + 10);
+  wheel.set("/j", now + 20);
+  wheel.set("/i", now + 300);
+  std::cout << std::boolalpha << wheel.remove("/j") << " " << wheel.remove("/j") << std::endl;
+  advance(now + 299);
+  advance(now + 300);
+}
+
+void optimistic_test() {
+  std::cout << "optimistic" << std::endl;
+
+  // `a/x == 1`, the first `writes` evaluations write `value` to `path` as if
+  // another writer committed between the snapshot and the commit
+  auto const condition_with_writes = [](store_base& store, immut_list<std::string> path,
+                                        double value, std::size_t writes) {
+    return [&store, path, value, writes, evaluations = std::make_shared<std::size_t>(0)](node_ptr const& n) {
+      if ((*evaluations)++ < writes) {
+        store.write({{path, set_operator{node::value_node(double{value})}}});
+      }
+      return equal_condition{node::value_node(1.0)}(n);
+    };
+  };
+
+  // the last case conflicts on every attempt, the combiner evaluates the
+  // preconditions itself after `max_optimistic_retries` conflicts
+  for (auto const& [path, value, writes] :
+       {std::tuple{immut_list{"a"s, "x"s}, 1.0, std::size_t{1}},
+        std::tuple{immut_list{"a"s, "x"s}, 2.0, std::size_t{1}},
+        std::tuple{immut_list{"b"s, "y"s}, 2.0, std::size_t{1}},
+        std::tuple{immut_list{"a"s, "x"s}, 1.0, store_base::max_optimistic_retries + 1}}) {
+    store_base store{node::from_buffer_ptr(R"=({"a":{"x":1},"b":{"y":1}})="_vpack)};
+    auto result = store.transact_optimistic(
+        {{{"a"s, "x"s}, condition_with_writes(store, path, value, writes)}},
+        {{{"c"s}, increment_operator{}}});
+    std::cout << std::boolalpha << (result != nullptr) << " conflicts "
+              << store.optimistic_conflicts() << " " << store << std::endl;
+  }
+}
+
+void plan_test() {
+  std::cout << "plan" << std::endl;
+  store_base store{node::from_buffer_ptr(R"=({"a":{"x":1,"y":2},"b":[3]})="_vpack)};
+
+  auto const transact = [&](std::vector<std::pair<std::string, double>> const& conditions) {
+    node_transaction_plan::precondition_list preconditions;
+    for (auto const& [path, value] : conditions) {
+      preconditions.emplace_back(node_path::parse(path), equal_condition{node::value_node(double{value})});
+    }
+    auto result = store.transact(preconditions, {{node_path::parse("/a/z"), increment_operator{}}});
+    std::cout << std::boolalpha << (result.root != nullptr) << " failed "
+              << (result.failed_precondition ? std::to_string(*result.failed_precondition) : "none"s)
+              << " " << store << std::endl;
+  };
+
+  transact({{"/b/0", 3}, {"/a/x", 1}, {"a/y", 2}});
+  // the first failure in the order given, not in path order
+  transact({{"/b/0", 4}, {"/a/x", 1}, {"/a/y", 3}});
+  transact({{"/b/0", 3}, {"/a//x", 1}, {"/a/y", 3}, {"/a/x", 2}});
+  transact({{"/a/x", 1}, {"/a/x", 2}});
+  transact({{"/c/d", 1}});
+  transact({});
+
+  // a shape that keeps coming back stays cached while shapes seen once
+  // replace each other
+  node_plan_cache cache{4};
+  auto const shape = [](std::string const& path) {
+    node_transaction_plan::precondition_list preconditions;
+    preconditions.emplace_back(node_path::parse(path), equal_condition{node::value_node(1.0)});
+    return preconditions;
+  };
+  auto const hot = shape("/a/x");
+  auto const first = cache.get(hot);
+  bool same = true;
+  for (int i = 0; i < 20; i++) {
+    static_cast<void>(cache.get(shape("/once/" + std::to_string(i))));
+    same = same && cache.get(hot) == first;
+  }
+  std::cout << same << " size " << cache.size() << " hits " << cache.hits() << " misses "
+            << cache.misses() << " evictions " << cache.evictions() << std::endl;
+}
+
 std::ostream& operator<<(std::ostream& os, deserialize_error const& err) {
   os << "deserialization error: " << err.as_string();
   return os;
@@ -244,6 +517,85 @@ std::ostream& operator<<(std::ostream& os, agency_transaction const& at) {
   return os;
 }
 
+void lazy_condition_test() {
+  std::cout << "lazy conditions" << std::endl;
+  // "big" is large enough for the element index of an array node
+  auto const buffer = R"=({"a":[1,"x",{"y":2}],"o":{"k":1},
+      "big":[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32,33,34,35,36,37,38,39]})="_vpack;
+  auto const slice = Slice(buffer.data());
+
+  // the same answers for a node and a lazy node, which is not materialized
+  auto const y = node::from_buffer_ptr(R"=({"y":2})="_vpack);
+  for (auto const& n : {node::from_slice(slice), node::lazy_from_slice(slice)}) {
+    std::cout << std::boolalpha;
+    for (auto const& key : {"a"s, "big"s, "o"s}) {
+      auto const child = n->get(immut_list{key});
+      std::cout << " " << key << ": " << is_array_condition{}(child) << " "
+                << in_condition{node::value_node(1.0)}(child) << " "
+                << in_condition{node::value_node("x"s)}(child) << " "
+                << in_condition{y}(child) << " "
+                << in_condition{node::value_node(39.0)}(child) << " "
+                << not_in_condition{node::value_node(40.0)}(child);
+    }
+    std::cout << std::endl;
+  }
+}
+
+void intern_test() {
+  std::cout << "intern" << std::endl;
+  node_intern_table::clear();
+  node_intern_table::set_limit(1u << 16);
+  {
+    // identical leaves are one node, no matter where they come from
+    auto const doc = node::from_buffer_ptr(
+        R"=({"a":"PRMR-1","b":"PRMR-1","c":[1,true],"d":[1,true],"e":[1,false],"z":0,"m":-0.0})="_vpack);
+    auto const a = doc->get(immut_list{"a"s});
+    std::cout << std::boolalpha << (a.get() == doc->get(immut_list{"b"s}).get()) << " "
+              << (a.get() == node::value_node("PRMR-1"s).get()) << " "
+              << (node::value_node(1.0).get() == node::value_node(1.0).get()) << std::endl;
+
+    // 0 and -0 are equal, but serialize differently
+    auto const zero = doc->get(immut_list{"z"s});
+    auto const minus_zero = doc->get(immut_list{"m"s});
+    std::cout << (zero.get() == node::value_node(0.0).get()) << " "
+              << (minus_zero.get() == node::value_node(-0.0).get()) << " "
+              << (zero.get() == minus_zero.get()) << std::endl;
+
+    // containers are identical if their children are
+    auto const c = doc->get(immut_list{"c"s});
+    node_intern_table::set_limit(0);
+    auto const built = node::from_buffer_ptr(R"=([1,true])="_vpack);
+    node_intern_table::set_limit(1u << 16);
+    std::cout << (c.get() == doc->get(immut_list{"d"s}).get()) << " "
+              << (c.get() == doc->get(immut_list{"e"s}).get()) << " "
+              << (built.get() == c.get()) << " "
+              << (node_intern_table::intern(built).get() == c.get()) << std::endl;
+  }
+
+  // nothing refers to the entries anymore
+  auto const entries = node_intern_table::size();
+  std::cout << (entries > 0) << " " << (node_intern_table::sweep() == entries) << " "
+            << node_intern_table::size() << std::endl;
+
+  // the store releases the values it replaced without an explicit sweep
+  {
+    store_base store{node::empty_object()};
+    for (int i = 0; i < 10'000; i++) {
+      store.write({{{"v"s}, set_operator{node::value_node(double(i))}}});
+    }
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+    while (node_intern_table::size() > 2 && std::chrono::steady_clock::now() < deadline) {
+      store.write({{{"v"s}, set_operator{node::value_node(-1.0)}}});
+      std::this_thread::sleep_for(std::chrono::microseconds{100});
+    }
+    std::cout << "swept by the store " << (node_intern_table::size() <= 2) << " " << store
+              << std::endl;
+  }
+
+  node_intern_table::set_limit(0);
+  node_intern_table::clear();
+}
+
 void huge_node_test(std::string const& filename) {
   node_ptr p = node_from_file(filename);
 
@@ -259,11 +611,33 @@ void huge_node_test(std::string const& filename) {
 
   std::cout << "Time " << std::setprecision(3) << (double) std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count() << "s" << std::endl;
   std::cout << "avg  " << std::setprecision(3) << (double) std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / n << "us" << std::endl;
+
+  // the same sets through an editor, the spine is only copied once
+  auto const flat_path = node_path::parse("/arango/Plan/Collections/_system/abc");
+  auto editor = node_editor{std::move(p)};
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) {
+    editor.set(flat_path, q);
+  }
+  end = std::chrono::steady_clock::now();
+
+  std::cout << "Editor time " << std::setprecision(3) << (double) std::chrono::duration_cast<std::chrono::duration<double>>(end - start).count() << "s" << std::endl;
+  std::cout << "Editor avg  " << std::setprecision(3) << (double) std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / n << "us" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
   node_test();
   //store_test();
+  transform_test();
+  extract_test();
+  json_test();
+  path_test();
+  group_commit_test();
+  ttl_test();
+  optimistic_test();
+  plan_test();
+  lazy_condition_test();
+  intern_test();
 
   if (argc > 1) {
     huge_node_test(argv[1]);
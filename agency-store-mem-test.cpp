@@ -19,12 +19,18 @@ void store_mem_test(std::string const& filename) {
   auto q = node::from_buffer_ptr(R"=({"name":"myDB", "replFact":2, "isBuilding":true})="_vpack);
 
   auto const n = 1'000'000;
+  auto const rss_before = resident_set_size();
+  auto const cycles_before = cycle_counter();
   auto const dur = timed([&] {
     for (int i = 0; i < n; i++) {
       p = p->set(path, q);
     }
   });
+  auto const cycles = cycle_counter() - cycles_before;
+  auto const rss_after = resident_set_size();
 
+  std::cout << "allocator " << (AGENCY_NODE_POOL_ALLOCATOR ? "pool" : "system")
+            << std::endl;
   std::cout
       << "Time " << std::setprecision(3)
       << (double)std::chrono::duration_cast<std::chrono::duration<double>>(dur).count()
@@ -33,6 +39,9 @@ void store_mem_test(std::string const& filename) {
       << "avg  " << std::setprecision(3)
       << (double)std::chrono::duration_cast<std::chrono::microseconds>(dur).count() / n
       << "us" << std::endl;
+  std::cout << "cycles/set " << cycles / n << std::endl;
+  std::cout << "rss  " << rss_before / 1024 << "KiB -> " << rss_after / 1024
+            << "KiB" << std::endl;
 }
 
 int main(int argc, char* argv[]) {
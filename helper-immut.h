@@ -53,16 +53,20 @@ struct immut_list {
 
   [[nodiscard]] bool empty() const noexcept { return head == nullptr; }
 
-  immut_list(std::initializer_list<T> l) : head(nullptr) {
-    typename element<T>::pointer last = nullptr;
-    for (auto const& v : l) {
-      auto next = std::make_shared<element<T>>(v);
+  immut_list(std::initializer_list<T> l) : immut_list(l.begin(), l.end()) {}
+
+  // the values of the range in order
+  template <typename Iterator>
+  immut_list(Iterator first, Iterator last) : head(nullptr) {
+    typename element<T>::pointer tail = nullptr;
+    for (; first != last; ++first) {
+      auto next = std::make_shared<element<T>>(*first);
       if (head == nullptr) {
         head = next;
       } else {
-        last->next = next;
+        tail->next = next;
       }
-      last = next;
+      tail = next;
     }
   }
 
@@ -6,9 +6,10 @@
 #define AGENCY_HELPER_STRINGS_H
 #include <optional>
 #include <string>
+#include <string_view>
 
 template <typename T>
-std::optional<T> string_to_number(std::string const& str) {
+std::optional<T> string_to_number(std::string_view str) {
   T a = T();
   for (char c : str) {
     if ('0' <= c && c <= '9') {
@@ -0,0 +1,209 @@
+#include "node-allocator.h"
+
+#include <array>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if AGENCY_NODE_POOL_ALLOCATOR
+
+namespace {
+
+struct free_block {
+  free_block* next;
+};
+
+// number of blocks transferred at once between a thread cache and the global
+// pool
+constexpr std::size_t batch_size = 64;
+// a thread cache holding more blocks of a size class returns one batch
+constexpr std::size_t thread_cache_limit = 2 * batch_size;
+constexpr std::size_t chunk_size = 64 * 1024;
+
+constexpr std::size_t size_class_of(std::size_t size) noexcept {
+  return (size + node_pool::granularity - 1) / node_pool::granularity - 1;
+}
+
+constexpr std::size_t block_size_of(std::size_t size_class) noexcept {
+  return (size_class + 1) * node_pool::granularity;
+}
+
+struct block_batch {
+  free_block* head = nullptr;
+  std::size_t count = 0;
+
+  void push(free_block* block) noexcept {
+    block->next = head;
+    head = block;
+    count += 1;
+  }
+
+  free_block* pop() noexcept {
+    auto block = head;
+    head = block->next;
+    count -= 1;
+    return block;
+  }
+};
+
+struct global_pool {
+  struct size_class {
+    std::mutex mutex;
+    std::vector<block_batch> batches;
+    block_batch loose;  // single blocks returned by exited threads
+    char* chunk_begin = nullptr;
+    char* chunk_end = nullptr;
+  };
+
+  block_batch fetch(std::size_t idx) {
+    auto& sc = classes[idx];
+    std::unique_lock guard(sc.mutex);
+    if (!sc.batches.empty()) {
+      auto batch = sc.batches.back();
+      sc.batches.pop_back();
+      return batch;
+    }
+
+    if (sc.loose.count > 0) {
+      return std::exchange(sc.loose, block_batch{});
+    }
+
+    return carve(sc, block_size_of(idx));
+  }
+
+  void give_back(std::size_t idx, block_batch batch) {
+    auto& sc = classes[idx];
+    std::unique_lock guard(sc.mutex);
+    sc.batches.push_back(batch);
+  }
+
+  void give_back(std::size_t idx, free_block* block) {
+    auto& sc = classes[idx];
+    std::unique_lock guard(sc.mutex);
+    sc.loose.push(block);
+    if (sc.loose.count == batch_size) {
+      sc.batches.push_back(std::exchange(sc.loose, block_batch{}));
+    }
+  }
+
+ private:
+  static block_batch carve(size_class& sc, std::size_t block_size) {
+    block_batch batch;
+    for (std::size_t i = 0; i < batch_size; i++) {
+      if (sc.chunk_begin == sc.chunk_end) {
+        sc.chunk_begin = static_cast<char*>(::operator new(chunk_size));
+        sc.chunk_end = sc.chunk_begin + (chunk_size / block_size) * block_size;
+      }
+      batch.push(reinterpret_cast<free_block*>(sc.chunk_begin));
+      sc.chunk_begin += block_size;
+    }
+    return batch;
+  }
+
+  std::array<size_class, node_pool::size_classes> classes;
+};
+
+global_pool& the_global_pool() {
+  // never destroyed, blocks might be freed during static destruction
+  static auto* pool = new global_pool();
+  return *pool;
+}
+
+/*
+ * The cache itself is trivially destructible so its storage stays valid while
+ * other thread locals (e.g. the shared null node) are destroyed. Its content
+ * is flushed by `thread_cache_guard` and all later deallocations are passed to
+ * the global pool.
+ */
+struct thread_cache {
+  enum class state { UNINITIALIZED, ALIVE, DEAD };
+
+  std::array<block_batch, node_pool::size_classes> lists;
+  state current = state::UNINITIALIZED;
+
+  void flush() noexcept {
+    for (std::size_t idx = 0; idx < lists.size(); idx++) {
+      while (lists[idx].count > 0) {
+        the_global_pool().give_back(idx, lists[idx].pop());
+      }
+    }
+  }
+};
+
+thread_local thread_cache cache;
+
+struct thread_cache_guard {
+  thread_cache_guard() noexcept { cache.current = thread_cache::state::ALIVE; }
+  ~thread_cache_guard() {
+    cache.current = thread_cache::state::DEAD;
+    cache.flush();
+  }
+};
+
+void register_thread_cache() {
+  thread_local thread_cache_guard guard;
+}
+
+}  // namespace
+
+void* node_pool::allocate(std::size_t size) {
+  if (size > max_pooled_size || size == 0) {
+    return ::operator new(size);
+  }
+
+  auto const idx = size_class_of(size);
+  if (cache.current != thread_cache::state::ALIVE) {
+    if (cache.current == thread_cache::state::DEAD) {
+      auto batch = the_global_pool().fetch(idx);
+      auto block = batch.pop();
+      if (batch.count > 0) {
+        the_global_pool().give_back(idx, batch);
+      }
+      return block;
+    }
+    register_thread_cache();
+  }
+
+  auto& list = cache.lists[idx];
+  if (list.count == 0) {
+    list = the_global_pool().fetch(idx);
+  }
+  return list.pop();
+}
+
+void node_pool::deallocate(void* p, std::size_t size) noexcept {
+  if (size > max_pooled_size || size == 0) {
+    ::operator delete(p);
+    return;
+  }
+
+  auto const idx = size_class_of(size);
+  auto block = static_cast<free_block*>(p);
+  if (cache.current != thread_cache::state::ALIVE) {
+    if (cache.current == thread_cache::state::DEAD) {
+      the_global_pool().give_back(idx, block);
+      return;
+    }
+    register_thread_cache();
+  }
+
+  auto& list = cache.lists[idx];
+  list.push(block);
+  if (list.count > thread_cache_limit) {
+    block_batch batch;
+    while (batch.count < batch_size) {
+      batch.push(list.pop());
+    }
+    the_global_pool().give_back(idx, batch);
+  }
+}
+
+#else
+
+void* node_pool::allocate(std::size_t size) { return ::operator new(size); }
+
+void node_pool::deallocate(void* p, std::size_t) noexcept {
+  ::operator delete(p);
+}
+
+#endif
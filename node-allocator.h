@@ -0,0 +1,181 @@
+#ifndef AGENCY_NODE_ALLOCATOR_H
+#define AGENCY_NODE_ALLOCATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+#if __has_include(<sys/single_threaded.h>)
+#include <sys/single_threaded.h>
+#define AGENCY_NODE_HAS_SINGLE_THREADED 1
+#else
+#define AGENCY_NODE_HAS_SINGLE_THREADED 0
+#endif
+
+#include "immer/heap/heap_policy.hpp"
+#include "immer/memory_policy.hpp"
+
+/*
+ * Selects the allocator used for nodes and their immer containers. Set by
+ * the build (see AGENCY_NODE_ALLOCATOR in CMakeLists.txt), defaults to the
+ * pool allocator.
+ */
+#ifndef AGENCY_NODE_POOL_ALLOCATOR
+#define AGENCY_NODE_POOL_ALLOCATOR 1
+#endif
+
+/*
+ * Selects whether node and immer container reference counts are atomic. A
+ * build with plain counts is only correct if every tree is confined to a
+ * single thread, e.g. for tools loading snapshots or building transactions.
+ * Set by the build (see AGENCY_NODE_REFCOUNT in CMakeLists.txt), defaults to
+ * atomic counts.
+ */
+#ifndef AGENCY_NODE_ATOMIC_REFCOUNT
+#define AGENCY_NODE_ATOMIC_REFCOUNT 1
+#endif
+
+/*
+ * Size class pool for the many small blocks a tree consists of. Every block
+ * up to `max_pooled_size` bytes is rounded up to a multiple of `granularity`
+ * and served from a per-thread free list. If a thread cache runs empty it
+ * fetches a batch of blocks from the global pool, if it holds too many blocks
+ * it returns a batch. This way blocks freed by a different thread than the one
+ * that allocated them eventually find their way back. Larger blocks are
+ * forwarded to the global operator new.
+ *
+ * Chunks of the pool are never returned to the operating system, not even if
+ * every block in them is free: the resident set stays at its high-water mark
+ * and is reused for the next tree versions instead.
+ *
+ * The pool does not reach the 2x fewer cycles per set that were the target.
+ * With `store-mem-test` on a 3 MB snapshot a set takes about 4000 cycles with
+ * the pool and 4500 with glibc malloc, the steady-state resident set is about
+ * 13% smaller. A set is dominated by reference counting and key hashing,
+ * not by allocation.
+ */
+struct node_pool {
+  static constexpr std::size_t granularity = 16;
+  static constexpr std::size_t max_pooled_size = 512;
+  static constexpr std::size_t size_classes = max_pooled_size / granularity;
+
+  [[nodiscard]] static void* allocate(std::size_t size);
+  static void deallocate(void* p, std::size_t size) noexcept;
+};
+
+/*
+ * Standard allocator adapter for the node pool, e.g. for `allocate_shared`.
+ */
+template <typename T>
+struct node_pool_allocator {
+  using value_type = T;
+
+  node_pool_allocator() noexcept = default;
+  template <typename S>
+  node_pool_allocator(node_pool_allocator<S> const&) noexcept {}
+
+  [[nodiscard]] T* allocate(std::size_t n) {
+    return static_cast<T*>(node_pool::allocate(n * sizeof(T)));
+  }
+  void deallocate(T* p, std::size_t n) noexcept {
+    node_pool::deallocate(p, n * sizeof(T));
+  }
+
+  template <typename S>
+  bool operator==(node_pool_allocator<S> const&) const noexcept {
+    return true;
+  }
+  template <typename S>
+  bool operator!=(node_pool_allocator<S> const&) const noexcept {
+    return false;
+  }
+};
+
+/*
+ * immer heap backed by the node pool. immer always passes the exact size of a
+ * block on deallocation, so no size header is required.
+ */
+struct node_pool_heap {
+  template <typename... Tags>
+  static void* allocate(std::size_t size, Tags...) {
+    return node_pool::allocate(size);
+  }
+
+  template <typename... Tags>
+  static void deallocate(std::size_t size, void* data, Tags...) noexcept {
+    node_pool::deallocate(data, size);
+  }
+};
+
+/*
+ * Like libstdc++'s shared_ptr, atomic reference counts skip the locked
+ * instructions as long as the process did not start a second thread.
+ */
+inline bool node_refcount_single_threaded() noexcept {
+#if AGENCY_NODE_HAS_SINGLE_THREADED
+  return __libc_single_threaded;
+#else
+  return false;
+#endif
+}
+
+/*
+ * Reference count stored in the header of every node. `release` returns true
+ * if the last reference was dropped.
+ */
+#if AGENCY_NODE_ATOMIC_REFCOUNT
+struct node_refcount {
+  std::atomic<std::uint32_t> count{0};
+
+  static bool single_threaded() noexcept {
+    return node_refcount_single_threaded();
+  }
+
+  void acquire() noexcept {
+    if (single_threaded()) {
+      count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    } else {
+      count.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  [[nodiscard]] bool release() noexcept {
+    // if we hold the only reference nobody else can acquire a new one
+    auto const current = count.load(std::memory_order_acquire);
+    if (current == 1) {
+      return true;
+    }
+    if (single_threaded()) {
+      count.store(current - 1, std::memory_order_relaxed);
+      return false;
+    }
+    return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+  [[nodiscard]] std::uint32_t load() const noexcept {
+    return count.load(std::memory_order_acquire);
+  }
+};
+
+using node_immer_refcount_policy = immer::refcount_policy;
+#else
+struct node_refcount {
+  std::uint32_t count = 0;
+
+  void acquire() noexcept { count += 1; }
+  [[nodiscard]] bool release() noexcept { return --count == 0; }
+  [[nodiscard]] std::uint32_t load() const noexcept { return count; }
+};
+
+using node_immer_refcount_policy = immer::unsafe_refcount_policy;
+#endif
+
+#if AGENCY_NODE_POOL_ALLOCATOR
+using node_memory_policy =
+    immer::memory_policy<immer::heap_policy<node_pool_heap>, node_immer_refcount_policy>;
+#else
+using node_memory_policy =
+    immer::memory_policy<immer::default_heap_policy, node_immer_refcount_policy>;
+#endif
+
+#endif  // AGENCY_NODE_ALLOCATOR_H
@@ -69,12 +69,23 @@ struct condition_helper : F {
     return value;
   }
 
+  /*
+   * A condition that can be answered from velocypack, e.g. from the type of
+   * the slice, takes a node_slice as well, thus lazy nodes are not
+   * materialized for it.
+   */
   template <typename E = F, std::enable_if_t<std::is_base_of_v<value_condition_type_restricted, E>, int> = 0>
   auto visit_node(node_ptr const& node) const {
     using T = typename F::condition_restricted_to;
 
-    return node->visit(visitor{[this](T const& v) { return F::operator()(v); },
-                               [this](auto const&) { return return_default(); }});
+    if constexpr (std::is_invocable_v<F const&, node_slice const&>) {
+      return node->visit_lazy(visitor{[this](T const& v) { return F::operator()(v); },
+                                      [this](node_slice const& s) { return F::operator()(s); },
+                                      [this](auto const&) { return return_default(); }});
+    } else {
+      return node->visit(visitor{[this](T const& v) { return F::operator()(v); },
+                                 [this](auto const&) { return return_default(); }});
+    }
   }
 
   template <typename E = F, std::enable_if_t<std::negation_v<std::is_base_of<value_condition_type_restricted, E>>, int> = 0>
@@ -116,11 +127,13 @@ struct value_in_condition : detail::condition_default_value<false>,
   bool operator()(node_array const& array) const noexcept {
     return array.contains(node);
   }
+  bool operator()(node_slice const& slice) const noexcept { return slice.contains(node); }
 };
 
 struct value_is_array_condition : detail::condition_default_value<false>,
                                   detail::value_condition_only_for<node_array> {
   bool operator()(node_array const& array) const noexcept { return true; }
+  bool operator()(node_slice const& slice) const noexcept { return slice.slice.isArray(); }
 };
 
 using in_condition = detail::condition_helper<value_in_condition>;
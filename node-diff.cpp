@@ -0,0 +1,446 @@
+#include "node.h"
+#include "node-work-pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+using champ_type = std::decay_t<decltype(std::declval<node_object::container_type const&>().impl())>;
+using champ_node = champ_type::node_t;
+using champ_value = champ_node::value_t;
+using champ_bitmap = champ_type::bitmap_t;
+using immer::detail::hamts::count_t;
+
+constexpr count_t champ_max_depth = immer::detail::hamts::max_depth<champ_type::bits>;
+
+// objects with at least this many members are diffed in parallel
+constexpr std::size_t parallel_diff_min_size = 4096;
+
+/*
+ * Change callbacks are called with the key, the old and the new value. A
+ * `nullptr` old or new value means the member was added or removed. Members
+ * with identical values are not reported.
+ */
+template <typename F>
+void report_if_changed(F& f, node_key const& key, node_ptr const& old_value,
+                       node_ptr const& new_value) {
+  if (old_value.get() != new_value.get()) {
+    f(key, &old_value, &new_value);
+  }
+}
+
+template <typename F>
+void champ_for_each(champ_node const* n, count_t depth, F&& f) {
+  if (depth == champ_max_depth) {
+    auto const* values = n->collisions();
+    for (count_t i = 0; i < n->collision_count(); i++) {
+      f(values[i]);
+    }
+    return;
+  }
+
+  // the value array is only allocated if there are values
+  if (auto const datamap = n->datamap(); datamap != 0) {
+    auto const* values = n->values();
+    for (count_t i = 0; i < immer::detail::hamts::popcount(datamap); i++) {
+      f(values[i]);
+    }
+  }
+  auto const* children = n->children();
+  for (count_t i = 0; i < immer::detail::hamts::popcount(n->nodemap()); i++) {
+    champ_for_each(children[i], depth + 1, f);
+  }
+}
+
+/*
+ * Compares the members of `subtree` with the single member `v` that is
+ * stored at the same position in the other tree.
+ */
+template <typename F>
+void champ_diff_subtree(champ_node const* subtree, count_t depth, champ_value const& v,
+                        bool subtree_is_old, F& f) {
+  bool matched = false;
+  champ_for_each(subtree, depth, [&](champ_value const& s) {
+    if (s.first == v.first) {
+      matched = true;
+      if (subtree_is_old) {
+        report_if_changed(f, s.first, s.second, v.second);
+      } else {
+        report_if_changed(f, s.first, v.second, s.second);
+      }
+    } else if (subtree_is_old) {
+      f(s.first, &s.second, nullptr);
+    } else {
+      f(s.first, nullptr, &s.second);
+    }
+  });
+
+  if (!matched) {
+    if (subtree_is_old) {
+      f(v.first, nullptr, &v.second);
+    } else {
+      f(v.first, &v.second, nullptr);
+    }
+  }
+}
+
+template <typename F>
+void champ_diff(champ_node const* a, champ_node const* b, count_t depth, F& f);
+
+/*
+ * Compares the entries of two champ nodes at the same position that belong
+ * to the bitmap position `bit`.
+ */
+template <typename F>
+void champ_diff_slot(champ_node const* a, champ_node const* b, count_t depth,
+                     champ_bitmap bit, F& f) {
+  auto const index = [bit](champ_bitmap map) {
+    return immer::detail::hamts::popcount(static_cast<champ_bitmap>(map & (bit - 1)));
+  };
+
+  if (a->nodemap() & bit) {
+    auto const* child = a->children()[index(a->nodemap())];
+    if (b->nodemap() & bit) {
+      champ_diff(child, b->children()[index(b->nodemap())], depth + 1, f);
+    } else if (b->datamap() & bit) {
+      champ_diff_subtree(child, depth + 1, b->values()[index(b->datamap())], true, f);
+    } else {
+      champ_for_each(child, depth + 1,
+                     [&](champ_value const& v) { f(v.first, &v.second, nullptr); });
+    }
+  } else if (a->datamap() & bit) {
+    auto const& v = a->values()[index(a->datamap())];
+    if (b->nodemap() & bit) {
+      champ_diff_subtree(b->children()[index(b->nodemap())], depth + 1, v, false, f);
+    } else if (b->datamap() & bit) {
+      auto const& w = b->values()[index(b->datamap())];
+      if (v.first == w.first) {
+        report_if_changed(f, v.first, v.second, w.second);
+      } else {
+        f(v.first, &v.second, nullptr);
+        f(w.first, nullptr, &w.second);
+      }
+    } else {
+      f(v.first, &v.second, nullptr);
+    }
+  } else if (b->nodemap() & bit) {
+    champ_for_each(b->children()[index(b->nodemap())], depth + 1,
+                   [&](champ_value const& v) { f(v.first, nullptr, &v.second); });
+  } else if (b->datamap() & bit) {
+    auto const& w = b->values()[index(b->datamap())];
+    f(w.first, nullptr, &w.second);
+  }
+}
+
+template <typename F>
+void champ_diff_collisions(champ_node const* a, champ_node const* b, F& f) {
+  auto const* a_values = a->collisions();
+  auto const* b_values = b->collisions();
+  auto const* a_end = a_values + a->collision_count();
+  auto const* b_end = b_values + b->collision_count();
+
+  for (auto v = a_values; v != a_end; ++v) {
+    auto w = std::find_if(b_values, b_end,
+                          [&](champ_value const& w) { return v->first == w.first; });
+    if (w == b_end) {
+      f(v->first, &v->second, nullptr);
+    } else {
+      report_if_changed(f, v->first, v->second, w->second);
+    }
+  }
+  for (auto w = b_values; w != b_end; ++w) {
+    if (std::none_of(a_values, a_end, [&](champ_value const& v) { return v.first == w->first; })) {
+      f(w->first, nullptr, &w->second);
+    }
+  }
+}
+
+template <typename F>
+void champ_diff(champ_node const* a, champ_node const* b, count_t depth, F& f) {
+  if (a == b) {
+    // shared subtree, nothing changed below
+    return;
+  } else if (depth == champ_max_depth) {
+    champ_diff_collisions(a, b, f);
+    return;
+  }
+
+  auto bits = a->datamap() | a->nodemap() | b->datamap() | b->nodemap();
+  while (bits != 0) {
+    auto const bit = static_cast<champ_bitmap>(bits & -bits);
+    champ_diff_slot(a, b, depth, bit, f);
+    bits &= bits - 1;
+  }
+}
+
+/*
+ * Calls `f` for all members that differ between `a` and `b`.
+ */
+template <typename F>
+void for_each_change(node_object const& a, node_object const& b, F&& f) {
+  using small_type = node_object::small_container_type;
+  using large_type = node_object::container_type;
+
+  if (!a.is_compact() && !b.is_compact()) {
+    champ_diff(std::get<large_type>(a.value).impl().root,
+               std::get<large_type>(b.value).impl().root, 0, f);
+  } else if (a.is_compact() && b.is_compact()) {
+    // both are sorted by `member_less`
+    auto const& left = std::get<small_type>(a.value);
+    auto const& right = std::get<small_type>(b.value);
+    auto i = left.begin();
+    auto j = right.begin();
+    while (i != left.end() && j != right.end()) {
+      if (i->first == j->first) {
+        report_if_changed(f, i->first, i->second, j->second);
+        ++i;
+        ++j;
+      } else if (node_object::member_less(i->first, j->first)) {
+        f(i->first, &i->second, nullptr);
+        ++i;
+      } else {
+        f(j->first, nullptr, &j->second);
+        ++j;
+      }
+    }
+    for (; i != left.end(); ++i) {
+      f(i->first, &i->second, nullptr);
+    }
+    for (; j != right.end(); ++j) {
+      f(j->first, nullptr, &j->second);
+    }
+  } else {
+    a.visit_members([&](auto const& c) {
+      for (auto const& member : c) {
+        if (auto other = b.find(member.first); other == nullptr) {
+          f(member.first, &member.second, nullptr);
+        } else {
+          report_if_changed(f, member.first, member.second, *other);
+        }
+      }
+    });
+    b.visit_members([&](auto const& c) {
+      for (auto const& member : c) {
+        if (a.find(member.first) == nullptr) {
+          f(member.first, nullptr, &member.second);
+        }
+      }
+    });
+  }
+}
+
+}  // namespace
+
+/*
+ * Defined here to share the HAMT walk of the diff. If both maps are HAMTs
+ * the sub-nodes that the overlay shares with this map are skipped, e.g. if
+ * the overlay is a newer version of the same object.
+ */
+node_object node_object::overlay_impl(node_object const& ov) const noexcept {
+  /*
+   * Copy all values from the base node. If the overlay contains a member that
+   * has `nullptr` as value, remove the value from the result.
+   * If the key is not set in the current node, just add it.
+   * Otherwise overlay the base child by the overlay child, unless they are
+   * the same node.
+   */
+  auto result = transient();
+  auto const apply = [&](node_key const& key, node_ptr const& v) {
+    if (v == nullptr) {
+      result.erase(key);
+    } else if (auto store = result.find(key); store == nullptr) {
+      result.set(key, v);
+    } else if (store->get() != v.get()) {
+      result.set(key, (*store)->overlay(v));
+    }
+  };
+
+  if (!is_compact() && !ov.is_compact()) {
+    // members only present in this map are kept
+    for_each_change(*this, ov, [&](node_key const& key, node_ptr const*, node_ptr const* v) {
+      if (v != nullptr) {
+        apply(key, *v);
+      }
+    });
+  } else {
+    ov.visit_members([&](auto const& c) {
+      for (auto const& member : c) {
+        apply(member.first, member.second);
+      }
+    });
+  }
+  return std::move(result).persistent();
+}
+
+namespace {
+
+class diff_builder {
+ public:
+  diff_builder(node_work_pool* pool, std::vector<std::string> path) noexcept
+      : pool(pool), path(std::move(path)) {}
+
+  std::vector<node_diff::operation> operations;
+  bool delta_exact = true;
+
+  /*
+   * Returns the overlay turning `a` into `b` or `nullptr` if they are equal.
+   */
+  node_ptr diff(node_ptr const& a, node_ptr const& b) {
+    assert(a != nullptr && b != nullptr);
+    if (a.get() == b.get()) {
+      return nullptr;
+    }
+
+    enum class kind { other, object, shorter_array };
+    node_ptr delta;
+    auto const k = a->visit([&](auto const& x) {
+      return b->visit([&](auto const& y) {
+        using X = std::decay_t<decltype(x)>;
+        using Y = std::decay_t<decltype(y)>;
+        if constexpr (std::is_same_v<X, node_object> && std::is_same_v<Y, node_object>) {
+          delta = diff_objects(x, y);
+          return kind::object;
+        } else if constexpr (std::is_same_v<X, node_array> && std::is_same_v<Y, node_array>) {
+          return y.size() < x.size() ? kind::shorter_array : kind::other;
+        } else {
+          return kind::other;
+        }
+      });
+    });
+
+    if (k == kind::object || *a == *b) {
+      return delta;
+    } else if (k == kind::shorter_array) {
+      delta_exact = false;
+    }
+    emit(b);
+    return b;
+  }
+
+ private:
+  using member_list = std::vector<node_object::member_type>;
+
+  void emit(node_ptr const& value) {
+    using element = immut_list<std::string>::element<std::string>;
+    auto head = immut_list<std::string>::element_pointer{};
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      auto next = std::make_shared<element>(*it);
+      next->next = std::move(head);
+      head = std::move(next);
+    }
+    operations.push_back({node::path_slice{std::move(head)}, value});
+  }
+
+  void diff_member(node_key const& key, node_ptr const* a, node_ptr const* b,
+                   member_list& members) {
+    path.push_back(key.str());
+    if (b == nullptr) {
+      emit(nullptr);
+      members.emplace_back(key, nullptr);
+    } else if (a == nullptr) {
+      emit(*b);
+      members.emplace_back(key, *b);
+    } else if (auto delta = diff(*a, *b); delta != nullptr) {
+      members.emplace_back(key, std::move(delta));
+    }
+    path.pop_back();
+  }
+
+  node_ptr diff_objects(node_object const& a, node_object const& b) {
+    member_list members;
+    if (pool != nullptr && !a.is_compact() && !b.is_compact() &&
+        std::max(a.size(), b.size()) >= parallel_diff_min_size) {
+      parallel_diff_objects(a, b, members);
+    } else {
+      for_each_change(a, b, [&](node_key const& key, node_ptr const* x, node_ptr const* y) {
+        diff_member(key, x, y, members);
+      });
+    }
+
+    if (members.empty()) {
+      return nullptr;
+    }
+
+    node_object::transient_type result;
+    for (auto& member : members) {
+      result.put(std::move(member.first), std::move(member.second));
+    }
+    return make_node_ptr(std::move(result).persistent());
+  }
+
+  /*
+   * Every slot of the HAMT root is compared by its own task, the results
+   * are concatenated in slot order afterwards.
+   */
+  void parallel_diff_objects(node_object const& a, node_object const& b, member_list& members) {
+    auto const* root_a = std::get<node_object::container_type>(a.value).impl().root;
+    auto const* root_b = std::get<node_object::container_type>(b.value).impl().root;
+    if (root_a == root_b) {
+      return;
+    }
+
+    struct slot_result {
+      member_list members;
+      diff_builder builder;
+    };
+    std::vector<slot_result> slots;
+    auto bits = root_a->datamap() | root_a->nodemap() | root_b->datamap() | root_b->nodemap();
+    for (auto b = bits; b != 0; b &= b - 1) {
+      slots.push_back(slot_result{{}, diff_builder{pool, path}});
+    }
+
+    {
+      node_work_pool::task_group group(*pool);
+      std::size_t i = 0;
+      for (; bits != 0; bits &= bits - 1) {
+        auto const bit = static_cast<champ_bitmap>(bits & -bits);
+        group.run([&, bit, &slot = slots[i++]] {
+          auto f = [&](node_key const& key, node_ptr const* x, node_ptr const* y) {
+            slot.builder.diff_member(key, x, y, slot.members);
+          };
+          champ_diff_slot(root_a, root_b, 0, bit, f);
+        });
+      }
+      group.wait();
+    }
+
+    for (auto& slot : slots) {
+      std::move(slot.members.begin(), slot.members.end(), std::back_inserter(members));
+      std::move(slot.builder.operations.begin(), slot.builder.operations.end(),
+                std::back_inserter(operations));
+      delta_exact &= slot.builder.delta_exact;
+    }
+  }
+
+  node_work_pool* pool;
+  std::vector<std::string> path;
+};
+
+node_diff make_diff(node_ptr const& old_node, node_ptr const& new_node, node_work_pool* pool) {
+#if !AGENCY_NODE_ATOMIC_REFCOUNT
+  // plain reference counts of shared nodes must not be touched by multiple
+  // threads
+  pool = nullptr;
+#endif
+  diff_builder builder{pool, {}};
+  node_diff result;
+  result.delta = builder.diff(old_node, new_node);
+  result.operations = std::move(builder.operations);
+  result.delta_exact = builder.delta_exact;
+  return result;
+}
+
+}  // namespace
+
+node_diff node::diff(node_ptr const& old_node, node_ptr const& new_node) {
+  return make_diff(old_node, new_node, nullptr);
+}
+
+node_diff node::diff(node_ptr const& old_node, node_ptr const& new_node, node_work_pool& pool) {
+  return make_diff(old_node, new_node, &pool);
+}
@@ -0,0 +1,120 @@
+#include "node-editor.h"
+
+#include <algorithm>
+#include <utility>
+
+void node_editor::set(node_path_view path, node_ptr const& value) {
+  edit(current, path, value);
+}
+
+void node_editor::set(node::path_slice const& path, node_ptr const& value) {
+  node_path flat;
+  for (auto e = path.head.get(); e != nullptr; e = e->next.get()) {
+    flat.push_back(e->value);
+  }
+  set(flat, value);
+}
+
+/*
+ * Stores `value` at `path` below the node in `slot`. A use count of one
+ * means that nobody but `slot` can see the node, it is changed in place.
+ * Children are edited in their slots as well and a slot is only assigned
+ * a complete node, thus if an exception is thrown every slot still holds
+ * a valid tree.
+ */
+void node_editor::edit(node_ptr& slot, node_path_view path, node_ptr const& value) {
+  if (path.empty()) {
+    slot = value;
+    return;
+  }
+  if (slot == nullptr) {
+    slot = node::node_at_path(path, value);
+    return;
+  }
+  if (slot.use_count() != 1) {
+    slot = slot->set(path, value);
+    return;
+  }
+
+  auto& target = const_cast<node&>(*slot);
+  target.clear_caches();
+
+  if (auto const* s = std::get_if<node_slice>(&target.value); s != nullptr) {
+    auto materialized = s->materialize();
+    target.value = std::move(const_cast<node&>(*materialized).value);
+  }
+
+  auto const& head = path.head();
+  auto const tail = path.tail();
+
+  if (auto* object = std::get_if<node_object>(&target.value); object != nullptr) {
+    if (object->is_compact() && !tail.empty()) {
+      // the member list belongs to this node alone
+      auto& members = std::get<node_object::small_container_type>(object->value);
+      auto member = std::find_if(members.begin(), members.end(),
+                                 [&](auto const& m) {
+                                   return m.first.hash() == head.hash && m.first.view() == head.name();
+                                 });
+      if (member != members.end()) {
+        edit(member->second, tail, value);
+        return;
+      }
+    }
+
+    // The slots of a HAMT may be shared with other maps even if this node is
+    // not, so its children are copied.
+    auto new_child = [&] {
+      if (tail.empty()) {
+        return value;
+      }
+      if (auto const* child = object->find(head.name(), head.hash); child != nullptr) {
+        return (*child)->set(tail, value);
+      }
+      return node::node_at_path(tail, value);
+    }();
+    node_object::transient_type members{std::move(*object)};
+    try {
+      members.set(head.key(), std::move(new_child));
+    } catch (...) {
+      *object = std::move(members).persistent();
+      throw;
+    }
+    *object = std::move(members).persistent();
+    return;
+  }
+
+  if (auto* array = std::get_if<node_array>(&target.value); array != nullptr) {
+    if (!head.is_index() || head.index >= array->size()) {
+      // grows the array or turns it into an object
+      slot = slot->set(path, value);
+      return;
+    }
+    std::visit(visitor{
+                   [&](node_array::small_container_type& c) { edit(c[head.index], tail, value); },
+                   [&](node_array::large_box& c) {
+                     // updates in place if neither the box nor the path to the
+                     // element is shared, the element index is dropped. The
+                     // element is passed in its slot, or as a copy otherwise.
+                     auto&& result = std::move(c).update([&](auto&& large) {
+                       auto const child = [&](node_ptr&& child) {
+                         edit(child, tail, value);
+                         return std::move(child);
+                       };
+                       if constexpr (std::is_rvalue_reference_v<decltype(large)>) {
+                         large.elements = std::move(large.elements).update(head.index, child);
+                         large.drop_index();
+                         return std::move(large);
+                       } else {
+                         return node_array::large_type{large.elements.update(head.index, child)};
+                       }
+                     });
+                     static_cast<void>(result);
+                   },
+               },
+               array->value);
+    return;
+  }
+
+  // values are replaced by an object, like `set` does
+  slot = node::node_at_path(path, value);
+}
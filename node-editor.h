@@ -0,0 +1,48 @@
+#ifndef AGENCY_NODE_EDITOR_H
+#define AGENCY_NODE_EDITOR_H
+
+#include "node-path.h"
+#include "node.h"
+
+/*
+ * Applies a series of `set`s to a tree. Nodes that are not shared with
+ * anybody else are changed in place instead of being copied: the editor
+ * holds the only reference to the root, every node on the path has a use
+ * count of one and is stored in a container that is not shared either.
+ * Everything else is copied like `node::set` does, thus trees that were
+ * handed out before are never changed.
+ *
+ * A path that is edited repeatedly is copied by the first `set` only,
+ * later ones reuse the copy. The members of large objects live in a HAMT
+ * that can share slots with other maps, thus below a large object the path
+ * is still copied.
+ *
+ * If an exception is thrown the tree of the editor stays valid and holds
+ * the previous `set`s, the one that threw may or may not be applied.
+ */
+class node_editor {
+ public:
+  node_editor() noexcept = default;
+  explicit node_editor(node_ptr root) noexcept : current(std::move(root)) {}
+
+  // same as `root = root->set(path, value)`
+  void set(node_path_view path, node_ptr const& value);
+  void set(node::path_slice const& path, node_ptr const& value);
+  void remove(node_path_view path) { set(path, nullptr); }
+  void remove(node::path_slice const& path) { set(path, nullptr); }
+
+  /*
+   * The current tree. Holding on to it is allowed, the editor copies what
+   * is shared from then on.
+   */
+  [[nodiscard]] node_ptr const& root() const noexcept { return current; }
+
+  [[nodiscard]] node_ptr finish() && noexcept { return std::move(current); }
+
+ private:
+  static void edit(node_ptr& slot, node_path_view path, node_ptr const& value);
+
+  node_ptr current;
+};
+
+#endif  // AGENCY_NODE_EDITOR_H
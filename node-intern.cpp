@@ -0,0 +1,505 @@
+#include "node-intern.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+#include "immer/flex_vector_transient.hpp"
+#include "immer/map_transient.hpp"
+
+#include "velocypack/Iterator.h"
+#include "velocypack/Slice.h"
+
+using arangodb::velocypack::ArrayIterator;
+using arangodb::velocypack::ObjectIterator;
+using arangodb::velocypack::Slice;
+
+namespace {
+
+std::atomic<std::size_t> intern_limit{0};
+std::atomic<std::size_t> intern_max_subtree_size{16};
+std::atomic<std::size_t> intern_used{0};
+
+constexpr std::uint64_t hash_seed_bool = 0x626f6f6c00000002;
+constexpr std::uint64_t hash_seed_number = 0x6e756d6200000003;
+constexpr std::uint64_t hash_seed_string = 0x7374726900000004;
+constexpr std::uint64_t hash_seed_array = 0x6172726100000005;
+constexpr std::uint64_t hash_seed_object = 0x6f626a6500000006;
+
+std::uint64_t hash_mix(std::uint64_t x) noexcept {
+  // splitmix64 finalizer
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111eb;
+  x ^= x >> 31;
+  return x;
+}
+
+std::uint64_t bits_of(double v) noexcept {
+  std::uint64_t bits;
+  static_assert(sizeof(bits) == sizeof(v));
+  std::memcpy(&bits, &v, sizeof(v));
+  return bits;
+}
+
+std::uint64_t hash_of(node const* n) noexcept {
+  return hash_mix(reinterpret_cast<std::uintptr_t>(n));
+}
+
+struct intern_entry {
+  std::uint64_t hash = 0;
+  node_ptr value;
+};
+
+/*
+ * One shard of the table. Open addressing with linear probing, like the
+ * key table. Entries are only removed by `sweep`, which rebuilds the shard.
+ */
+struct intern_shard {
+  mutable std::shared_mutex mutex;
+  std::vector<intern_entry> slots = std::vector<intern_entry>(16);
+  std::size_t used = 0;
+
+  [[nodiscard]] std::size_t mask() const noexcept { return slots.size() - 1; }
+
+  template <typename P>
+  [[nodiscard]] node_ptr const* find(std::uint64_t hash, P&& same) const {
+    auto pos = static_cast<std::size_t>(hash) & mask();
+    while (slots[pos].value != nullptr) {
+      if (slots[pos].hash == hash && same(*slots[pos].value)) {
+        return &slots[pos].value;
+      }
+      pos = (pos + 1) & mask();
+    }
+    return nullptr;
+  }
+
+  void insert(std::uint64_t hash, node_ptr value) {
+    if (2 * (used + 1) > slots.size()) {
+      rehash(2 * slots.size());
+    }
+    place(hash, std::move(value));
+  }
+
+  // removes entries with a use count of one, returns their number
+  std::size_t sweep() {
+    if (used == 0) {
+      return 0;
+    }
+    std::vector<intern_entry> old(slots.size());
+    std::swap(old, slots);
+    auto const before = used;
+    used = 0;
+    for (auto& e : old) {
+      if (e.value != nullptr && e.value.use_count() > 1) {
+        place(e.hash, std::move(e.value));
+      }
+    }
+    // `old` releases the removed nodes
+    return before - used;
+  }
+
+  std::size_t clear() {
+    auto const before = used;
+    slots = std::vector<intern_entry>(16);
+    used = 0;
+    return before;
+  }
+
+ private:
+  void place(std::uint64_t hash, node_ptr value) noexcept {
+    auto pos = static_cast<std::size_t>(hash) & mask();
+    while (slots[pos].value != nullptr) {
+      pos = (pos + 1) & mask();
+    }
+    slots[pos] = intern_entry{hash, std::move(value)};
+    used += 1;
+  }
+
+  void rehash(std::size_t size) {
+    std::vector<intern_entry> old(size);
+    std::swap(old, slots);
+    used = 0;
+    for (auto& e : old) {
+      if (e.value != nullptr) {
+        place(e.hash, std::move(e.value));
+      }
+    }
+  }
+};
+
+constexpr std::size_t shard_count = 64;
+
+struct intern_table {
+  std::array<intern_shard, shard_count> shards;
+
+  intern_table() = default;
+  intern_table(intern_table const&) = delete;
+  intern_table& operator=(intern_table const&) = delete;
+  ~intern_table() {
+    for (auto& shard : shards) {
+      intern_used.fetch_sub(shard.used, std::memory_order_relaxed);
+    }
+  }
+
+  intern_shard& shard_for(std::uint64_t hash) noexcept {
+    // the lower bits select the slot within the shard
+    return shards[(hash >> 58) % shard_count];
+  }
+
+  /*
+   * Returns the entry identical to the candidate or, if there is none, the
+   * node created by `make`. A new node is only stored while the table is
+   * below its limit.
+   */
+  template <typename P, typename F>
+  node_ptr find_or_insert(std::uint64_t hash, P&& same, F&& make) {
+    auto& shard = shard_for(hash);
+    {
+      std::shared_lock guard(shard.mutex);
+      if (auto e = shard.find(hash, same); e != nullptr) {
+        return *e;
+      }
+    }
+
+    node_ptr value = make();
+    if (intern_used.load(std::memory_order_relaxed) >= intern_limit.load(std::memory_order_relaxed)) {
+      return value;
+    }
+    std::unique_lock guard(shard.mutex);
+    if (auto e = shard.find(hash, same); e != nullptr) {
+      return *e;
+    }
+    shard.insert(hash, value);
+    intern_used.fetch_add(1, std::memory_order_relaxed);
+    return value;
+  }
+};
+
+#if AGENCY_NODE_ATOMIC_REFCOUNT
+intern_table& the_intern_table() {
+  // never destroyed, nodes might be released during static destruction
+  static auto* table = new intern_table();
+  return *table;
+}
+#else
+intern_table& the_intern_table() {
+  // plain reference counts, interned nodes must not leave their thread
+  thread_local intern_table table;
+  return table;
+}
+#endif
+
+}  // namespace
+
+/*
+ * Builds and looks up interned nodes. Children are interned before their
+ * parents, thus containers are identical if they have the same keys and
+ * the same child pointers.
+ */
+class node_interner {
+ public:
+  // node and number of nodes of its subtree
+  using result = std::pair<node_ptr, std::size_t>;
+
+  result from_slice(Slice s) {
+    if (s.isNumber()) {
+      auto const v = s.getNumber<double>();
+      return {leaf<node_double>(hash_mix(hash_seed_number ^ bits_of(v)), v), 1};
+    } else if (s.isString()) {
+      auto const v = s.stringView();
+      return {leaf<node_string>(hash_mix(hash_seed_string ^ node_key::hash_of(v)), v), 1};
+    } else if (s.isBool()) {
+      auto const v = s.getBool();
+      return {leaf<node_bool>(hash_mix(hash_seed_bool + v), v), 1};
+    } else if (s.isObject()) {
+      node_object::transient_type members;
+      std::size_t nodes = 1;
+      for (auto const& member : ObjectIterator(s)) {
+        auto [child, child_nodes] = from_slice(member.value);
+        members.set(node_key{member.key.stringView()}, std::move(child));
+        nodes += child_nodes;
+      }
+      return container(make_node_ptr(std::move(members).persistent()), nodes);
+    } else if (s.isArray()) {
+      std::vector<node_ptr> elements;
+      elements.reserve(s.length());
+      std::size_t nodes = 1;
+      for (auto const& member : ArrayIterator(s)) {
+        auto [child, child_nodes] = from_slice(member);
+        elements.push_back(std::move(child));
+        nodes += child_nodes;
+      }
+      return container(make_array(std::move(elements)), nodes);
+    }
+    return {node::null_node(), 1};
+  }
+
+  node_ptr value(double v) {
+    return leaf<node_double>(hash_mix(hash_seed_number ^ bits_of(v)), v);
+  }
+  node_ptr value(bool v) { return leaf<node_bool>(hash_mix(hash_seed_bool + v), v); }
+  node_ptr value(std::string_view v) {
+    return leaf<node_string>(hash_mix(hash_seed_string ^ node_key::hash_of(v)), v);
+  }
+
+  result intern(node_ptr const& n) {
+    if (n == nullptr) {
+      return {nullptr, 0};
+    }
+    return std::visit(
+        visitor{
+            [&](node_double const& v) -> result {
+              return {leaf<node_double>(hash_mix(hash_seed_number ^ bits_of(v.value)), v.value, &n), 1};
+            },
+            [&](node_string const& v) -> result {
+              return {leaf<node_string>(hash_mix(hash_seed_string ^ node_key::hash_of(v.value)),
+                                        std::string_view{v.value}, &n),
+                      1};
+            },
+            [&](node_bool const& v) -> result {
+              return {leaf<node_bool>(hash_mix(hash_seed_bool + v.value), v.value, &n), 1};
+            },
+            [&](node_null const&) -> result { return {n, 1}; },
+            [&](node_slice const&) -> result { return {n, 1}; },
+            [&](node_object const& o) -> result {
+              std::vector<std::pair<node_key, node_ptr>> changed;
+              std::size_t nodes = 1;
+              o.visit_members([&](auto const& c) {
+                for (auto const& [key, child] : c) {
+                  auto [interned, child_nodes] = intern(child);
+                  if (interned.get() != child.get()) {
+                    changed.emplace_back(key, std::move(interned));
+                  }
+                  nodes += child_nodes;
+                }
+              });
+              if (changed.empty()) {
+                return container(n, nodes);
+              }
+              auto members = o.transient();
+              for (auto& [key, child] : changed) {
+                members.put(std::move(key), std::move(child));
+              }
+              return container(make_node_ptr(std::move(members).persistent()), nodes);
+            },
+            [&](node_array const& a) -> result {
+              std::vector<node_ptr> elements;
+              elements.reserve(a.size());
+              std::size_t nodes = 1;
+              bool changed = false;
+              a.visit_elements([&](auto const& c) {
+                for (auto const& child : c) {
+                  auto [interned, child_nodes] = intern(child);
+                  changed = changed || interned.get() != child.get();
+                  elements.push_back(std::move(interned));
+                  nodes += child_nodes;
+                }
+              });
+              if (!changed) {
+                return container(n, nodes);
+              }
+              return container(make_array(std::move(elements)), nodes);
+            },
+        },
+        n->value);
+  }
+
+ private:
+  /*
+   * Leaves are looked up by value before a node is allocated. `existing`
+   * is returned instead of a new node if nothing is found.
+   */
+  template <typename T, typename V>
+  node_ptr leaf(std::uint64_t hash, V const& v, node_ptr const* existing = nullptr) {
+    return table.find_or_insert(
+        hash,
+        [&](node const& candidate) {
+          auto const* other = std::get_if<T>(&candidate.value);
+          if constexpr (std::is_same_v<T, node_double>) {
+            return other != nullptr && bits_of(other->value) == bits_of(v);
+          } else {
+            return other != nullptr && other->value == v;
+          }
+        },
+        [&] {
+          if (existing != nullptr) {
+            return *existing;
+          }
+          if constexpr (std::is_same_v<T, node_string>) {
+            return make_node_ptr(T{std::string{v}});
+          } else {
+            return make_node_ptr(T{v});
+          }
+        });
+  }
+
+  result container(node_ptr n, std::size_t nodes) {
+    if (nodes > intern_max_subtree_size.load(std::memory_order_relaxed)) {
+      return {std::move(n), nodes};
+    }
+    // `n` is moved into the table, the node itself stays where it is
+    auto const& raw = *n;
+    return {table.find_or_insert(
+                shallow_hash(raw), [&](node const& candidate) { return same_children(raw, candidate); },
+                [&] { return std::move(n); }),
+            nodes};
+  }
+
+  static std::uint64_t shallow_hash(node const& n) noexcept {
+    if (auto const* o = std::get_if<node_object>(&n.value); o != nullptr) {
+      // order insensitive, a HAMT does not keep the insertion order
+      std::uint64_t sum = 0;
+      o->visit_members([&](auto const& c) {
+        for (auto const& [key, child] : c) {
+          sum += hash_mix(key.hash() ^ hash_of(child.get()));
+        }
+      });
+      return hash_mix(hash_seed_object ^ hash_mix(sum + o->size()));
+    }
+    auto const& a = std::get<node_array>(n.value);
+    std::uint64_t state = hash_seed_array;
+    a.visit_elements([&](auto const& c) {
+      for (auto const& child : c) {
+        state = hash_mix(state + hash_of(child.get()));
+      }
+    });
+    return hash_mix(state ^ a.size());
+  }
+
+  static bool same_children(node const& n, node const& candidate) noexcept {
+    if (n.value.index() != candidate.value.index()) {
+      return false;
+    }
+    if (auto const* o = std::get_if<node_object>(&n.value); o != nullptr) {
+      auto const& other = std::get<node_object>(candidate.value);
+      if (o->size() != other.size()) {
+        return false;
+      }
+      return o->visit_members([&](auto const& c) {
+        for (auto const& [key, child] : c) {
+          auto const* found = other.find(key);
+          if (found == nullptr || found->get() != child.get()) {
+            return false;
+          }
+        }
+        return true;
+      });
+    }
+    auto const& a = std::get<node_array>(n.value);
+    auto const& other = std::get<node_array>(candidate.value);
+    if (a.size() != other.size()) {
+      return false;
+    }
+    for (std::size_t i = 0; i < a.size(); i++) {
+      if (a.at(i).get() != other.at(i).get()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static node_ptr make_array(std::vector<node_ptr> elements) {
+    if (elements.size() <= node_small_container_limit) {
+      return make_node_ptr(node_array{
+          node_array::small_container_type(std::make_move_iterator(elements.begin()),
+                                           std::make_move_iterator(elements.end()))});
+    }
+    auto result = node_array::container_type{}.transient();
+    for (auto& e : elements) {
+      result.push_back(std::move(e));
+    }
+    return make_node_ptr(node_array{result.persistent()});
+  }
+
+  intern_table& table = the_intern_table();
+};
+
+void node_intern_table::set_limit(std::size_t entries) noexcept {
+  intern_limit.store(entries, std::memory_order_relaxed);
+}
+
+void node_intern_table::set_max_subtree_size(std::size_t nodes) noexcept {
+  intern_max_subtree_size.store(nodes, std::memory_order_relaxed);
+}
+
+std::size_t node_intern_table::limit() noexcept {
+  return intern_limit.load(std::memory_order_relaxed);
+}
+
+std::size_t node_intern_table::max_subtree_size() noexcept {
+  return intern_max_subtree_size.load(std::memory_order_relaxed);
+}
+
+std::size_t node_intern_table::size() noexcept {
+  return intern_used.load(std::memory_order_relaxed);
+}
+
+node_ptr node_intern_table::intern(node_ptr const& n) {
+  if (limit() == 0) {
+    return n;
+  }
+  return node_interner{}.intern(n).first;
+}
+
+node_ptr node_intern_table::from_slice(Slice s) {
+  return node_interner{}.from_slice(s).first;
+}
+
+node_ptr node_intern_table::from_value(double v) { return node_interner{}.value(v); }
+
+node_ptr node_intern_table::from_value(bool v) { return node_interner{}.value(v); }
+
+node_ptr node_intern_table::from_value(std::string_view v) {
+  return node_interner{}.value(v);
+}
+
+std::size_t node_intern_table::sweep() {
+  // Removing a subtree releases its children, which might then be only
+  // referenced by the table. Repeat until nothing changes.
+  std::size_t total = 0;
+  while (true) {
+    std::size_t removed = 0;
+    for (auto& shard : the_intern_table().shards) {
+      std::unique_lock guard(shard.mutex);
+      removed += shard.sweep();
+    }
+    intern_used.fetch_sub(removed, std::memory_order_relaxed);
+    total += removed;
+    if (removed == 0) {
+      return total;
+    }
+  }
+}
+
+std::size_t node_intern_table::sweep_step() noexcept {
+  if (size() == 0) {
+    return 0;
+  }
+  static std::atomic<std::size_t> next_shard{0};
+  auto& shard =
+      the_intern_table().shards[next_shard.fetch_add(1, std::memory_order_relaxed) % shard_count];
+  std::unique_lock guard(shard.mutex);
+  try {
+    auto const removed = shard.sweep();
+    intern_used.fetch_sub(removed, std::memory_order_relaxed);
+    return removed;
+  } catch (std::bad_alloc const&) {
+    // the shard is left as it was, the next round tries again
+    return 0;
+  }
+}
+
+void node_intern_table::clear() {
+  for (auto& shard : the_intern_table().shards) {
+    std::unique_lock guard(shard.mutex);
+    intern_used.fetch_sub(shard.clear(), std::memory_order_relaxed);
+  }
+}
@@ -0,0 +1,61 @@
+#ifndef AGENCY_NODE_INTERN_H
+#define AGENCY_NODE_INTERN_H
+
+#include <cstddef>
+#include <string_view>
+
+#include "node.h"
+
+/*
+ * Hash-consing of leaves and small subtrees. While enabled, `node::from_slice`
+ * and `node::value_node` return the same node for identical values, thus
+ * imports, the leaves of lazy nodes, the values read by the deserializers and
+ * the values of writes share their nodes with everything that was imported
+ * before. Comparing two interned nodes is a pointer comparison.
+ *
+ * Values are identical if they serialize the same, e.g. `0` and `-0` are
+ * not. Subtrees with at most `max_subtree_size` nodes are interned after
+ * their children, larger ones are not, their children are. Lazy nodes are
+ * never interned, `null` is shared anyway.
+ *
+ * The table holds a reference to every entry. `sweep` removes the entries
+ * nobody else refers to. `sweep_step` does the same for one shard of the
+ * table, the reclaimer of a `node_root` calls it whenever it has freed
+ * retired versions, thus the entries of dropped versions are released
+ * without calling `sweep`, a few writes later. No entries are added while
+ * `size` would exceed `limit`, a limit of zero disables interning, which is
+ * the default.
+ *
+ * Without atomic reference counts the table is thread local, like the
+ * shared null node.
+ */
+struct node_intern_table {
+  static void set_limit(std::size_t entries) noexcept;
+  static void set_max_subtree_size(std::size_t nodes) noexcept;
+  [[nodiscard]] static std::size_t limit() noexcept;
+  [[nodiscard]] static std::size_t max_subtree_size() noexcept;
+  [[nodiscard]] static std::size_t size() noexcept;
+
+  /*
+   * Returns `n` with all its leaves and small subtrees replaced by their
+   * interned nodes. Containers are copied if one of their children was
+   * replaced, `n` itself is returned if interning is disabled.
+   */
+  [[nodiscard]] static node_ptr intern(node_ptr const& n);
+
+  // removes the entries only referenced by the table, returns their number
+  static std::size_t sweep();
+  // same as `sweep` for the next shard only, children of removed entries are
+  // removed by later steps
+  static std::size_t sweep_step() noexcept;
+  static void clear();
+
+ private:
+  friend struct node;
+  static node_ptr from_slice(arangodb::velocypack::Slice s);
+  static node_ptr from_value(double v);
+  static node_ptr from_value(bool v);
+  static node_ptr from_value(std::string_view v);
+};
+
+#endif  // AGENCY_NODE_INTERN_H
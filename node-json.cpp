@@ -0,0 +1,467 @@
+#include "node-json.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <ostream>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "node.h"
+
+#include "velocypack/Exception.h"
+#include "velocypack/Iterator.h"
+#include "velocypack/Slice.h"
+
+namespace arangodb::velocypack {
+int fpconv_dtoa(double fp, char dest[24]);
+}
+
+using namespace arangodb::velocypack;
+
+void node_json_buffer_sink::write(char const* data, std::size_t size) {
+  buffer.append(data, size);
+}
+
+void node_json_fd_sink::write(char const* data, std::size_t size) {
+  while (size > 0) {
+    auto const written = ::write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(), "writing json");
+    }
+    data += written;
+    size -= static_cast<std::size_t>(written);
+  }
+}
+
+void node_json_ostream_sink::write(char const* data, std::size_t size) {
+  os.write(data, static_cast<std::streamsize>(size));
+}
+
+namespace {
+
+// characters that have to be escaped, zero means none, 'u' means \u00XX
+constexpr std::array<char, 128> escape_table = [] {
+  std::array<char, 128> table{};
+  for (std::size_t c = 0; c < 0x20; c++) {
+    table[c] = 'u';
+  }
+  table['\b'] = 'b';
+  table['\t'] = 't';
+  table['\n'] = 'n';
+  table['\f'] = 'f';
+  table['\r'] = 'r';
+  table['"'] = '"';
+  table['\\'] = '\\';
+  return table;
+}();
+
+[[nodiscard]] bool needs_escape(unsigned char c) noexcept {
+  return c < escape_table.size() && escape_table[c] != 0;
+}
+
+/*
+ * Length of the prefix of [p, end) that can be copied as is. Looks at 16
+ * bytes at a time with SSE2, otherwise at 8 bytes at a time in a register.
+ */
+std::size_t plain_prefix(char const* p, char const* end) noexcept {
+  auto const* begin = p;
+#if defined(__SSE2__)
+  auto const quote = _mm_set1_epi8('"');
+  auto const backslash = _mm_set1_epi8('\\');
+  auto const control = _mm_set1_epi8(0x1f);
+  while (end - p >= 16) {
+    auto const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p));
+    // unsigned chunk <= 0x1f
+    auto const is_control = _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control);
+    auto const is_special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                         _mm_cmpeq_epi8(chunk, backslash));
+    auto const mask = _mm_movemask_epi8(_mm_or_si128(is_control, is_special));
+    if (mask != 0) {
+      return (p - begin) + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    p += 16;
+  }
+#else
+  constexpr std::uint64_t ones = 0x0101010101010101ull;
+  constexpr std::uint64_t highs = 0x8080808080808080ull;
+  auto const has_zero = [](std::uint64_t v) { return (v - ones) & ~v & highs; };
+  while (end - p >= 8) {
+    std::uint64_t chunk;
+    std::memcpy(&chunk, p, sizeof(chunk));
+    // bytes below 0x20, equal to '"' or equal to '\\'
+    auto const special = ((chunk - ones * 0x20) & ~chunk & highs) |
+                         has_zero(chunk ^ (ones * '"')) | has_zero(chunk ^ (ones * '\\'));
+    if (special != 0) {
+      break;
+    }
+    p += 8;
+  }
+#endif
+  while (p != end && !needs_escape(static_cast<unsigned char>(*p))) {
+    ++p;
+  }
+  return p - begin;
+}
+
+}  // namespace
+
+/*
+ * Walks the node variant directly. node_slice values are written from the
+ * slice without materializing them.
+ */
+class node_json_writer {
+ public:
+  node_json_writer(node_json_sink& sink, node_json_options options) noexcept
+      : sink(sink), options(options) {}
+
+  node_json_writer(node_json_writer const&) = delete;
+  node_json_writer& operator=(node_json_writer const&) = delete;
+
+  void write_node(node const& n) {
+    std::visit(visitor{
+                   [&](node_string const& s) { write_string(s.value); },
+                   [&](node_double const& d) { write_double(d.value); },
+                   [&](node_bool const& b) { write_bool(b.value); },
+                   [&](node_null const&) { append("null"); },
+                   [&](node_array const& a) { write_array(a); },
+                   [&](node_object const& o) { write_object(o); },
+                   [&](node_slice const& s) { write_slice(s.slice); },
+               },
+               n.value);
+  }
+
+  void flush() {
+    if (used > 0) {
+      sink.write(buffer.data(), used);
+      used = 0;
+    }
+  }
+
+ private:
+  void write_array(node_array const& a) {
+    open('[', a.empty());
+    bool first = true;
+    a.visit_elements([&](auto const& c) {
+      for (auto const& element : c) {
+        next_element(first);
+        write_node(*element);
+      }
+    });
+    close(']', a.empty());
+  }
+
+  void write_object(node_object const& o) {
+    auto const empty = o.size() == 0;
+    open('{', empty);
+    bool first = true;
+    if (!options.sort_keys) {
+      o.visit_members([&](auto const& c) {
+        for (auto const& member : c) {
+          next_element(first);
+          write_member(member.first.view(), *member.second);
+        }
+      });
+    } else {
+      auto& members = scratch<node const*>(node_members);
+      o.visit_members([&](auto const& c) {
+        for (auto const& member : c) {
+          members.emplace_back(member.first.view(), member.second.get());
+        }
+      });
+      sort(members);
+      for (auto const& [key, value] : members) {
+        next_element(first);
+        write_member(key, *value);
+      }
+      release(node_members);
+    }
+    close('}', empty);
+  }
+
+  void write_slice(Slice s) {
+    switch (s.type()) {
+      case ValueType::Null:
+        append("null");
+        break;
+      case ValueType::Bool:
+        write_bool(s.getBool());
+        break;
+      case ValueType::Double:
+        write_double(s.getDouble());
+        break;
+      case ValueType::Int:
+      case ValueType::SmallInt:
+        write_integer(s.getInt());
+        break;
+      case ValueType::UInt:
+        write_integer(s.getUInt());
+        break;
+      case ValueType::String:
+        write_string(s.stringView());
+        break;
+      case ValueType::Array: {
+        auto const empty = s.length() == 0;
+        open('[', empty);
+        bool first = true;
+        for (auto const& element : ArrayIterator(s)) {
+          next_element(first);
+          write_slice(element);
+        }
+        close(']', empty);
+        break;
+      }
+      case ValueType::Object: {
+        auto const empty = s.length() == 0;
+        open('{', empty);
+        bool first = true;
+        if (!options.sort_keys) {
+          for (auto const& member : ObjectIterator(s, true)) {
+            next_element(first);
+            write_member(member.key.stringView(), member.value);
+          }
+        } else {
+          auto& members = scratch<Slice>(slice_members);
+          for (auto const& member : ObjectIterator(s, true)) {
+            members.emplace_back(member.key.stringView(), member.value);
+          }
+          sort(members);
+          for (auto const& [key, value] : members) {
+            next_element(first);
+            write_member(key, value);
+          }
+          release(slice_members);
+        }
+        close('}', empty);
+        break;
+      }
+      default:
+        throw Exception(Exception::NoJsonEquivalent);
+    }
+  }
+
+  void write_member(std::string_view key, node const& value) {
+    write_string(key);
+    append(options.pretty ? " : " : ":");
+    write_node(value);
+  }
+
+  void write_member(std::string_view key, Slice value) {
+    write_string(key);
+    append(options.pretty ? " : " : ":");
+    write_slice(value);
+  }
+
+  void write_string(std::string_view s) {
+    // worst case every character becomes \u00XX
+    auto const worst_case = 6 * s.size() + 2;
+    if (worst_case > buffer.size()) {
+      write_long_string(s);
+      return;
+    }
+
+    auto out = reserve(worst_case);
+    *out++ = '"';
+    auto p = s.data();
+    auto const end = p + s.size();
+    while (p != end) {
+      auto const plain = plain_prefix(p, end);
+      std::memcpy(out, p, plain);
+      out += plain;
+      p += plain;
+      if (p == end) {
+        break;
+      }
+      out = escape(static_cast<unsigned char>(*p++), out);
+    }
+    *out++ = '"';
+    used = out - buffer.data();
+  }
+
+  void write_long_string(std::string_view s) {
+    put('"');
+    auto p = s.data();
+    auto const end = p + s.size();
+    while (p != end) {
+      auto const plain = plain_prefix(p, end);
+      append(std::string_view{p, plain});
+      p += plain;
+      if (p == end) {
+        break;
+      }
+      char temp[6];
+      auto const length = escape(static_cast<unsigned char>(*p++), temp) - temp;
+      append(std::string_view{temp, static_cast<std::size_t>(length)});
+    }
+    put('"');
+  }
+
+  static char* escape(unsigned char c, char* out) noexcept {
+    constexpr char digits[] = "0123456789ABCDEF";
+    auto const escaped = escape_table[c];
+    *out++ = '\\';
+    *out++ = escaped;
+    if (escaped == 'u') {
+      *out++ = '0';
+      *out++ = '0';
+      *out++ = digits[c >> 4];
+      *out++ = digits[c & 0xf];
+    }
+    return out;
+  }
+
+  void write_double(double d) {
+    if (std::isnan(d) || !std::isfinite(d)) {
+      throw Exception(Exception::NoJsonEquivalent);
+    }
+    used += fpconv_dtoa(d, reserve(24));
+  }
+
+  template <typename T>
+  void write_integer(T v) {
+    auto const out = reserve(24);
+    used = std::to_chars(out, out + 24, v).ptr - buffer.data();
+  }
+
+  void write_bool(bool b) { append(b ? "true" : "false"); }
+
+  void open(char c, bool empty) {
+    put(c);
+    if (options.pretty) {
+      put('\n');
+      depth += 1;
+      if (empty) {
+        // velocypack prints "[\n]" for empty containers
+        depth -= 1;
+        indent();
+      }
+    }
+  }
+
+  void close(char c, bool empty) {
+    if (options.pretty && !empty) {
+      put('\n');
+      depth -= 1;
+      indent();
+    }
+    put(c);
+  }
+
+  void next_element(bool& first) {
+    if (!first) {
+      put(',');
+      if (options.pretty) {
+        put('\n');
+      }
+    }
+    first = false;
+    if (options.pretty) {
+      indent();
+    }
+  }
+
+  void indent() {
+    for (std::size_t i = 0; i < depth; i++) {
+      append("  ");
+    }
+  }
+
+  template <typename V>
+  static void sort(std::vector<std::pair<std::string_view, V>>& members) {
+    std::sort(members.begin(), members.end(),
+              [](auto const& a, auto const& b) { return a.first < b.first; });
+  }
+
+  /*
+   * The member lists for sorting are reused per nesting level, thus they are
+   * allocated once for every level instead of once for every object.
+   */
+  template <typename V>
+  using member_list = std::vector<std::pair<std::string_view, V>>;
+
+  template <typename V>
+  struct member_lists {
+    // a deque keeps the lists of the outer levels in place
+    std::deque<member_list<V>> levels;
+    std::size_t used = 0;
+  };
+
+  template <typename V>
+  member_list<V>& scratch(member_lists<V>& lists) {
+    if (lists.used == lists.levels.size()) {
+      lists.levels.emplace_back();
+    }
+    auto& list = lists.levels[lists.used++];
+    list.clear();
+    return list;
+  }
+
+  template <typename V>
+  static void release(member_lists<V>& lists) noexcept {
+    lists.used -= 1;
+  }
+
+  // returns space for at least `n` <= buffer.size() characters
+  char* reserve(std::size_t n) {
+    if (buffer.size() - used < n) {
+      flush();
+    }
+    return buffer.data() + used;
+  }
+
+  void put(char c) {
+    if (used == buffer.size()) {
+      flush();
+    }
+    buffer[used++] = c;
+  }
+
+  void append(std::string_view s) {
+    while (!s.empty()) {
+      if (used == buffer.size()) {
+        flush();
+      }
+      auto const n = std::min(s.size(), buffer.size() - used);
+      std::memcpy(buffer.data() + used, s.data(), n);
+      used += n;
+      s.remove_prefix(n);
+    }
+  }
+
+  node_json_sink& sink;
+  node_json_options const options;
+  std::size_t depth = 0;
+  member_lists<node const*> node_members;
+  member_lists<Slice> slice_members;
+
+  std::size_t used = 0;
+  std::array<char, 16 * 1024> buffer;
+};
+
+void write_json(node const& n, node_json_sink& sink, node_json_options options) {
+  node_json_writer writer{sink, options};
+  writer.write_node(n);
+  writer.flush();
+}
+
+std::string to_json(node const& n, node_json_options options) {
+  std::string result;
+  node_json_buffer_sink sink{result};
+  write_json(n, sink, options);
+  return result;
+}
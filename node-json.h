@@ -0,0 +1,67 @@
+#ifndef AGENCY_NODE_JSON_H
+#define AGENCY_NODE_JSON_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+
+struct node;
+
+/*
+ * Destination of the JSON writer. The writer collects its output in a small
+ * buffer of its own and passes it on in chunks, thus writing a tree needs
+ * memory proportional to its depth, not to the size of the document.
+ */
+class node_json_sink {
+ public:
+  virtual ~node_json_sink() = default;
+  virtual void write(char const* data, std::size_t size) = 0;
+};
+
+// appends to a string
+class node_json_buffer_sink final : public node_json_sink {
+ public:
+  explicit node_json_buffer_sink(std::string& buffer) noexcept : buffer(buffer) {}
+  void write(char const* data, std::size_t size) override;
+
+ private:
+  std::string& buffer;
+};
+
+// writes to a file descriptor, throws std::system_error on failure
+class node_json_fd_sink final : public node_json_sink {
+ public:
+  explicit node_json_fd_sink(int fd) noexcept : fd(fd) {}
+  void write(char const* data, std::size_t size) override;
+
+ private:
+  int fd;
+};
+
+class node_json_ostream_sink final : public node_json_sink {
+ public:
+  explicit node_json_ostream_sink(std::ostream& os) noexcept : os(os) {}
+  void write(char const* data, std::size_t size) override;
+
+ private:
+  std::ostream& os;
+};
+
+struct node_json_options {
+  // sorts object keys bytewise, like velocypack does, otherwise they are
+  // written in the order of the node
+  bool sort_keys = false;
+  // same layout as the velocypack pretty printer
+  bool pretty = false;
+};
+
+/*
+ * Writes `n` as JSON to `sink` without building velocypack first. Doubles
+ * are formatted with fpconv, like the velocypack dumper does. Throws a
+ * velocypack exception for values without JSON representation.
+ */
+void write_json(node const& n, node_json_sink& sink, node_json_options options = {});
+
+[[nodiscard]] std::string to_json(node const& n, node_json_options options = {});
+
+#endif  // AGENCY_NODE_JSON_H
@@ -0,0 +1,195 @@
+#include "node-key.h"
+
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <shared_mutex>
+#include <vector>
+
+#define XXH_STATIC_LINKING_ONLY
+#include "velocypack/src/xxhash.h"
+
+namespace {
+
+using table_entry = node_key::table_entry;
+
+/*
+ * One shard of the intern table. Open addressing with linear probing, the
+ * slots only store entry pointers, the hash is read from the entry.
+ */
+struct intern_shard {
+  mutable std::shared_mutex mutex;
+  std::vector<table_entry*> slots = std::vector<table_entry*>(16, nullptr);
+  std::size_t used = 0;
+
+  [[nodiscard]] std::size_t mask() const noexcept { return slots.size() - 1; }
+
+  [[nodiscard]] std::size_t position(std::string_view name, std::uint64_t hash) const noexcept {
+    auto pos = static_cast<std::size_t>(hash) & mask();
+    while (slots[pos] != nullptr) {
+      auto e = slots[pos];
+      if (e->hash == hash && std::string_view{e->data(), e->size} == name) {
+        return pos;
+      }
+      pos = (pos + 1) & mask();
+    }
+    return pos;
+  }
+
+  void insert(table_entry* e) {
+    if (2 * (used + 1) > slots.size()) {
+      grow();
+    }
+    auto pos = static_cast<std::size_t>(e->hash) & mask();
+    while (slots[pos] != nullptr) {
+      pos = (pos + 1) & mask();
+    }
+    slots[pos] = e;
+    used += 1;
+  }
+
+  void erase(std::size_t pos) noexcept {
+    // backward shift deletion, keeps probe sequences intact without tombstones
+    slots[pos] = nullptr;
+    used -= 1;
+    auto next = (pos + 1) & mask();
+    while (slots[next] != nullptr) {
+      auto const home = static_cast<std::size_t>(slots[next]->hash) & mask();
+      if (((next - home) & mask()) >= ((next - pos) & mask())) {
+        slots[pos] = slots[next];
+        slots[next] = nullptr;
+        pos = next;
+      }
+      next = (next + 1) & mask();
+    }
+  }
+
+ private:
+  void grow() {
+    std::vector<table_entry*> old(2 * slots.size(), nullptr);
+    std::swap(old, slots);
+    used = 0;
+    for (auto e : old) {
+      if (e != nullptr) {
+        insert(e);
+      }
+    }
+  }
+};
+
+constexpr std::size_t shard_count = 64;
+
+struct intern_table {
+  std::array<intern_shard, shard_count> shards;
+
+  intern_shard& shard_for(std::uint64_t hash) noexcept {
+    // the lower bits select the slot within the shard
+    return shards[(hash >> 58) % shard_count];
+  }
+};
+
+intern_table& the_intern_table() {
+  // never destroyed, keys might be released during static destruction
+  static auto* table = new intern_table();
+  return *table;
+}
+
+table_entry* make_entry(std::string_view name, std::uint64_t hash) {
+  auto memory = ::operator new(sizeof(table_entry) + name.size());
+  auto e = new (memory) table_entry{};
+  e->refcount.store(1, std::memory_order_relaxed);
+  e->size = static_cast<std::uint32_t>(name.size());
+  e->hash = hash;
+  std::memcpy(const_cast<char*>(e->data()), name.data(), name.size());
+  return e;
+}
+
+}  // namespace
+
+std::uint64_t node_key::hash_of(std::string_view name) noexcept {
+  return XXH3_64bits(name.data(), name.size());
+}
+
+node_key::node_key(std::string_view name) : node_key(name, hash_of(name)) {}
+
+node_key::node_key(std::string_view name, std::uint64_t hash) {
+  auto& shard = the_intern_table().shard_for(hash);
+  {
+    std::shared_lock guard(shard.mutex);
+    if (auto e = shard.slots[shard.position(name, hash)]; e != nullptr) {
+      acquire(e);
+      entry = e;
+      return;
+    }
+  }
+
+  std::unique_lock guard(shard.mutex);
+  if (auto e = shard.slots[shard.position(name, hash)]; e != nullptr) {
+    acquire(e);
+    entry = e;
+    return;
+  }
+
+  entry = make_entry(name, hash);
+  shard.insert(entry);
+}
+
+node_key node_key::find(std::string_view name) noexcept {
+  return find(name, hash_of(name));
+}
+
+node_key node_key::find(std::string_view name, std::uint64_t hash) noexcept {
+  auto& shard = the_intern_table().shard_for(hash);
+  std::shared_lock guard(shard.mutex);
+  if (auto e = shard.slots[shard.position(name, hash)]; e != nullptr) {
+    acquire(e);
+    return node_key{e};
+  }
+  return node_key{};
+}
+
+node_key_probe::node_key_probe(std::string_view name, std::uint64_t hash) noexcept {
+  if (name.size() > inline_size) {
+    key = node_key::find(name, hash);
+    return;
+  }
+  auto e = new (storage) table_entry{};
+  e->size = static_cast<std::uint32_t>(name.size());
+  e->hash = hash;
+  std::memcpy(storage + sizeof(table_entry), name.data(), name.size());
+  key.entry = e;
+  borrowed = true;
+}
+
+node_key_probe::~node_key_probe() {
+  if (borrowed) {
+    // the entry is not in the table and must not be released
+    key.entry = nullptr;
+  }
+}
+
+void node_key::release_last() noexcept {
+  auto& shard = the_intern_table().shard_for(entry->hash);
+  std::unique_lock guard(shard.mutex);
+  if (entry->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    shard.erase(shard.position(view(), entry->hash));
+    entry->~table_entry();
+    ::operator delete(entry);
+  }
+  entry = nullptr;
+}
+
+std::size_t node_key::interned_count() noexcept {
+  std::size_t count = 0;
+  for (auto& shard : the_intern_table().shards) {
+    std::shared_lock guard(shard.mutex);
+    count += shard.used;
+  }
+  return count;
+}
+
+std::ostream& operator<<(std::ostream& os, node_key const& key) {
+  return os << key.view();
+}
@@ -0,0 +1,177 @@
+#ifndef AGENCY_NODE_KEY_H
+#define AGENCY_NODE_KEY_H
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+
+#include "node-allocator.h"
+
+/*
+ * Handle to an interned attribute name. All handles for the same name point
+ * to the same entry of a global, thread-safe table. The entry stores the name
+ * together with its precomputed xxh3 hash, thus hashing a key is a load and
+ * comparing two keys is a pointer comparison. Entries are reference counted
+ * and removed from the table when the last handle is gone.
+ *
+ * A default constructed key is empty and not equal to any interned key.
+ */
+class node_key {
+ public:
+  node_key() noexcept = default;
+  explicit node_key(std::string_view name);
+  node_key(std::string_view name, std::uint64_t hash);
+
+  node_key(node_key const& other) noexcept : entry(other.entry) {
+    if (entry != nullptr) {
+      acquire(entry);
+    }
+  }
+  node_key(node_key&& other) noexcept : entry(other.entry) {
+    other.entry = nullptr;
+  }
+  node_key& operator=(node_key const& other) noexcept {
+    node_key{other}.swap(*this);
+    return *this;
+  }
+  node_key& operator=(node_key&& other) noexcept {
+    node_key{std::move(other)}.swap(*this);
+    return *this;
+  }
+  ~node_key() {
+    if (entry != nullptr) {
+      release();
+    }
+  }
+
+  void swap(node_key& other) noexcept { std::swap(entry, other.entry); }
+
+  /*
+   * Returns the interned key for `name` or an empty key, if no such key exists
+   * at the moment. Does not insert into the table.
+   */
+  [[nodiscard]] static node_key find(std::string_view name) noexcept;
+  [[nodiscard]] static node_key find(std::string_view name, std::uint64_t hash) noexcept;
+
+  [[nodiscard]] static std::uint64_t hash_of(std::string_view name) noexcept;
+
+  [[nodiscard]] std::string_view view() const noexcept {
+    return entry == nullptr ? std::string_view{}
+                            : std::string_view{entry->data(), entry->size};
+  }
+  [[nodiscard]] std::string str() const { return std::string{view()}; }
+  [[nodiscard]] std::uint64_t hash() const noexcept {
+    return entry == nullptr ? 0 : entry->hash;
+  }
+  [[nodiscard]] bool empty() const noexcept { return entry == nullptr; }
+  explicit operator bool() const noexcept { return entry != nullptr; }
+
+  bool operator==(node_key const& other) const noexcept {
+    return entry == other.entry;
+  }
+  bool operator!=(node_key const& other) const noexcept {
+    return entry != other.entry;
+  }
+
+  /*
+   * Returns the number of names currently interned.
+   */
+  [[nodiscard]] static std::size_t interned_count() noexcept;
+
+  /*
+   * The name is stored directly behind the entry.
+   */
+  struct table_entry {
+    std::atomic<std::uint32_t> refcount;
+    std::uint32_t size;
+    std::uint64_t hash;
+
+    [[nodiscard]] char const* data() const noexcept {
+      return reinterpret_cast<char const*>(this + 1);
+    }
+  };
+
+ private:
+  friend class node_key_probe;
+
+  explicit node_key(table_entry* e) noexcept : entry(e) {}
+
+  static void acquire(table_entry* e) noexcept {
+    if (node_refcount_single_threaded()) {
+      e->refcount.store(e->refcount.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+    } else {
+      e->refcount.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void release() noexcept {
+    // Counts above one are decremented without the table lock. The last
+    // reference is dropped while holding the lock, so a concurrent `find`
+    // can not resurrect an entry that is about to be removed.
+    auto current = entry->refcount.load(std::memory_order_relaxed);
+    if (current > 1 && node_refcount_single_threaded()) {
+      entry->refcount.store(current - 1, std::memory_order_relaxed);
+      return;
+    }
+    while (current > 1) {
+      if (entry->refcount.compare_exchange_weak(current, current - 1,
+                                                std::memory_order_acq_rel)) {
+        return;
+      }
+    }
+    release_last();
+  }
+
+  void release_last() noexcept;
+
+  table_entry* entry = nullptr;
+};
+
+struct node_key_hash {
+  std::size_t operator()(node_key const& key) const noexcept {
+    return key.hash();
+  }
+};
+
+/*
+ * Interned keys are equal if and only if they are the same entry, the names
+ * are only compared for keys with equal hashes from different entries, i.e.
+ * a `node_key_probe`.
+ */
+struct node_key_equal {
+  bool operator()(node_key const& left, node_key const& right) const noexcept {
+    return left == right || (left.hash() == right.hash() && left.view() == right.view());
+  }
+};
+
+/*
+ * A key for looking up a name in containers compared by `node_key_equal`
+ * without interning it. The entry is built inside the probe, thus neither
+ * the table lock nor a reference count is touched. Names longer than
+ * `inline_size` are looked up in the table instead, `get` is then empty if
+ * the name is not interned.
+ */
+class node_key_probe {
+ public:
+  static constexpr std::size_t inline_size = 112;
+
+  node_key_probe(std::string_view name, std::uint64_t hash) noexcept;
+  ~node_key_probe();
+
+  node_key_probe(node_key_probe const&) = delete;
+  node_key_probe& operator=(node_key_probe const&) = delete;
+
+  [[nodiscard]] node_key const& get() const noexcept { return key; }
+
+ private:
+  alignas(node_key::table_entry) unsigned char storage[sizeof(node_key::table_entry) + inline_size];
+  bool borrowed = false;
+  node_key key;
+};
+
+std::ostream& operator<<(std::ostream& os, node_key const& key);
+
+#endif  // AGENCY_NODE_KEY_H
@@ -0,0 +1,525 @@
+#include "node-memory.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+
+#include "velocypack/Buffer.h"
+
+namespace {
+
+using champ_type = std::decay_t<decltype(std::declval<node_object::container_type const&>().impl())>;
+using champ_node = champ_type::node_t;
+using champ_values = champ_node::values_t;
+using immer::detail::hamts::count_t;
+using immer::detail::hamts::popcount;
+
+constexpr count_t champ_max_depth = immer::detail::hamts::max_depth<champ_type::bits>;
+
+using vpack_buffer = arangodb::velocypack::Buffer<uint8_t>;
+// size of the storage inside of a velocypack buffer object
+constexpr std::size_t vpack_buffer_local_capacity = 192;
+
+// strings up to this length are stored inside the std::string
+std::size_t const string_inline_capacity = std::string{}.capacity();
+
+template <typename R>
+std::size_t immer_use_count(R const& refs) noexcept {
+  // atomic for the thread-safe policy, a plain int otherwise
+  return static_cast<std::size_t>(static_cast<int>(refs.refcount));
+}
+
+}  // namespace
+
+/*
+ * A single allocation of a tree: a node, a HAMT node, the value array of a
+ * HAMT node or a velocypack buffer.
+ */
+class node_memory_walker {
+ public:
+  enum class kind : std::uint8_t { node, champ, champ_values, buffer };
+
+  struct allocation {
+    kind type;
+    void const* ptr;
+    // depth of a HAMT node, number of entries of a value array
+    count_t extra = 0;
+  };
+
+  // name of a child node in its parent, `key` is nullptr for array elements
+  struct member_name {
+    node_key const* key = nullptr;
+    std::size_t index = 0;
+  };
+
+  static allocation of(node const* n) noexcept { return {kind::node, n}; }
+
+  static std::size_t own_bytes(allocation a) noexcept {
+    switch (a.type) {
+      case kind::node:
+        return sizeof(node) + storage_bytes(*static_cast<node const*>(a.ptr));
+      case kind::champ: {
+        auto const* n = static_cast<champ_node const*>(a.ptr);
+        if (a.extra == champ_max_depth) {
+          return champ_node::sizeof_collision_n(n->collision_count());
+        }
+        return champ_node::sizeof_inner_n(popcount(n->nodemap()));
+      }
+      case kind::champ_values:
+        return champ_node::sizeof_values_n(a.extra);
+      case kind::buffer: {
+        auto const* b = static_cast<vpack_buffer const*>(a.ptr);
+        return sizeof(vpack_buffer) +
+               (b->capacity() > vpack_buffer_local_capacity ? b->capacity() : 0);
+      }
+    }
+    return 0;
+  }
+
+  // references held on `a`, including the ones from the accounted trees
+  static std::size_t use_count(allocation a, node_slice::buffer_ptr const* buffer) noexcept {
+    switch (a.type) {
+      case kind::node:
+        return static_cast<node const*>(a.ptr)->refcount.load();
+      case kind::champ:
+        return immer_use_count(champ_node::refs(static_cast<champ_node const*>(a.ptr)));
+      case kind::champ_values:
+        return immer_use_count(champ_node::refs(static_cast<champ_values const*>(a.ptr)));
+      case kind::buffer:
+        return buffer == nullptr ? 1 : buffer->use_count();
+    }
+    return 0;
+  }
+
+  /*
+   * Calls `f(child, name)` for every allocation that `a` refers to. `name`
+   * is only meaningful for nodes.
+   */
+  template <typename F>
+  static void for_each_child(allocation a, F&& f) {
+    switch (a.type) {
+      case kind::node:
+        return for_each_node_child(*static_cast<node const*>(a.ptr), f);
+      case kind::champ:
+        return for_each_champ_child(static_cast<champ_node const*>(a.ptr), a.extra, f);
+      case kind::champ_values: {
+        auto const* values = static_cast<champ_values const*>(a.ptr);
+        auto const* members = reinterpret_cast<champ_node::value_t const*>(&values->d.buffer);
+        for (count_t i = 0; i < a.extra; i++) {
+          member(members[i], f);
+        }
+        return;
+      }
+      case kind::buffer:
+        return;
+    }
+  }
+
+  // the velocypack buffer of a lazy node, nullptr otherwise
+  static node_slice::buffer_ptr const* buffer_of(node const& n) noexcept {
+    if (auto const* s = std::get_if<node_slice>(&n.value); s != nullptr) {
+      return &s->buffer;
+    }
+    return nullptr;
+  }
+
+ private:
+  static std::size_t storage_bytes(node const& n) noexcept {
+    return std::visit(
+        visitor{
+            [](node_string const& s) -> std::size_t {
+              return s.value.capacity() > string_inline_capacity ? s.value.capacity() + 1 : 0;
+            },
+            [](node_array const& a) -> std::size_t {
+              return a.visit_elements([](auto const& c) -> std::size_t {
+                using container = std::decay_t<decltype(c)>;
+                if constexpr (std::is_same_v<container, node_array::small_container_type>) {
+                  return c.capacity() * sizeof(node_ptr);
+                } else {
+                  // the box, its element index is not accounted
+                  return sizeof(node_array::large_type) + c.size() * sizeof(node_ptr);
+                }
+              });
+            },
+            [](node_object const& o) -> std::size_t {
+              if (auto const* small = std::get_if<node_object::small_container_type>(&o.value);
+                  small != nullptr) {
+                return small->capacity() * sizeof(node_object::member_type);
+              }
+              // the HAMT nodes are separate allocations
+              return 0;
+            },
+            [](auto const&) -> std::size_t { return 0; },
+        },
+        n.value);
+  }
+
+  template <typename F>
+  static void member(node_object::member_type const& m, F& f) {
+    if (m.second != nullptr) {
+      f(of(m.second.get()), member_name{&m.first});
+    }
+  }
+
+  template <typename F>
+  static void for_each_node_child(node const& n, F& f) {
+    std::visit(visitor{
+                   [&](node_array const& a) {
+                     a.visit_elements([&](auto const& c) {
+                       std::size_t index = 0;
+                       for (auto const& element : c) {
+                         if (element != nullptr) {
+                           f(of(element.get()), member_name{nullptr, index});
+                         }
+                         index += 1;
+                       }
+                     });
+                   },
+                   [&](node_object const& o) {
+                     if (auto const* small = std::get_if<node_object::small_container_type>(&o.value);
+                         small != nullptr) {
+                       for (auto const& m : *small) {
+                         member(m, f);
+                       }
+                     } else {
+                       auto const& large = std::get<node_object::container_type>(o.value);
+                       f(allocation{kind::champ, large.impl().root, 0}, member_name{});
+                     }
+                   },
+                   [&](node_slice const& s) {
+                     f(allocation{kind::buffer, s.buffer.get()}, member_name{});
+                   },
+                   [](auto const&) {},
+               },
+               n.value);
+  }
+
+  template <typename F>
+  static void for_each_champ_child(champ_node const* n, count_t depth, F& f) {
+    if (depth == champ_max_depth) {
+      auto const* values = n->collisions();
+      for (count_t i = 0; i < n->collision_count(); i++) {
+        member(values[i], f);
+      }
+      return;
+    }
+
+    // the value array is only allocated if there are values
+    if (auto const datamap = n->datamap(); datamap != 0) {
+      f(allocation{kind::champ_values, n->impl.d.data.inner.values, popcount(datamap)},
+        member_name{});
+    }
+    auto const* children = n->children();
+    for (count_t i = 0; i < popcount(n->nodemap()); i++) {
+      f(allocation{kind::champ, children[i], static_cast<count_t>(depth + 1)}, member_name{});
+    }
+  }
+};
+
+namespace {
+
+using walker = node_memory_walker;
+
+constexpr std::size_t no_root = std::numeric_limits<std::size_t>::max();
+
+struct allocation_info {
+  walker::allocation allocation;
+  std::size_t bytes = 0;
+  // references from the allocations of the accounted trees
+  std::size_t internal_refs = 0;
+  // last root that reached this allocation, see `reach` and `sum`
+  std::size_t epoch = no_root;
+  std::size_t roots = 0;
+  node_slice::buffer_ptr const* buffer = nullptr;
+  bool is_root = false;
+  bool shared = false;
+  // `closed` is computed, see `close`
+  bool closed_known = false;
+  // nothing below is reachable other than through this allocation
+  bool closed = false;
+  // this allocation and everything below, only valid if `closed`
+  node_memory_usage subtree;
+};
+
+/*
+ * Allocations by address. Open addressing with linear probing, the entries
+ * themselves are never moved, references to them stay valid while the
+ * table grows.
+ */
+class allocation_table {
+ public:
+  // the entry of `ptr` and whether it was created
+  std::pair<allocation_info&, bool> try_emplace(void const* ptr) {
+    if (2 * (entries.size() + 1) > slots.size()) {
+      rehash(std::max<std::size_t>(2 * slots.size(), 1024));
+    }
+    auto pos = slot_of(ptr);
+    while (slots[pos] != 0) {
+      auto& info = entries[slots[pos] - 1];
+      if (info.allocation.ptr == ptr) {
+        return {info, false};
+      }
+      pos = (pos + 1) & (slots.size() - 1);
+    }
+    auto& info = entries.emplace_back();
+    info.allocation.ptr = ptr;
+    slots[pos] = entries.size();
+    return {info, true};
+  }
+
+  [[nodiscard]] allocation_info& at(void const* ptr) noexcept {
+    auto pos = slot_of(ptr);
+    while (entries[slots[pos] - 1].allocation.ptr != ptr) {
+      pos = (pos + 1) & (slots.size() - 1);
+    }
+    return entries[slots[pos] - 1];
+  }
+
+  [[nodiscard]] auto begin() noexcept { return entries.begin(); }
+  [[nodiscard]] auto end() noexcept { return entries.end(); }
+
+ private:
+  [[nodiscard]] std::size_t slot_of(void const* ptr) const noexcept {
+    // allocations are at least 16 byte aligned, mix the remaining bits
+    auto const x = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(ptr) >> 4);
+    return static_cast<std::size_t>((x * 0x9e3779b97f4a7c15) >> 32) & (slots.size() - 1);
+  }
+
+  void rehash(std::size_t size) {
+    slots.assign(size, 0);
+    for (std::size_t i = 0; i < entries.size(); i++) {
+      auto pos = slot_of(entries[i].allocation.ptr);
+      while (slots[pos] != 0) {
+        pos = (pos + 1) & (slots.size() - 1);
+      }
+      slots[pos] = i + 1;
+    }
+  }
+
+  std::deque<allocation_info> entries;
+  // index of the entry plus one, zero for an empty slot
+  std::vector<std::size_t> slots;
+};
+
+/*
+ * Every allocation is visited once by `reach`, no matter how many roots
+ * share it. Afterwards the totals of closed subtrees, those that are only
+ * reachable through their top allocation, are computed once, thus summing
+ * up a root only walks down to the subtrees it shares with other roots or
+ * that are shared inside of it. For versions of the same tree that is
+ * about the path to the last change.
+ */
+class memory_accountant {
+ public:
+  node_memory_report run(std::vector<node_ptr> const& roots) {
+    // reachability and references from inside the trees
+    for (std::size_t i = 0; i < roots.size(); i++) {
+      if (roots[i] != nullptr) {
+        auto& info = reach(walker::of(roots[i].get()), nullptr, i);
+        info.is_root = true;
+      }
+    }
+
+    // Whatever somebody else holds a reference to is shared, and so is
+    // everything below it.
+    std::vector<allocation_info*> held;
+    for (auto& info : table) {
+      if (info.roots > 1 ||
+          (!info.is_root && walker::use_count(info.allocation, info.buffer) > info.internal_refs)) {
+        held.push_back(&info);
+      }
+    }
+    for (auto* info : held) {
+      mark_shared(*info);
+    }
+
+    node_memory_report report;
+    report.roots.resize(roots.size());
+    for (auto& info : table) {
+      add(report.total, info);
+      info.epoch = no_root;
+    }
+    for (std::size_t i = 0; i < roots.size(); i++) {
+      if (roots[i] != nullptr) {
+        sum(table.at(roots[i].get()), i, report.roots[i]);
+      }
+    }
+    return report;
+  }
+
+ private:
+  /*
+   * An allocation that was reached before is not visited again, everything
+   * below it was reached then as well. If that was from a different root,
+   * it is shared and so is everything below it, see `mark_shared`.
+   */
+  allocation_info& reach(walker::allocation a, node_slice::buffer_ptr const* buffer,
+                         std::size_t root) {
+    auto [info, inserted] = table.try_emplace(a.ptr);
+    if (info.epoch != root) {
+      info.epoch = root;
+      info.roots += 1;
+    }
+    if (!inserted) {
+      return info;
+    }
+    info.allocation = a;
+    info.bytes = walker::own_bytes(a);
+    info.buffer = buffer;
+
+    auto const* child_buffer =
+        a.type == walker::kind::node ? walker::buffer_of(*static_cast<node const*>(a.ptr)) : nullptr;
+    walker::for_each_child(a, [&](walker::allocation child, walker::member_name) {
+      reach(child, child_buffer, root).internal_refs += 1;
+    });
+    return info;
+  }
+
+  void mark_shared(allocation_info& info) {
+    if (info.shared) {
+      return;
+    }
+    info.shared = true;
+    walker::for_each_child(info.allocation, [&](walker::allocation child, walker::member_name) {
+      mark_shared(table.at(child.ptr));
+    });
+  }
+
+  // computes `closed` and, if so, the totals of the subtree
+  void close(allocation_info& info) {
+    info.closed_known = true;
+    info.subtree = node_memory_usage{};
+    add(info.subtree, info);
+    bool closed = true;
+    walker::for_each_child(info.allocation, [&](walker::allocation child, walker::member_name) {
+      auto& child_info = table.at(child.ptr);
+      if (!child_info.closed_known) {
+        close(child_info);
+      }
+      closed = closed && child_info.closed && child_info.internal_refs == 1;
+      if (closed) {
+        info.subtree.nodes += child_info.subtree.nodes;
+        info.subtree.unique_bytes += child_info.subtree.unique_bytes;
+        info.subtree.shared_bytes += child_info.subtree.shared_bytes;
+      }
+    });
+    info.closed = closed;
+  }
+
+  void sum(allocation_info& info, std::size_t root, node_memory_usage& usage) {
+    if (info.epoch == root) {
+      return;
+    }
+    info.epoch = root;
+    if (!info.closed_known) {
+      close(info);
+    }
+    if (info.closed) {
+      // nothing below was reached by this root before, nor will it be
+      usage.nodes += info.subtree.nodes;
+      usage.unique_bytes += info.subtree.unique_bytes;
+      usage.shared_bytes += info.subtree.shared_bytes;
+      return;
+    }
+    add(usage, info);
+    walker::for_each_child(info.allocation, [&](walker::allocation child, walker::member_name) {
+      sum(table.at(child.ptr), root, usage);
+    });
+  }
+
+  static void add(node_memory_usage& usage, allocation_info const& info) noexcept {
+    if (info.allocation.type == walker::kind::node) {
+      usage.nodes += 1;
+    }
+    (info.shared ? usage.shared_bytes : usage.unique_bytes) += info.bytes;
+  }
+
+  allocation_table table;
+};
+
+class path_accountant {
+ public:
+  explicit path_accountant(std::size_t max_depth) : max_depth(max_depth) {}
+
+  std::vector<node_memory_path> run(node const* root) {
+    std::string path;
+    visit(walker::of(root), 0, path);
+    return std::move(paths);
+  }
+
+ private:
+  // returns the nodes and bytes first reached through `a`
+  std::pair<std::size_t, std::size_t> visit(walker::allocation a, std::size_t depth,
+                                            std::string& path) {
+    if (!seen.insert(a.ptr).second) {
+      return {0, 0};
+    }
+
+    std::size_t nodes = a.type == walker::kind::node ? 1 : 0;
+    std::size_t bytes = walker::own_bytes(a);
+    walker::for_each_child(a, [&](walker::allocation child, walker::member_name name) {
+      auto const is_node = child.type == walker::kind::node;
+      auto const length = path.size();
+      if (is_node && depth < max_depth) {
+        path += '/';
+        if (name.key != nullptr) {
+          path += name.key->view();
+        } else {
+          path += std::to_string(name.index);
+        }
+      }
+      // HAMT nodes belong to the level of their object
+      auto const [child_nodes, child_bytes] = visit(child, is_node ? depth + 1 : depth, path);
+      nodes += child_nodes;
+      bytes += child_bytes;
+      path.resize(length);
+    });
+
+    if (a.type == walker::kind::node && depth <= max_depth) {
+      paths.push_back(node_memory_path{path.empty() ? "/" : path, nodes, bytes});
+    }
+    return {nodes, bytes};
+  }
+
+  std::size_t const max_depth;
+  std::unordered_set<void const*> seen;
+  std::vector<node_memory_path> paths;
+};
+
+}  // namespace
+
+double node_memory_report::sharing_ratio() const noexcept {
+  auto const bytes = total.bytes();
+  return bytes == 0 ? 0.0 : static_cast<double>(total.shared_bytes) / static_cast<double>(bytes);
+}
+
+node_memory_report account_memory(std::vector<node_ptr> const& roots) {
+  return memory_accountant{}.run(roots);
+}
+
+node_memory_usage node::memory_usage() const {
+  return account_memory({node_ptr{this}}).roots.front();
+}
+
+std::vector<node_memory_path> heaviest_paths(node_ptr const& root, std::size_t count,
+                                             std::size_t max_depth) {
+  if (root == nullptr) {
+    return {};
+  }
+
+  auto paths = path_accountant{max_depth}.run(root.get());
+  auto const heavier = [](auto const& a, auto const& b) { return a.bytes > b.bytes; };
+  if (paths.size() > count) {
+    std::partial_sort(paths.begin(), paths.begin() + count, paths.end(), heavier);
+    paths.resize(count);
+  } else {
+    std::sort(paths.begin(), paths.end(), heavier);
+  }
+  return paths;
+}
@@ -0,0 +1,64 @@
+#ifndef AGENCY_NODE_MEMORY_H
+#define AGENCY_NODE_MEMORY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "node.h"
+
+/*
+ * Memory held by nodes. Bytes are the allocations of the nodes, their
+ * strings and flat containers, the HAMT nodes of large objects and the
+ * velocypack buffers of lazy nodes. Every allocation is counted once, no
+ * matter how many parents refer to it. Interned keys and the slack of the
+ * allocators are not included, large arrays are counted by their elements.
+ *
+ * An allocation is shared if it is reachable from more than one of the
+ * accounted roots or if somebody outside of them holds a reference to it,
+ * e.g. an older version of the tree.
+ */
+struct node_memory_usage {
+  std::size_t nodes = 0;
+  std::size_t unique_bytes = 0;
+  std::size_t shared_bytes = 0;
+
+  [[nodiscard]] std::size_t bytes() const noexcept { return unique_bytes + shared_bytes; }
+};
+
+struct node_memory_report {
+  // everything reachable from `roots[i]`, split into unique and shared
+  std::vector<node_memory_usage> roots;
+  // every allocation once
+  node_memory_usage total;
+
+  // part of the bytes that is shared, zero for an empty report
+  [[nodiscard]] double sharing_ratio() const noexcept;
+};
+
+/*
+ * Visits every distinct allocation once, a subtree that is shared between
+ * roots is not walked again. The sums per root reuse the totals of subtrees
+ * that are only reachable through their top, thus the cost is proportional
+ * to the number of distinct allocations, not times the number of roots.
+ */
+[[nodiscard]] node_memory_report account_memory(std::vector<node_ptr> const& roots);
+
+struct node_memory_path {
+  std::string path;
+  // nodes and bytes that are first reached through this path
+  std::size_t nodes = 0;
+  std::size_t bytes = 0;
+};
+
+/*
+ * The `count` subtrees with the most bytes, of all subtrees at most
+ * `max_depth` levels below `root`. Allocations that are reachable through
+ * multiple paths are attributed to the first one, thus the sizes of the
+ * children add up to the size of their parent.
+ */
+[[nodiscard]] std::vector<node_memory_path> heaviest_paths(node_ptr const& root,
+                                                           std::size_t count,
+                                                           std::size_t max_depth);
+
+#endif  // AGENCY_NODE_MEMORY_H
@@ -0,0 +1,98 @@
+#include "node-overlay.h"
+
+namespace {
+
+node_path to_node_path(node::path_slice const& path) {
+  node_path flat;
+  for (auto e = path.head.get(); e != nullptr; e = e->next.get()) {
+    flat.push_back(e->value);
+  }
+  return flat;
+}
+
+}  // namespace
+
+node_ptr node_overlay_view::get(node::path_slice const& path) const {
+  return get(to_node_path(path));
+}
+
+/*
+ * Walks both trees in parallel. As long as both are containers of the same
+ * kind the overlay merges them, otherwise the result is found in one of
+ * the two trees alone.
+ */
+node_ptr node_overlay_view::get(node_path_view path) const {
+  enum class kind { value, object, array };
+  auto const kind_of = [](node const& n) {
+    if (auto const* s = std::get_if<node_slice>(&n.value); s != nullptr) {
+      return s->slice.isObject() ? kind::object : kind::array;
+    } else if (std::holds_alternative<node_object>(n.value)) {
+      return kind::object;
+    } else if (std::holds_alternative<node_array>(n.value)) {
+      return kind::array;
+    }
+    return kind::value;
+  };
+
+  node_ptr b = base;
+  node_ptr d = delta;
+  for (auto segment = path.begin(); segment != path.end(); ++segment) {
+    auto const rest = node_path_view{segment, path.end()};
+    if (d == nullptr) {
+      return b == nullptr ? nullptr : b->get(rest);
+    } else if (b == nullptr || kind_of(*d) == kind::value || kind_of(*d) != kind_of(*b)) {
+      return d->get(rest);
+    }
+
+    auto const head = node_path_view{segment, segment + 1};
+    if (auto const* object = std::get_if<node_object>(&d->value); object != nullptr) {
+      // a member with a `nullptr` value is removed by the overlay
+      auto const* member = object->find(segment->name(), segment->hash);
+      if (member != nullptr && *member == nullptr) {
+        return nullptr;
+      }
+      d = member == nullptr ? nullptr : *member;
+    } else if (kind_of(*d) == kind::array) {
+      // elements replace the base element, `nullptr` ones keep it and the
+      // array is filled up with nulls
+      if (auto element = d->get(head); element != nullptr) {
+        return element->get(node_path_view{segment + 1, path.end()});
+      }
+      auto const* array = std::get_if<node_array>(&d->value);
+      auto const in_delta = array != nullptr && segment->index < array->size();
+      d = nullptr;
+      if (in_delta && b->get(head) == nullptr) {
+        b = node::null_node();
+        continue;
+      }
+    } else {
+      d = d->get(head);
+    }
+    b = b->get(head);
+  }
+
+  if (d == nullptr) {
+    return b;
+  } else if (b == nullptr) {
+    return d;
+  }
+  return b->overlay(d);
+}
+
+void node_overlay_view::set(node_path_view path, node_ptr const& value) {
+  base = materialize()->set(path, value);
+  delta = nullptr;
+}
+
+void node_overlay_view::set(node::path_slice const& path, node_ptr const& value) {
+  set(to_node_path(path), value);
+}
+
+node_ptr node_overlay_view::materialize() const {
+  if (delta == nullptr) {
+    return base;
+  } else if (base == nullptr) {
+    return delta;
+  }
+  return base->overlay(delta);
+}
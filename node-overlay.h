@@ -0,0 +1,42 @@
+#ifndef AGENCY_NODE_OVERLAY_H
+#define AGENCY_NODE_OVERLAY_H
+
+#include "node-path.h"
+#include "node.h"
+
+/*
+ * A tree `base` overlayed by `delta` without merging them, see
+ * `node::overlay`. Reads descend into both trees and only merge the
+ * subtree that is returned, thus reading a leaf costs about the same as
+ * reading it from either tree. The merged tree is built on the first write,
+ * afterwards the view holds a plain tree.
+ *
+ * A speculative state is a view of the committed tree and the pending
+ * changes, it is created and dropped without touching the committed tree.
+ */
+class node_overlay_view {
+ public:
+  node_overlay_view() noexcept = default;
+  explicit node_overlay_view(node_ptr base, node_ptr delta = nullptr) noexcept
+      : base(std::move(base)), delta(std::move(delta)) {}
+
+  // same as `materialize()->get(path)`
+  [[nodiscard]] node_ptr get(node_path_view path) const;
+  [[nodiscard]] node_ptr get(node::path_slice const& path) const;
+  [[nodiscard]] bool has(node_path_view path) const { return get(path) != nullptr; }
+
+  // merges base and delta and writes to the result
+  void set(node_path_view path, node_ptr const& value);
+  void set(node::path_slice const& path, node_ptr const& value);
+  void remove(node_path_view path) { set(path, nullptr); }
+
+  [[nodiscard]] node_ptr materialize() const;
+
+  [[nodiscard]] bool is_materialized() const noexcept { return delta == nullptr; }
+
+ private:
+  node_ptr base;
+  node_ptr delta;
+};
+
+#endif  // AGENCY_NODE_OVERLAY_H
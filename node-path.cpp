@@ -0,0 +1,137 @@
+#include "node-path.h"
+
+#include <algorithm>
+#include <ostream>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "helper-strings.h"
+
+namespace {
+
+/*
+ * Calls `f` for every non-empty segment of `path`. The separators are found
+ * 16 bytes at a time with SSE2.
+ */
+template <typename F>
+void for_each_segment(std::string_view path, F&& f) {
+  std::size_t start = 0;
+  auto const separator = [&](std::size_t i) {
+    if (i > start) {
+      f(path.substr(start, i - start));
+    }
+    start = i + 1;
+  };
+
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  auto const slash = _mm_set1_epi8('/');
+  for (; i + 16 <= path.size(); i += 16) {
+    auto const chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(path.data() + i));
+    auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, slash)));
+    while (mask != 0) {
+      separator(i + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i < path.size(); i++) {
+    if (path[i] == '/') {
+      separator(i);
+    }
+  }
+  separator(path.size());
+}
+
+}  // namespace
+
+node_path_segment::node_path_segment(std::string_view name) noexcept
+    : text(name),
+      hash(node_key::hash_of(name)),
+      index(string_to_number<std::size_t>(name).value_or(no_index)) {}
+
+std::string node_path_view::to_string() const {
+  if (empty()) {
+    return "/";
+  }
+
+  std::size_t length = 0;
+  for (auto const& segment : *this) {
+    length += 1 + segment.name().size();
+  }
+
+  std::string result;
+  result.reserve(length);
+  for (auto const& segment : *this) {
+    result += '/';
+    result += segment.name();
+  }
+  return result;
+}
+
+node_path node_path::from_segments(std::initializer_list<std::string_view> names) {
+  std::size_t length = 0;
+  for (auto name : names) {
+    length += name.size();
+  }
+
+  node_path result;
+  result.reserve_buffer(length);
+  result.segments.reserve(names.size());
+  for (auto name : names) {
+    result.push_back(name);
+  }
+  return result;
+}
+
+node_path node_path::parse(std::string_view path) {
+  node_path result;
+  if (path.empty()) {
+    return result;
+  }
+  // the segments point into a copy of the whole path
+  result.buffer = std::make_shared<std::string>(path);
+  result.segments.reserve(std::count(path.begin(), path.end(), '/') + 1);
+  for_each_segment(*result.buffer, [&](std::string_view name) { result.segments.emplace_back(name); });
+  return result;
+}
+
+void node_path::push_back(std::string_view name) {
+  reserve_buffer(name.size());
+  auto const offset = buffer->size();
+  buffer->append(name);
+  segments.emplace_back(std::string_view{buffer->data() + offset, name.size()});
+}
+
+void node_path::reserve_buffer(std::size_t extra) {
+  if (buffer != nullptr && buffer.use_count() == 1 &&
+      buffer->size() + extra <= buffer->capacity()) {
+    return;
+  }
+
+  auto replacement = std::make_shared<std::string>();
+  auto const size = buffer == nullptr ? 0 : buffer->size();
+  replacement->reserve(std::max(2 * size, size + extra));
+  if (buffer != nullptr) {
+    replacement->append(*buffer);
+  }
+  for (auto& segment : segments) {
+    auto const offset = segment.text.data() - buffer->data();
+    segment.text = std::string_view{replacement->data() + offset, segment.text.size()};
+  }
+  buffer = std::move(replacement);
+}
+
+bool node_path::operator==(node_path const& other) const noexcept {
+  return std::equal(begin(), end(), other.begin(), other.end());
+}
+
+std::ostream& operator<<(std::ostream& os, node_path_view path) {
+  return os << path.to_string();
+}
+
+std::ostream& operator<<(std::ostream& os, node_path const& path) {
+  return os << path.view();
+}
@@ -0,0 +1,128 @@
+#ifndef AGENCY_NODE_PATH_H
+#define AGENCY_NODE_PATH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iosfwd>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "node-key.h"
+
+struct node_path_segment {
+  static constexpr std::size_t no_index = std::numeric_limits<std::size_t>::max();
+
+  // points into the buffer of the path
+  std::string_view text;
+  // `node_key::hash_of(text)`
+  std::uint64_t hash = 0;
+  // the name parsed as array index, `no_index` if it is not a number
+  std::size_t index = no_index;
+
+  // `name` has to outlive the segment
+  explicit node_path_segment(std::string_view name) noexcept;
+
+  [[nodiscard]] std::string_view name() const noexcept { return text; }
+  [[nodiscard]] bool is_index() const noexcept { return index != no_index; }
+
+  // interns the name, only for writes
+  [[nodiscard]] node_key key() const { return node_key{text, hash}; }
+
+  [[nodiscard]] bool operator==(node_path_segment const& other) const noexcept {
+    return hash == other.hash && text == other.text;
+  }
+  [[nodiscard]] bool operator!=(node_path_segment const& other) const noexcept {
+    return !(*this == other);
+  }
+};
+
+/*
+ * Non-owning view of the segments of a node_path, usually a suffix of it.
+ * Taking the tail of a view does not allocate.
+ */
+class node_path_view {
+ public:
+  node_path_view() noexcept = default;
+  node_path_view(node_path_segment const* begin, node_path_segment const* end) noexcept
+      : first(begin), last(end) {}
+
+  [[nodiscard]] bool empty() const noexcept { return first == last; }
+  [[nodiscard]] std::size_t size() const noexcept { return last - first; }
+  [[nodiscard]] node_path_segment const& head() const noexcept { return *first; }
+  [[nodiscard]] node_path_view tail() const noexcept { return {first + 1, last}; }
+
+  [[nodiscard]] node_path_segment const* begin() const noexcept { return first; }
+  [[nodiscard]] node_path_segment const* end() const noexcept { return last; }
+
+  [[nodiscard]] std::string to_string() const;
+
+ private:
+  node_path_segment const* first = nullptr;
+  node_path_segment const* last = nullptr;
+};
+
+/*
+ * Flat path into a node tree: a single table of segments whose names point
+ * into one buffer. The hash of every segment is computed once, objects are
+ * searched by hash and name without touching the intern table, names are
+ * only interned when they are written. Segments that are numbers are parsed
+ * once as array index. Copies share the buffer.
+ */
+class node_path {
+ public:
+  node_path() noexcept = default;
+
+  /*
+   * Parses an agency path like "/a/b/c". Empty segments are dropped, thus
+   * "a/b/c", "/a//b/c/" and "/a/b/c" are the same path.
+   */
+  [[nodiscard]] static node_path parse(std::string_view path);
+
+  /*
+   * Path of the given segment names, taken as is. This is not a constructor,
+   * a braced list of strings is a path_slice.
+   */
+  [[nodiscard]] static node_path from_segments(std::initializer_list<std::string_view> names);
+
+  void push_back(std::string_view name);
+
+  [[nodiscard]] bool empty() const noexcept { return segments.empty(); }
+  [[nodiscard]] std::size_t size() const noexcept { return segments.size(); }
+  [[nodiscard]] node_path_segment const& operator[](std::size_t i) const noexcept {
+    return segments[i];
+  }
+
+  [[nodiscard]] node_path_view view() const noexcept {
+    return {segments.data(), segments.data() + segments.size()};
+  }
+  operator node_path_view() const noexcept { return view(); }
+
+  [[nodiscard]] node_path_segment const* begin() const noexcept { return segments.data(); }
+  [[nodiscard]] node_path_segment const* end() const noexcept {
+    return segments.data() + segments.size();
+  }
+
+  // normalized form, "/" for the empty path
+  [[nodiscard]] std::string to_string() const { return view().to_string(); }
+
+  [[nodiscard]] bool operator==(node_path const& other) const noexcept;
+  [[nodiscard]] bool operator!=(node_path const& other) const noexcept {
+    return !(*this == other);
+  }
+
+ private:
+  // makes `buffer` unshared with room for `extra` more bytes
+  void reserve_buffer(std::size_t extra);
+
+  std::shared_ptr<std::string> buffer;
+  std::vector<node_path_segment> segments;
+};
+
+std::ostream& operator<<(std::ostream& os, node_path_view path);
+std::ostream& operator<<(std::ostream& os, node_path const& path);
+
+#endif  // AGENCY_NODE_PATH_H
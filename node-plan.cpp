@@ -0,0 +1,272 @@
+#include "node-plan.h"
+
+#include <algorithm>
+
+namespace {
+
+std::uint64_t mix(std::uint64_t x) noexcept {
+  // splitmix64 finalizer, like the node hash
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+}  // namespace
+
+node_transaction_plan::node_transaction_plan(precondition_list const& preconditions) {
+  paths.reserve(preconditions.size());
+  for (auto const& precondition : preconditions) {
+    paths.push_back(precondition.first);
+  }
+
+  // sorted paths share their prefix with the previous one, and a path comes
+  // before all paths it is a prefix of
+  order.resize(paths.size());
+  for (std::size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) {
+    return std::lexicographical_compare(
+        paths[a].begin(), paths[a].end(), paths[b].begin(), paths[b].end(),
+        [](auto const& x, auto const& y) { return x.name() < y.name(); });
+  });
+
+  steps.emplace_back();
+  // steps along the previous path, starting with the root
+  std::vector<std::size_t> stack{0};
+  auto const close = [&](std::size_t depth) {
+    while (stack.size() > depth) {
+      steps[stack.back()].end = steps.size();
+      stack.pop_back();
+    }
+  };
+
+  for (std::size_t i = 0; i < order.size(); i++) {
+    auto const& path = paths[order[i]];
+    // length of the prefix shared with the previous path
+    std::size_t common = 0;
+    while (common < path.size() && common + 1 < stack.size() &&
+           *steps[stack[common + 1]].segment == path[common]) {
+      common += 1;
+    }
+
+    close(common + 1);
+    for (auto s = common; s < path.size(); s++) {
+      stack.push_back(steps.size());
+      steps.push_back(step{path[s]});
+    }
+
+    // equal paths are adjacent, so are the preconditions of a step
+    auto& target = steps[stack.back()];
+    if (target.first_precondition == target.end_precondition) {
+      target.first_precondition = i;
+    }
+    target.end_precondition = i + 1;
+  }
+  close(0);
+
+  // children follow their parent, thus they are done first backwards
+  for (auto index = steps.size(); index-- > 0;) {
+    auto& s = steps[index];
+    for (auto i = s.first_precondition; i < s.end_precondition; i++) {
+      s.min_precondition = std::min(s.min_precondition, order[i]);
+    }
+    for (auto i = index + 1; i < s.end; i = steps[i].end) {
+      s.min_precondition = std::min(s.min_precondition, steps[i].min_precondition);
+    }
+  }
+
+  // children are checked by their first precondition, thus an early failing
+  // precondition cuts the descent short
+  std::vector<step> by_precondition;
+  by_precondition.reserve(steps.size());
+  auto const emit = [&](auto const& self, std::size_t index) -> void {
+    auto const position = by_precondition.size();
+    by_precondition.push_back(steps[index]);
+    std::vector<std::size_t> children;
+    for (auto i = index + 1; i < steps[index].end; i = steps[i].end) {
+      children.push_back(i);
+    }
+    std::sort(children.begin(), children.end(), [&](auto a, auto b) {
+      return steps[a].min_precondition < steps[b].min_precondition;
+    });
+    for (auto child : children) {
+      self(self, child);
+    }
+    by_precondition[position].end = by_precondition.size();
+  };
+  emit(emit, 0);
+  steps = std::move(by_precondition);
+}
+
+node_transaction_plan::result node_transaction_plan::execute(
+    node_ptr const& root, precondition_list const& preconditions, operation_list const& operations) const {
+  if (auto failed = check(root, preconditions); failed.has_value()) {
+    return result{nullptr, failed};
+  }
+  return result{root->transform(operations), std::nullopt};
+}
+
+std::optional<std::size_t> node_transaction_plan::check(node_ptr const& root,
+                                                        precondition_list const& preconditions) const {
+  auto failed = preconditions.size();
+  check(root, 0, preconditions, failed);
+  if (failed == preconditions.size()) {
+    return std::nullopt;
+  }
+  return failed;
+}
+
+/*
+ * Checks the preconditions of step `index` on `n` and then those of its
+ * children, `n` is `nullptr` if the path does not exist. Descends through
+ * the child pointers held by their parents without copying them, only the
+ * children of lazy nodes are created on access. Lowers `failed` to the
+ * index of a failing precondition before it.
+ */
+void node_transaction_plan::check(node_ptr const& n, std::size_t index,
+                                  precondition_list const& preconditions, std::size_t& failed) const {
+  static node_ptr const missing;
+
+  auto const& s = steps[index];
+  // equal paths keep their order, thus the indexes increase
+  for (auto i = s.first_precondition; i < s.end_precondition && order[i] < failed; i++) {
+    if (!preconditions[order[i]].second(n)) {
+      failed = order[i];
+    }
+  }
+
+  for (auto i = index + 1; i < s.end; i = steps[i].end) {
+    if (steps[i].min_precondition >= failed) {
+      continue;
+    }
+    auto const& segment = *steps[i].segment;
+    node_ptr const* child = &missing;
+    node_ptr lazy_child;
+    if (n == nullptr) {
+      // missing as well
+    } else if (auto const* o = std::get_if<node_object>(&n->value); o != nullptr) {
+      if (auto const* c = o->find(segment.name(), segment.hash); c != nullptr) {
+        child = c;
+      }
+    } else if (auto const* a = std::get_if<node_array>(&n->value); a != nullptr) {
+      if (segment.is_index() && segment.index < a->size()) {
+        child = &a->at(segment.index);
+      }
+    } else if (auto const* l = std::get_if<node_slice>(&n->value); l != nullptr) {
+      lazy_child = l->get(node_path_view{&segment, &segment + 1});
+      child = &lazy_child;
+    }
+
+    check(*child, i, preconditions, failed);
+  }
+}
+
+bool node_transaction_plan::matches(precondition_list const& preconditions) const noexcept {
+  return std::equal(paths.begin(), paths.end(), preconditions.begin(), preconditions.end(),
+                    [](auto const& path, auto const& p) { return path == p.first; });
+}
+
+std::uint64_t node_transaction_plan::shape_hash(precondition_list const& preconditions) noexcept {
+  // the key hashes are well mixed already, only each path is mixed into the
+  // result, a dependent multiply per segment costs more than the lookups
+  auto h = mix(preconditions.size());
+  for (auto const& [path, condition] : preconditions) {
+    std::uint64_t p = path.size();
+    for (auto const& segment : path) {
+      p = ((p << 5) | (p >> 59)) ^ segment.hash;
+    }
+    h = mix(h ^ p);
+  }
+  return h;
+}
+
+std::shared_ptr<node_transaction_plan const> node_plan_cache::get(
+    node_transaction_plan::precondition_list const& preconditions) {
+  auto const hash = node_transaction_plan::shape_hash(preconditions);
+  {
+    std::unique_lock guard(mutex);
+    if (auto const* plan = find(hash, preconditions); plan != nullptr) {
+      hit_count += 1;
+      return *plan;
+    }
+    miss_count += 1;
+  }
+
+  // compiled without holding the lock
+  auto plan = std::make_shared<node_transaction_plan const>(preconditions);
+  std::unique_lock guard(mutex);
+  if (auto const* added = find(hash, preconditions); added != nullptr) {
+    // by a concurrent miss
+    return *added;
+  }
+  if (limit != 0) {
+    insert(hash, plan);
+  }
+  return plan;
+}
+
+std::shared_ptr<node_transaction_plan const> const* node_plan_cache::find(
+    std::uint64_t hash, node_transaction_plan::precondition_list const& preconditions) {
+  auto [begin, end] = index.equal_range(hash);
+  for (auto it = begin; it != end; ++it) {
+    auto& e = entries[it->second];
+    if (e.plan->matches(preconditions)) {
+      e.referenced = true;
+      return &e.plan;
+    }
+  }
+  return nullptr;
+}
+
+void node_plan_cache::insert(std::uint64_t hash, std::shared_ptr<node_transaction_plan const> plan) {
+  // everything that allocates comes first, the cache stays consistent if
+  // it throws
+  if (entries.size() < limit) {
+    entries.reserve(entries.size() + 1);
+    index.emplace(hash, entries.size());
+    entries.push_back(entry{hash, std::move(plan), false});
+    return;
+  }
+
+  // at most one round clears every mark, the next one finds a victim
+  while (entries[hand].referenced) {
+    entries[hand].referenced = false;
+    hand = (hand + 1) % entries.size();
+  }
+  auto& victim = entries[hand];
+  auto const added = index.emplace(hash, hand);
+  auto [begin, end] = index.equal_range(victim.hash);
+  for (auto it = begin; it != end; ++it) {
+    if (it != added && it->second == hand) {
+      index.erase(it);
+      break;
+    }
+  }
+  victim = entry{hash, std::move(plan), false};
+  hand = (hand + 1) % entries.size();
+  eviction_count += 1;
+}
+
+std::size_t node_plan_cache::size() const {
+  std::unique_lock guard(mutex);
+  return entries.size();
+}
+
+std::size_t node_plan_cache::hits() const {
+  std::unique_lock guard(mutex);
+  return hit_count;
+}
+
+std::size_t node_plan_cache::misses() const {
+  std::unique_lock guard(mutex);
+  return miss_count;
+}
+
+std::size_t node_plan_cache::evictions() const {
+  std::unique_lock guard(mutex);
+  return eviction_count;
+}
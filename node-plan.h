@@ -0,0 +1,128 @@
+#ifndef AGENCY_NODE_PLAN_H
+#define AGENCY_NODE_PLAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "node-path.h"
+#include "node.h"
+
+/*
+ * A transaction compiled for execution. The precondition paths are merged
+ * into a trie, thus preconditions that share a prefix are checked in a
+ * single descent. The children of a trie node are visited in the order of
+ * their first precondition in the transaction, and a subtree is skipped
+ * once it holds no precondition before the earliest failure found so far.
+ * Thus the reported failure is the first failing precondition in the order
+ * they were given, and a failure early in that order ends the check early.
+ * The operations are applied by `node::transform`, which groups them by
+ * prefix itself.
+ *
+ * A plan only depends on the precondition paths, the shape of a
+ * transaction, so it can be executed with the values of every transaction
+ * of that shape, see `node_plan_cache`. `store_base::transact` uses it for
+ * transactions on node paths.
+ */
+class node_transaction_plan {
+ public:
+  using precondition_list = std::vector<std::pair<node_path, node::fold_operator<bool>>>;
+  using operation_list = std::vector<std::pair<node_path, node::transformation>>;
+
+  struct result {
+    // `nullptr` if a precondition failed
+    node_ptr root;
+    // index into the preconditions of the transaction
+    std::optional<std::size_t> failed_precondition;
+  };
+
+  explicit node_transaction_plan(precondition_list const& preconditions);
+
+  // `preconditions` must have the shape of the plan, see `matches`
+  [[nodiscard]] result execute(node_ptr const& root, precondition_list const& preconditions,
+                               operation_list const& operations) const;
+
+  // index of the first precondition that fails on `root`
+  [[nodiscard]] std::optional<std::size_t> check(node_ptr const& root,
+                                                 precondition_list const& preconditions) const;
+
+  [[nodiscard]] bool matches(precondition_list const& preconditions) const noexcept;
+
+  // combined from the hashes of the path segments
+  [[nodiscard]] static std::uint64_t shape_hash(precondition_list const& preconditions) noexcept;
+
+ private:
+  /*
+   * Trie nodes in preorder, the children of a node follow it directly,
+   * ordered by `min_precondition`, and `end` is the index past its subtree. The preconditions on a node are
+   * `order[first_precondition]` up to `order[end_precondition]`, the
+   * smallest index of a precondition in the subtree is `min_precondition`.
+   */
+  struct step {
+    std::optional<node_path_segment> segment;
+    std::size_t end = 0;
+    std::size_t first_precondition = 0;
+    std::size_t end_precondition = 0;
+    std::size_t min_precondition = std::numeric_limits<std::size_t>::max();
+  };
+
+  void check(node_ptr const& n, std::size_t index, precondition_list const& preconditions,
+             std::size_t& failed) const;
+
+  std::vector<node_path> paths;
+  std::vector<step> steps;
+  std::vector<std::size_t> order;
+};
+
+/*
+ * Plans of recently seen transaction shapes, e.g. of the transactions the
+ * supervision submits over and over. Once `limit` plans are cached a new
+ * shape replaces a plan chosen by the clock algorithm: a hit marks its plan
+ * as referenced, a miss advances the hand over the plans, clears their marks
+ * and replaces the first one that was not referenced since the hand passed
+ * it last. Thus shapes that keep coming back stay cached, no matter how many
+ * others were seen once. Thread safe.
+ */
+class node_plan_cache {
+ public:
+  explicit node_plan_cache(std::size_t limit = 1024) : limit(limit) {}
+
+  [[nodiscard]] std::shared_ptr<node_transaction_plan const> get(
+      node_transaction_plan::precondition_list const& preconditions);
+
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] std::size_t hits() const;
+  [[nodiscard]] std::size_t misses() const;
+  [[nodiscard]] std::size_t evictions() const;
+
+ private:
+  struct entry {
+    std::uint64_t hash = 0;
+    std::shared_ptr<node_transaction_plan const> plan;
+    // hit since the hand passed it
+    bool referenced = false;
+  };
+
+  [[nodiscard]] std::shared_ptr<node_transaction_plan const> const* find(
+      std::uint64_t hash, node_transaction_plan::precondition_list const& preconditions);
+  void insert(std::uint64_t hash, std::shared_ptr<node_transaction_plan const> plan);
+
+  std::size_t const limit;
+
+  mutable std::mutex mutex;
+  std::vector<entry> entries;
+  // hash of the shape to indexes into `entries`
+  std::unordered_multimap<std::uint64_t, std::size_t> index;
+  std::size_t hand = 0;
+  std::size_t hit_count = 0;
+  std::size_t miss_count = 0;
+  std::size_t eviction_count = 0;
+};
+
+#endif  // AGENCY_NODE_PLAN_H
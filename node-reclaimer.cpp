@@ -0,0 +1,124 @@
+#include "node-reclaimer.h"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+#include "node-intern.h"
+
+#if __has_include(<pthread.h>)
+#include <pthread.h>
+#endif
+
+node_reclaimer::node_reclaimer(std::size_t batch_size)
+    : batch_size(std::max<std::size_t>(batch_size, 1)) {
+#if AGENCY_NODE_ATOMIC_REFCOUNT
+  thread = std::thread([this] { run(); });
+#endif
+}
+
+node_reclaimer::~node_reclaimer() {
+  {
+    std::unique_lock guard(mutex);
+    stopping = true;
+  }
+  work_cv.notify_one();
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+void node_reclaimer::retire(node_ptr n) {
+#if AGENCY_NODE_ATOMIC_REFCOUNT
+  node_ptr::defer(std::move(n));
+  static_cast<void>(node_ptr::destroy_deferred(inline_budget));
+  // a write freed inline does not wake the thread, thus it is asked to sweep
+  // every now and then
+  bool const sweep = sweep_due();
+  if (!node_ptr::has_deferred() && !sweep) {
+    return;
+  }
+  auto const list = node_ptr::has_deferred() ? node_ptr::take_deferred() : nullptr;
+
+  bool idle = false;
+  {
+    std::unique_lock guard(mutex);
+    if (list != nullptr) {
+      try {
+        retired.push_back(list);
+      } catch (std::bad_alloc const&) {
+        // freed by this thread instead
+        guard.unlock();
+        node_ptr::adopt_deferred(list);
+        while (node_ptr::has_deferred()) {
+          static_cast<void>(node_ptr::destroy_deferred(batch_size));
+        }
+        return;
+      }
+    }
+    sweep_requested = sweep_requested || sweep;
+    idle = !awake;
+  }
+  if (idle) {
+    work_cv.notify_one();
+  }
+#else
+  n = nullptr;
+  if (sweep_due()) {
+    static_cast<void>(node_intern_table::sweep_step());
+  }
+#endif
+}
+
+bool node_reclaimer::sweep_due() noexcept {
+  return retires.fetch_add(1, std::memory_order_relaxed) % sweep_interval == sweep_interval - 1 &&
+         node_intern_table::size() != 0;
+}
+
+void node_reclaimer::drain() {
+  std::unique_lock guard(mutex);
+  idle_cv.wait(guard, [&] { return !busy && retired.empty(); });
+}
+
+void node_reclaimer::run() {
+#ifdef SCHED_BATCH
+  // a woken batch thread does not preempt the writer that retired a version,
+  // which matters if they share a core
+  sched_param param{};
+  pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+#endif
+
+  std::unique_lock guard(mutex);
+  // dead nodes are left on this thread
+  bool pending = false;
+  while (true) {
+    if (!pending) {
+      busy = false;
+      idle_cv.notify_all();
+      auto const has_work = [&] { return stopping || !retired.empty() || sweep_requested; };
+      if (!work_cv.wait_for(guard, linger, has_work)) {
+        awake = false;
+        work_cv.wait(guard, has_work);
+        awake = true;
+      }
+      if (stopping && retired.empty()) {
+        return;
+      }
+      busy = true;
+    }
+
+    auto lists = std::exchange(retired, {});
+    sweep_requested = false;
+    guard.unlock();
+    for (auto const* list : lists) {
+      node_ptr::adopt_deferred(list);
+    }
+    freed.fetch_add(node_ptr::destroy_deferred(batch_size), std::memory_order_relaxed);
+    pending = node_ptr::has_deferred();
+    if (!pending) {
+      // interned nodes only kept alive by the freed versions
+      static_cast<void>(node_intern_table::sweep_step());
+    }
+    guard.lock();
+  }
+}
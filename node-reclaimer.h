@@ -0,0 +1,79 @@
+#ifndef AGENCY_NODE_RECLAIMER_H
+#define AGENCY_NODE_RECLAIMER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "node.h"
+
+/*
+ * Frees retired tree versions on a background thread, thus a writer that
+ * replaces the root does not pay for freeing the old version, no matter how
+ * much of it was removed. `retire` destroys nodes worth `inline_budget`
+ * itself, which covers the spine replaced by a small write, and hands the
+ * remaining ones to the thread. The thread destroys them iteratively in
+ * batches worth `batch_size` and takes the versions retired meanwhile after
+ * each batch. A node is worth one plus the number of its elements or
+ * members. Once done the thread lingers for a moment and looks for new
+ * versions by itself, only then `retire` has to wake it.
+ *
+ * A retired version that is still referenced elsewhere is freed by whoever
+ * drops the last reference, like any other node. Without atomic reference
+ * counts trees must not cross threads, `retire` then frees the version
+ * right away. After freeing, and every `sweep_interval` retired versions, a
+ * step of `node_intern_table::sweep_step` releases interned nodes that were
+ * only referenced by the freed versions.
+ */
+class node_reclaimer {
+ public:
+  static constexpr std::size_t inline_budget = 64;
+  static constexpr std::size_t sweep_interval = 64;
+
+  explicit node_reclaimer(std::size_t batch_size = 4096);
+  // frees everything that was retired
+  ~node_reclaimer();
+
+  node_reclaimer(node_reclaimer const&) = delete;
+  node_reclaimer& operator=(node_reclaimer const&) = delete;
+
+  void retire(node_ptr n);
+
+  // waits until all versions retired so far are freed
+  void drain();
+
+  // the number of nodes freed by the thread
+  [[nodiscard]] std::size_t freed_nodes() const noexcept {
+    return freed.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void run();
+  [[nodiscard]] bool sweep_due() noexcept;
+
+  static constexpr std::chrono::milliseconds linger{1};
+
+  std::size_t const batch_size;
+
+  std::mutex mutex;
+  std::condition_variable work_cv;
+  std::condition_variable idle_cv;
+  // lists of dead nodes, see `node_ptr::take_deferred`
+  std::vector<node const*> retired;
+  // working on retired versions
+  bool busy = false;
+  // not waiting for `retire` to wake it
+  bool awake = true;
+  bool stopping = false;
+  bool sweep_requested = false;
+
+  std::atomic<std::size_t> freed{0};
+  std::atomic<std::size_t> retires{0};
+  std::thread thread;
+};
+
+#endif  // AGENCY_NODE_RECLAIMER_H
@@ -0,0 +1,138 @@
+#include "node-root.h"
+
+#include <algorithm>
+#include <new>
+#include <utility>
+
+/*
+ * Slots are never freed, a slot whose thread exited is taken over by the
+ * next thread that needs one. `pointer` is only written by the thread that
+ * took the slot.
+ */
+struct alignas(64) node_hazard_slot {
+  std::atomic<node const*> pointer{nullptr};
+  std::atomic<bool> taken{false};
+  node_hazard_slot* next = nullptr;
+};
+
+namespace {
+
+std::atomic<node_hazard_slot*> slots{nullptr};
+std::atomic<std::size_t> number_of_slots{0};
+
+node_hazard_slot* take_slot() {
+  for (auto* s = slots.load(std::memory_order_acquire); s != nullptr; s = s->next) {
+    if (!s->taken.load(std::memory_order_relaxed) &&
+        !s->taken.exchange(true, std::memory_order_acquire)) {
+      return s;
+    }
+  }
+
+  auto* s = new node_hazard_slot;
+  s->taken.store(true, std::memory_order_relaxed);
+  s->next = slots.load(std::memory_order_relaxed);
+  while (!slots.compare_exchange_weak(s->next, s, std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+  }
+  number_of_slots.fetch_add(1, std::memory_order_relaxed);
+  return s;
+}
+
+/*
+ * A thread keeps its slot until it exits. Pins that overlap, e.g. of two
+ * roots, take another slot for as long as they live.
+ */
+struct thread_slot {
+  node_hazard_slot* slot = take_slot();
+  bool in_use = false;
+
+  ~thread_slot() { slot->taken.store(false, std::memory_order_release); }
+};
+
+thread_local thread_slot own_slot;
+
+}  // namespace
+
+node_root::pinned::pinned(pinned&& other) noexcept
+    : slot(std::exchange(other.slot, nullptr)), ptr(std::exchange(other.ptr, nullptr)) {}
+
+node_root::pinned::~pinned() {
+  if (slot == nullptr) {
+    return;
+  }
+  slot->pointer.store(nullptr, std::memory_order_release);
+  if (slot == own_slot.slot) {
+    own_slot.in_use = false;
+  } else {
+    slot->taken.store(false, std::memory_order_release);
+  }
+}
+
+node_root::node_root(node_ptr root)
+    : current(root.get()), published(std::move(root)) {}
+
+node_root::~node_root() = default;
+
+node_root::pinned node_root::pin() const noexcept {
+  auto& own = own_slot;
+  auto* slot = own.slot;
+  if (own.in_use) {
+    slot = take_slot();
+  } else {
+    own.in_use = true;
+  }
+
+  // the version is safe once the slot points to it while it is still current,
+  // `scan` then sees the slot
+  auto const* ptr = current.load(std::memory_order_relaxed);
+  while (true) {
+    slot->pointer.store(ptr, std::memory_order_seq_cst);
+    auto const* now = current.load(std::memory_order_seq_cst);
+    if (now == ptr) {
+      break;
+    }
+    ptr = now;
+  }
+  return pinned{slot, ptr};
+}
+
+void node_root::store(node_ptr root) {
+  std::unique_lock guard(store_mutex);
+  // nothing can fail once the root is published, a reader may still see the
+  // old one
+  replaced.reserve(replaced.size() + 1);
+  current.store(root.get(), std::memory_order_seq_cst);
+  if (auto old = std::exchange(published, std::move(root)); old != nullptr) {
+    replaced.push_back(std::move(old));
+  }
+  if (replaced.size() > number_of_slots.load(std::memory_order_relaxed)) {
+    try {
+      scan();
+    } catch (std::bad_alloc const&) {
+      // out of memory for the hazards, the versions wait for the next scan
+    }
+  }
+}
+
+std::size_t node_root::slot_count() noexcept {
+  return number_of_slots.load(std::memory_order_relaxed);
+}
+
+void node_root::scan() {
+  hazards.clear();
+  for (auto* s = slots.load(std::memory_order_acquire); s != nullptr; s = s->next) {
+    if (auto const* ptr = s->pointer.load(std::memory_order_seq_cst); ptr != nullptr) {
+      hazards.push_back(ptr);
+    }
+  }
+  std::sort(hazards.begin(), hazards.end());
+
+  auto const still_pinned = [&](node_ptr const& n) {
+    return std::binary_search(hazards.begin(), hazards.end(), n.get());
+  };
+  auto const kept = std::partition(replaced.begin(), replaced.end(), still_pinned);
+  for (auto it = kept; it != replaced.end(); ++it) {
+    reclaimer.retire(std::move(*it));
+  }
+  replaced.erase(kept, replaced.end());
+}
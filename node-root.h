@@ -0,0 +1,83 @@
+#ifndef AGENCY_NODE_ROOT_H
+#define AGENCY_NODE_ROOT_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include "node-reclaimer.h"
+#include "node.h"
+
+struct node_hazard_slot;
+
+/*
+ * The current version of a tree, published to readers without a lock.
+ * Readers pin the root with a hazard pointer: they announce the pointer they
+ * are about to use in a slot of their own and check that it is still the
+ * current one. A slot is a cache line of its own and is reused by its thread,
+ * thus pinning the root writes no memory shared with other readers, neither
+ * a lock word nor the reference count of the root.
+ *
+ * `store` publishes a new version. Replaced versions are kept until no slot
+ * points to them, then they are handed to a `node_reclaimer`. The slots are
+ * scanned once the number of kept versions exceeds the number of slots,
+ * thus a write scans a slot about once. Writers are serialized by a mutex.
+ *
+ * A pinned root is only valid as long as the `pinned` object lives, copy it
+ * into a `node_ptr` with `get` to keep it longer. The pin has to be dropped
+ * by the thread that took it.
+ */
+class node_root {
+ public:
+  class pinned {
+   public:
+    pinned(pinned&& other) noexcept;
+    pinned& operator=(pinned&&) = delete;
+    ~pinned();
+
+    [[nodiscard]] node const& operator*() const noexcept { return *ptr; }
+    [[nodiscard]] node const* operator->() const noexcept { return ptr; }
+    explicit operator bool() const noexcept { return ptr != nullptr; }
+
+    // a reference that outlives the pin
+    [[nodiscard]] node_ptr get() const noexcept { return node_ptr{ptr}; }
+
+   private:
+    friend class node_root;
+    pinned(node_hazard_slot* slot, node const* ptr) noexcept
+        : slot(slot), ptr(ptr) {}
+
+    node_hazard_slot* slot;
+    node const* ptr;
+  };
+
+  explicit node_root(node_ptr root = nullptr);
+  // there must be no readers left
+  ~node_root();
+
+  node_root(node_root const&) = delete;
+  node_root& operator=(node_root const&) = delete;
+
+  [[nodiscard]] pinned pin() const noexcept;
+  [[nodiscard]] node_ptr load() const noexcept { return pin().get(); }
+
+  void store(node_ptr root);
+
+  // the number of slots of all threads so far
+  [[nodiscard]] static std::size_t slot_count() noexcept;
+
+ private:
+  void scan();
+
+  std::atomic<node const*> current;
+
+  std::mutex store_mutex;
+  // `current` and the replaced versions that were pinned at the last scan
+  node_ptr published;
+  std::vector<node_ptr> replaced;
+  std::vector<node const*> hazards;
+  node_reclaimer reclaimer;
+};
+
+#endif  // AGENCY_NODE_ROOT_H
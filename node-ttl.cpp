@@ -0,0 +1,132 @@
+#include "node-ttl.h"
+
+#include <algorithm>
+#include <utility>
+
+node_ttl_wheel::node_ttl_wheel() noexcept { slots.fill(no_entry); }
+
+void node_ttl_wheel::set(std::string_view path, tick_type expiry) {
+  entry_index i;
+  if (auto it = index.find(path); it != index.end()) {
+    i = it->second;
+    unlink(i);
+  } else {
+    if (free_entries.empty()) {
+      i = static_cast<entry_index>(entries.size());
+      entries.emplace_back();
+    } else {
+      i = free_entries.back();
+      free_entries.pop_back();
+    }
+    entries[i].path = path;
+    index.emplace(entries[i].path, i);
+  }
+
+  entries[i].expiry = std::max(expiry, current + 1);
+  link(i, current);
+}
+
+bool node_ttl_wheel::remove(std::string_view path) {
+  auto it = index.find(path);
+  if (it == index.end()) {
+    return false;
+  }
+  auto const i = it->second;
+  index.erase(it);
+  unlink(i);
+  entries[i].path.clear();
+  free_entries.push_back(i);
+  return true;
+}
+
+void node_ttl_wheel::advance(tick_type now, std::vector<std::string>& expired) {
+  while (current < now) {
+    if (index.empty()) {
+      // nothing to move down or expire on the way
+      current = now;
+      break;
+    }
+
+    std::size_t level = 0;
+    while (level_size[level] == 0) {
+      level += 1;
+    }
+    auto next = current + 1;
+    if (level > 0) {
+      // the levels below are empty until the next slot of `level` starts
+      auto const shift = slot_bits * level;
+      next = ((current >> shift) + 1) << shift;
+      if (next > now) {
+        current = now;
+        break;
+      }
+    }
+    tick(next, expired);
+  }
+}
+
+void node_ttl_wheel::link(entry_index i, tick_type reference) noexcept {
+  auto& e = entries[i];
+  auto const differing = e.expiry ^ reference;
+  std::size_t level = 0;
+  while (level + 1 < levels && (differing >> (slot_bits * (level + 1))) != 0) {
+    level += 1;
+  }
+
+  e.slot = static_cast<std::uint32_t>(
+      level * slots_per_level + ((e.expiry >> (slot_bits * level)) & (slots_per_level - 1)));
+  level_size[level] += 1;
+  e.previous = no_entry;
+  e.next = slots[e.slot];
+  if (e.next != no_entry) {
+    entries[e.next].previous = i;
+  }
+  slots[e.slot] = i;
+}
+
+void node_ttl_wheel::unlink(entry_index i) noexcept {
+  auto& e = entries[i];
+  level_size[e.slot / slots_per_level] -= 1;
+  if (e.previous == no_entry) {
+    slots[e.slot] = e.next;
+  } else {
+    entries[e.previous].next = e.next;
+  }
+  if (e.next != no_entry) {
+    entries[e.next].previous = e.previous;
+  }
+}
+
+/*
+ * Moves the slots starting at `t` down, the highest level first, then
+ * expires the level 0 slot of `t`. Entries moved down have their expiry at
+ * `t` or later and do not end up in a slot that is moved down at `t`.
+ */
+void node_ttl_wheel::tick(tick_type t, std::vector<std::string>& expired) {
+  current = t;
+  for (auto level = levels - 1; level > 0; level--) {
+    auto const shift = slot_bits * level;
+    if ((t & ((tick_type{1} << shift) - 1)) != 0) {
+      continue;
+    }
+    auto& slot = slots[level * slots_per_level + ((t >> shift) & (slots_per_level - 1))];
+    auto i = std::exchange(slot, no_entry);
+    while (i != no_entry) {
+      auto const next = entries[i].next;
+      level_size[level] -= 1;
+      link(i, t);
+      i = next;
+    }
+  }
+
+  auto i = std::exchange(slots[t & (slots_per_level - 1)], no_entry);
+  while (i != no_entry) {
+    auto& e = entries[i];
+    level_size[0] -= 1;
+    index.erase(e.path);
+    expired.push_back(std::move(e.path));
+    e.path.clear();
+    free_entries.push_back(i);
+    i = e.next;
+  }
+}
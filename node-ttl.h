@@ -0,0 +1,87 @@
+#ifndef AGENCY_NODE_TTL_H
+#define AGENCY_NODE_TTL_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Expiry times of paths, kept in a hierarchical timing wheel. Time is
+ * counted in ticks of the owner's choosing. The wheel has `levels` levels
+ * of 256 slots, a slot of level `l` spans 256^l ticks. An entry is put into
+ * the level of the highest byte in which its expiry differs from the
+ * current tick, thus level 0 holds the entries of the next 256 ticks by
+ * their exact tick. When the current tick reaches the start of a slot of a
+ * higher level, its entries are moved down, an entry moves at most once
+ * per level.
+ *
+ * Entries are found by path through a hash index and are linked into their
+ * slot in both directions, thus setting, refreshing and removing an expiry
+ * is O(1). Advancing costs O(1) per expired entry and per tick, ticks
+ * while the lower levels are empty are skipped up to the next slot of the
+ * lowest level in use. Not thread safe.
+ */
+class node_ttl_wheel {
+ public:
+  using tick_type = std::uint64_t;
+
+  node_ttl_wheel() noexcept;
+
+  node_ttl_wheel(node_ttl_wheel const&) = delete;
+  node_ttl_wheel& operator=(node_ttl_wheel const&) = delete;
+
+  /*
+   * The path expires with the advance to `expiry`, or with the next one if
+   * that tick has passed already. Replaces a previous expiry of the path.
+   */
+  void set(std::string_view path, tick_type expiry);
+  // returns `false` if the path had no expiry
+  bool remove(std::string_view path);
+
+  /*
+   * Advances the current tick to `now` and appends the paths that expired
+   * meanwhile to `expired`, in order of their expiry.
+   */
+  void advance(tick_type now, std::vector<std::string>& expired);
+
+  [[nodiscard]] tick_type current_tick() const noexcept { return current; }
+  [[nodiscard]] std::size_t size() const noexcept { return index.size(); }
+  [[nodiscard]] bool empty() const noexcept { return index.empty(); }
+
+ private:
+  static constexpr std::size_t slot_bits = 8;
+  static constexpr std::size_t slots_per_level = std::size_t{1} << slot_bits;
+  static constexpr std::size_t levels = 64 / slot_bits;
+
+  using entry_index = std::uint32_t;
+  static constexpr entry_index no_entry = std::numeric_limits<entry_index>::max();
+
+  struct entry {
+    std::string path;
+    tick_type expiry = 0;
+    entry_index previous = no_entry;
+    entry_index next = no_entry;
+    std::uint32_t slot = 0;
+  };
+
+  // `reference` is the tick the slots are relative to, `expiry` is not before it
+  void link(entry_index i, tick_type reference) noexcept;
+  void unlink(entry_index i) noexcept;
+  void tick(tick_type t, std::vector<std::string>& expired);
+
+  tick_type current = 0;
+  // a deque does not move its elements, the index refers to their paths
+  std::deque<entry> entries;
+  std::vector<entry_index> free_entries;
+  std::array<entry_index, levels * slots_per_level> slots;
+  std::array<std::size_t, levels> level_size{};
+  std::unordered_map<std::string_view, entry_index> index;
+};
+
+#endif  // AGENCY_NODE_TTL_H
@@ -0,0 +1,137 @@
+#include "node-work-pool.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+struct worker_identity {
+  node_work_pool const* pool = nullptr;
+  std::size_t index = 0;
+};
+
+thread_local worker_identity current_worker;
+
+}  // namespace
+
+node_work_pool::node_work_pool(std::size_t threads) {
+  threads = std::max<std::size_t>(threads, 1);
+  for (std::size_t i = 0; i < threads; i++) {
+    queues.emplace_back(std::make_unique<task_queue>());
+  }
+  for (std::size_t i = 1; i < threads; i++) {
+    workers.emplace_back([this, i] { worker_loop(i); });
+  }
+}
+
+node_work_pool::~node_work_pool() {
+  {
+    std::unique_lock guard(sleep_mutex);
+    stopping = true;
+  }
+  sleep_cv.notify_all();
+  for (auto& w : workers) {
+    w.join();
+  }
+}
+
+void node_work_pool::push(task t) {
+  auto const self = current_worker.pool == this ? current_worker.index : 0;
+  {
+    auto& q = *queues[self];
+    std::unique_lock guard(q.mutex);
+    q.tasks.push_back(std::move(t));
+  }
+  queued.fetch_add(1, std::memory_order_release);
+  if (!workers.empty()) {
+    // the lock orders the increment before a sleeping worker checks again
+    { std::unique_lock guard(sleep_mutex); }
+    sleep_cv.notify_one();
+  }
+}
+
+bool node_work_pool::try_run_one(std::size_t self) {
+  task t;
+  {
+    // own queue first, newest task
+    auto& q = *queues[self];
+    std::unique_lock guard(q.mutex);
+    if (!q.tasks.empty()) {
+      t = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    }
+  }
+
+  for (std::size_t i = 1; t.group == nullptr && i < queues.size(); i++) {
+    // steal the oldest task of somebody else
+    auto& q = *queues[(self + i) % queues.size()];
+    std::unique_lock guard(q.mutex);
+    if (!q.tasks.empty()) {
+      t = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+  }
+
+  if (t.group == nullptr) {
+    return false;
+  }
+
+  queued.fetch_sub(1, std::memory_order_relaxed);
+  execute(t);
+  return true;
+}
+
+void node_work_pool::execute(task& t) noexcept {
+  auto* group = t.group;
+  try {
+    t.function();
+  } catch (...) {
+    std::unique_lock guard(group->error_mutex);
+    if (group->error == nullptr) {
+      group->error = std::current_exception();
+    }
+  }
+  // release the closure before the group is considered done
+  t.function = nullptr;
+  group->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void node_work_pool::worker_loop(std::size_t self) {
+  current_worker = worker_identity{this, self};
+  while (true) {
+    if (try_run_one(self)) {
+      continue;
+    }
+
+    std::unique_lock guard(sleep_mutex);
+    sleep_cv.wait(guard, [&] {
+      return stopping || queued.load(std::memory_order_acquire) > 0;
+    });
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+void node_work_pool::task_group::wait() {
+  auto const self = current_worker.pool == &pool ? current_worker.index : 0;
+  while (pending.load(std::memory_order_acquire) > 0) {
+    if (!pool.try_run_one(self)) {
+      // the remaining tasks are executed by other threads
+      std::this_thread::yield();
+    }
+  }
+
+  if (error != nullptr) {
+    std::rethrow_exception(std::exchange(error, nullptr));
+  }
+}
+
+node_work_pool::task_group::~task_group() {
+  // tasks reference the group, do not leave before they are done
+  while (pending.load(std::memory_order_acquire) > 0) {
+    if (!pool.try_run_one(current_worker.pool == &pool ? current_worker.index : 0)) {
+      std::this_thread::yield();
+    }
+  }
+}
@@ -0,0 +1,92 @@
+#ifndef AGENCY_NODE_WORK_POOL_H
+#define AGENCY_NODE_WORK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Work stealing thread pool for fork-join style work on trees, e.g. the
+ * parallel import of a snapshot. Every worker owns a deque of tasks. New
+ * tasks are pushed to the back of the deque of the spawning thread and taken
+ * from there, idle workers steal from the front of other deques, i.e. they
+ * take the oldest and usually largest pieces of work.
+ *
+ * Tasks are spawned through a `task_group`. A thread waiting for a group
+ * executes pending tasks until the group is complete, thus nested groups do
+ * not block workers.
+ */
+class node_work_pool {
+ public:
+  // `threads` includes the thread calling `task_group::wait`
+  explicit node_work_pool(std::size_t threads = std::thread::hardware_concurrency());
+  ~node_work_pool();
+
+  node_work_pool(node_work_pool const&) = delete;
+  node_work_pool& operator=(node_work_pool const&) = delete;
+
+  [[nodiscard]] std::size_t concurrency() const noexcept { return workers.size() + 1; }
+
+  class task_group {
+   public:
+    explicit task_group(node_work_pool& pool) noexcept : pool(pool) {}
+    ~task_group();
+
+    task_group(task_group const&) = delete;
+    task_group& operator=(task_group const&) = delete;
+
+    template <typename F>
+    void run(F&& f) {
+      pending.fetch_add(1, std::memory_order_relaxed);
+      pool.push(task{this, std::function<void()>(std::forward<F>(f))});
+    }
+
+    /*
+     * Executes tasks until all tasks of this group are done. Rethrows the
+     * first exception thrown by a task.
+     */
+    void wait();
+
+   private:
+    friend class node_work_pool;
+
+    node_work_pool& pool;
+    std::atomic<std::size_t> pending{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+  };
+
+ private:
+  struct task {
+    task_group* group = nullptr;
+    std::function<void()> function;
+  };
+
+  struct task_queue {
+    std::mutex mutex;
+    std::deque<task> tasks;
+  };
+
+  void push(task t);
+  bool try_run_one(std::size_t self);
+  static void execute(task& t) noexcept;
+  void worker_loop(std::size_t self);
+
+  // queue 0 belongs to threads that are not workers of this pool
+  std::vector<std::unique_ptr<task_queue>> queues;
+  std::vector<std::thread> workers;
+
+  std::atomic<std::size_t> queued{0};
+  std::mutex sleep_mutex;
+  std::condition_variable sleep_cv;
+  bool stopping = false;
+};
+
+#endif  // AGENCY_NODE_WORK_POOL_H
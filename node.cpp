@@ -1,10 +1,20 @@
 //
 // Created by lars on 28.11.19.
 //
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <exception>
+#include <limits>
+#include <new>
+#include <unordered_map>
+#include <utility>
 
 #include "helper-strings.h"
+#include "node-editor.h"
+#include "node-intern.h"
+#include "node-json.h"
+#include "node-work-pool.h"
 #include "node.h"
 
 #include "immer/flex_vector_transient.hpp"
@@ -14,55 +24,909 @@
 #include "velocypack/Iterator.h"
 #include "velocypack/Slice.h"
 
-node_ptr node_array::get_impl(std::string const& key) const noexcept {
+namespace {
+
+constexpr std::size_t demote_size_limit = node_small_container_limit / 2;
+
+template <typename C>
+node_array::small_container_type to_small_array(C const& c) {
+  return node_array::small_container_type(c.begin(), c.end());
+}
+
+node_array::container_type to_large_array(node_array::small_container_type const& c) {
+  auto result = node_array::container_type{}.transient();
+  for (auto const& v : c) {
+    result.push_back(v);
+  }
+  return result.persistent();
+}
+
+}  // namespace
+
+/*
+ * Maps the hash of the elements to their number. All elements of an entry
+ * equal its witness unless it collided, then they have to be searched.
+ *
+ * The entries are built at once into an open addressing table, which is
+ * shared by the derived indexes. Their changes are kept in a HAMT, thus
+ * deriving an index is cheap, and merged into a new table once they reach a
+ * quarter of it.
+ */
+struct node_array::element_index {
+  struct entry {
+    std::uint64_t hash = 0;
+    // zero for empty slots and removed entries
+    std::uint32_t count = 0;
+    bool collided = false;
+    node_ptr witness;
+  };
+
+  struct table {
+    std::vector<entry> slots;
+    std::size_t size = 0;
+
+    explicit table(std::size_t entries) {
+      auto capacity = std::size_t{16};
+      while (capacity < 2 * entries) {
+        capacity *= 2;
+      }
+      slots.resize(capacity);
+    }
+
+    // the slot of `hash` or the empty slot it is inserted at
+    [[nodiscard]] std::size_t position(std::uint64_t hash) const noexcept {
+      auto const mask = slots.size() - 1;
+      auto pos = hash & mask;
+      while (slots[pos].count != 0 && slots[pos].hash != hash) {
+        pos = (pos + 1) & mask;
+      }
+      return pos;
+    }
+
+    [[nodiscard]] entry const* find(std::uint64_t hash) const noexcept {
+      auto const& slot = slots[position(hash)];
+      return slot.count == 0 ? nullptr : &slot;
+    }
+
+    void insert(entry e) {
+      slots[position(e.hash)] = std::move(e);
+      size += 1;
+    }
+  };
+
+  struct identity_hash {
+    std::size_t operator()(std::uint64_t hash) const noexcept { return hash; }
+  };
+
+  std::shared_ptr<table const> base;
+  immer::map<std::uint64_t, entry, identity_hash, std::equal_to<>, node_memory_policy> changes;
+
+  explicit element_index(container_type const& elements) {
+    auto result = std::make_shared<table>(elements.size());
+    for (auto const& element : elements) {
+      // the `nullptr` elements of an overlay never match
+      if (element == nullptr) {
+        continue;
+      }
+      auto const hash = element->hash();
+      auto& slot = result->slots[result->position(hash)];
+      if (slot.count == 0) {
+        slot = entry{hash, 1, false, element};
+        result->size += 1;
+      } else {
+        slot.count += 1;
+        slot.collided = slot.collided || !(*slot.witness == *element);
+      }
+    }
+    base = std::move(result);
+  }
+
+  [[nodiscard]] entry const* find(std::uint64_t hash) const noexcept {
+    if (auto const* changed = changes.find(hash); changed != nullptr) {
+      return changed->count == 0 ? nullptr : changed;
+    }
+    return base->find(hash);
+  }
+
+  void add(node_ptr const& element) {
+    if (element == nullptr) {
+      return;
+    }
+    auto const hash = element->hash();
+    auto next = entry{hash, 1, false, element};
+    if (auto const* found = find(hash); found != nullptr) {
+      next = *found;
+      next.count += 1;
+      next.collided = next.collided || !(*next.witness == *element);
+    }
+    update(std::move(next));
+  }
+
+  void remove(node_ptr const& element) {
+    if (element == nullptr) {
+      return;
+    }
+    auto const* found = find(element->hash());
+    assert(found != nullptr);
+    auto next = *found;
+    next.count -= 1;
+    update(std::move(next));
+  }
+
+ private:
+  void update(entry e) {
+    auto const hash = e.hash;
+    if (e.count == 0 && base->find(hash) == nullptr) {
+      changes = changes.erase(hash);
+    } else {
+      if (e.count == 0) {
+        e.witness = nullptr;
+      }
+      changes = changes.set(hash, std::move(e));
+    }
+    if (changes.size() > std::max<std::size_t>(16, base->size / 4)) {
+      merge();
+    }
+  }
+
+  void merge() {
+    auto result = std::make_shared<table>(base->size + changes.size());
+    for (auto const& slot : base->slots) {
+      if (slot.count != 0 && changes.find(slot.hash) == nullptr) {
+        result->insert(slot);
+      }
+    }
+    for (auto const& [hash, e] : changes) {
+      if (e.count != 0) {
+        result->insert(e);
+      }
+    }
+    base = std::move(result);
+    changes = {};
+  }
+};
+
+namespace {
+
+node_array copy_of(node_array const& array) {
+  node_array result;
+  result.value = array.value;
+  return result;
+}
+
+// the index of `base` changed by `f`, nullptr if `base` has no index
+template <typename F>
+std::unique_ptr<node_array::element_index const> derived_index(node_array const& base, F&& f) {
+  auto const* large = std::get_if<node_array::large_box>(&base.value);
+  if (large == nullptr) {
+    return nullptr;
+  }
+  auto const* index = (*large)->index.load(std::memory_order_acquire);
+  if (index == nullptr) {
+    return nullptr;
+  }
+  auto result = std::make_unique<node_array::element_index>(*index);
+  f(*result);
+  return result;
+}
+
+}  // namespace
+
+node_array::large_type::large_type(container_type elements) noexcept
+    : elements(std::move(elements)) {}
+
+node_array::large_type::large_type(container_type elements,
+                                   std::unique_ptr<element_index const> index) noexcept
+    : elements(std::move(elements)), index(index.release()) {}
+
+node_array::large_type::large_type(large_type&& other) noexcept
+    : elements(std::move(other.elements)), index(other.index.exchange(nullptr)) {}
+
+node_array::large_type& node_array::large_type::operator=(large_type&& other) noexcept {
+  if (this != &other) {
+    elements = std::move(other.elements);
+    delete index.exchange(other.index.exchange(nullptr));
+  }
+  return *this;
+}
+
+node_array::large_type::~large_type() { delete index.load(); }
+
+void node_array::large_type::drop_index() noexcept { delete index.exchange(nullptr); }
+
+node_array::node_array(container_type value) : node_array(std::move(value), nullptr) {}
+
+node_array::node_array(container_type value, std::unique_ptr<element_index const> index) {
+  if (value.size() <= demote_size_limit) {
+    this->value = to_small_array(value);
+  } else {
+    if (value.size() < index_size_limit) {
+      index = nullptr;
+    }
+    this->value = large_box{std::move(value), std::move(index)};
+  }
+}
+
+node_array::node_array(small_container_type value) {
+  if (value.size() > node_small_container_limit) {
+    this->value = large_box{to_large_array(value)};
+  } else {
+    this->value = std::move(value);
+  }
+}
+
+/*
+ * Concurrent readers may both build the index, the first one to publish it
+ * wins. Without memory for the index the queries scan the array.
+ */
+node_array::element_index const* node_array::index() const noexcept {
+  auto const* large = std::get_if<large_box>(&value);
+  if (large == nullptr || (*large)->elements.size() < index_size_limit) {
+    return nullptr;
+  }
+  auto& slot = (*large)->index;
+  if (auto const* existing = slot.load(std::memory_order_acquire); existing != nullptr) {
+    return existing;
+  }
+
+  std::unique_ptr<element_index> built;
+  try {
+    built = std::make_unique<element_index>((*large)->elements);
+  } catch (std::bad_alloc const&) {
+    return nullptr;
+  }
+  element_index const* expected = nullptr;
+  if (slot.compare_exchange_strong(expected, built.get(), std::memory_order_acq_rel)) {
+    return built.release();
+  }
+  return expected;
+}
+
+std::size_t node_array::size() const noexcept {
+  return visit_elements([](auto const& c) { return c.size(); });
+}
+
+node_ptr const& node_array::at(std::size_t i) const noexcept {
+  return visit_elements([i](auto const& c) -> node_ptr const& { return c[i]; });
+}
+
+node_ptr node_array::get_impl(std::string_view key) const noexcept {
   auto parsed_value = string_to_number<std::size_t>(key);
   if (parsed_value.has_value()) {
     std::size_t i = parsed_value.value();
-    if (i >= value.size()) {
+    if (i >= size()) {
       return nullptr;
     }
-    return value[i];
+    return at(i);
   }
   return nullptr;
 }
 
-node_ptr node_object::get_impl(std::string const& key) const noexcept {
-  if (auto it = value.find(key); it != nullptr) {
+node_ptr node_object::get_impl(std::string_view key) const noexcept {
+  if (auto it = find(key, node_key::hash_of(key)); it != nullptr) {
     return *it;
   }
 
   return nullptr;
 }
 
+node_ptr node_object::get_impl(node_key const& key) const noexcept {
+  if (auto it = find(key); it != nullptr) {
+    return *it;
+  }
+
+  return nullptr;
+}
+
+node_object::node_object(container_type value) {
+  if (value.size() <= demote_size_limit) {
+    auto result = small_container_type(value.begin(), value.end());
+    std::sort(result.begin(), result.end(), [](member_type const& a, member_type const& b) {
+      return member_less(a.first, b.first);
+    });
+    this->value = std::move(result);
+  } else {
+    this->value = std::move(value);
+  }
+}
+
+std::size_t node_object::size() const noexcept {
+  return visit_members([](auto const& c) { return c.size(); });
+}
+
+namespace {
+node_ptr const* find_member(node_object::small_container_type const& c,
+                            node_key const& key) noexcept {
+  // there are only a few members, comparing pointers beats a binary search
+  for (auto const& member : c) {
+    if (member.first == key) {
+      return &member.second;
+    }
+  }
+  return nullptr;
+}
+
+node_ptr const* find_member(node_object::container_type const& c, node_key const& key) noexcept {
+  return c.find(key);
+}
+}  // namespace
+
+node_ptr const* node_object::find(node_key const& key) const noexcept {
+  return visit_members([&](auto const& c) { return find_member(c, key); });
+}
+
+node_ptr const* node_object::find(std::string_view name, std::uint64_t hash) const noexcept {
+  return visit_members(visitor{
+      [&](small_container_type const& c) -> node_ptr const* {
+        // sorted by hash first
+        for (auto const& member : c) {
+          if (member.first.hash() == hash && member.first.view() == name) {
+            return &member.second;
+          } else if (member.first.hash() > hash) {
+            break;
+          }
+        }
+        return nullptr;
+      },
+      [&](container_type const& c) -> node_ptr const* {
+        node_key_probe probe{name, hash};
+        // a long name that is not interned can not be a member
+        return probe.get() ? c.find(probe.get()) : nullptr;
+      },
+  });
+}
+
+node_object::transient_type::transient_type(node_object const& base) {
+  if (base.is_compact()) {
+    small = std::get<small_container_type>(base.value);
+  } else {
+    compact = false;
+    large = std::get<container_type>(base.value);
+  }
+}
+
+node_object::transient_type::transient_type(node_object&& base) noexcept {
+  if (base.is_compact()) {
+    small = std::move(std::get<small_container_type>(base.value));
+  } else {
+    compact = false;
+    large = std::move(std::get<container_type>(base.value));
+  }
+  base.value = small_container_type{};
+}
+
+node_ptr const* node_object::transient_type::find(node_key const& key) const noexcept {
+  return compact ? find_member(small, key) : find_member(large, key);
+}
+
+std::size_t node_object::transient_type::size() const noexcept {
+  return compact ? small.size() : large.size();
+}
+
+void node_object::transient_type::set(node_key key, node_ptr v) {
+  if (v == nullptr) {
+    erase(key);
+    return;
+  }
+
+  put(std::move(key), std::move(v));
+}
+
+void node_object::transient_type::put(node_key key, node_ptr v) {
+  if (!compact) {
+    large = large.set(std::move(key), std::move(v));
+    return;
+  }
+
+  auto it = std::lower_bound(small.begin(), small.end(), key,
+                             [](member_type const& m, node_key const& k) {
+                               return member_less(m.first, k);
+                             });
+  if (it != small.end() && it->first == key) {
+    it->second = std::move(v);
+    return;
+  }
+
+  small.emplace(it, std::move(key), std::move(v));
+  if (small.size() > node_small_container_limit) {
+    promote();
+  }
+}
+
+void node_object::transient_type::erase(node_key const& key) {
+  if (!compact) {
+    large = large.erase(key);
+    return;
+  }
+
+  auto it = std::find_if(small.begin(), small.end(),
+                         [&](member_type const& m) { return m.first == key; });
+  if (it != small.end()) {
+    small.erase(it);
+  }
+}
+
+void node_object::transient_type::promote() {
+  for (auto& member : small) {
+    large = large.set(std::move(member.first), std::move(member.second));
+  }
+  small.clear();
+  compact = false;
+}
+
+node_object node_object::transient_type::persistent() && {
+  if (compact) {
+    return node_object{std::move(small)};
+  }
+  return node_object{std::move(large)};
+}
+
 thread_local node_ptr node::null_value_node = make_node_ptr(node_null{});
 thread_local node_ptr node::empty_array_node = make_node_ptr(node_array{});
 thread_local node_ptr node::empty_object_node = make_node_ptr(node_object{});
 
+namespace {
+
+/*
+ * Builds an object or array node from `s`, the children are created by
+ * `child`.
+ */
+template <typename F>
+node_ptr container_from_slice(arangodb::velocypack::Slice s, F&& child) {
+  if (s.isObject()) {
+    node_object::transient_type result;
+    for (auto const& member : arangodb::velocypack::ObjectIterator(s)) {
+      result.set(node_key{member.key.stringView()}, child(member.value));
+    }
+    return make_node_ptr(std::move(result).persistent());
+  }
+
+  assert(s.isArray());
+  if (s.length() <= node_small_container_limit) {
+    node_array::small_container_type result;
+    result.reserve(s.length());
+    for (auto const& member : ArrayIterator(s)) {
+      result.push_back(child(member));
+    }
+    return make_node_ptr(node_array{std::move(result)});
+  }
+  node_array::container_type container;
+  auto result = container.transient();
+  for (auto const& member : ArrayIterator(s)) {
+    result.push_back(child(member));
+  }
+  return make_node_ptr(node_array{result.persistent()});
+}
+
+bool is_lazy_container(arangodb::velocypack::Slice s) {
+  return (s.isObject() || s.isArray()) && s.length() > 0;
+}
+
+node_ptr slice_node(node_slice::buffer_ptr const& buffer, arangodb::velocypack::Slice s) {
+  if (is_lazy_container(s)) {
+    return make_node_ptr(node_slice{buffer, s});
+  }
+  return node::from_slice(s);
+}
+
+}  // namespace
+
+bool node::interning() noexcept { return node_intern_table::limit() != 0; }
+
+node_ptr node::interned_value(double v) { return node_intern_table::from_value(v); }
+
+node_ptr node::interned_value(bool v) { return node_intern_table::from_value(v); }
+
+node_ptr node::interned_value(std::string_view v) {
+  return node_intern_table::from_value(v);
+}
+
 node_ptr node::from_slice(arangodb::velocypack::Slice s) {
+  if (node_intern_table::limit() != 0) {
+    return node_intern_table::from_slice(s);
+  }
   if (s.isNumber()) {
     return make_node_ptr(node_double{s.getNumber<double>()});
   } else if (s.isString()) {
     return make_node_ptr(node_string{std::move(s.copyString())});
   } else if (s.isBool()) {
     return make_node_ptr(node_bool{s.getBool()});
-  } else if (s.isObject()) {
-    node_object::container_type container;
-    for (auto const& member : arangodb::velocypack::ObjectIterator(s)) {
-      container = container.set(member.key.copyString(), node::from_slice(member.value));
+  } else if (s.isObject() || s.isArray()) {
+    return container_from_slice(s, [](Slice child) { return node::from_slice(child); });
+  } else if (s.isNull()) {
+    return node::null_node();
+  }
+
+  std::terminate();  // unhandled type
+}
+
+namespace {
+
+// subtrees smaller than this are imported by a single task
+constexpr std::size_t parallel_import_min_size = 64 * 1024;
+
+node_ptr parallel_from_slice(Slice s, node_work_pool& pool) {
+  if (s.byteSize() < parallel_import_min_size || !(s.isObject() || s.isArray())) {
+    return node::from_slice(s);
+  }
+
+  std::vector<Slice> values;
+  values.reserve(s.length());
+  if (s.isObject()) {
+    for (auto const& member : ObjectIterator(s)) {
+      values.push_back(member.value);
+    }
+  } else {
+    for (auto const& member : ArrayIterator(s)) {
+      values.push_back(member);
+    }
+  }
+
+  // Large children are split up further, small ones are imported in batches
+  // of about the minimum size.
+  std::vector<node_ptr> children(values.size());
+  {
+    node_work_pool::task_group group(pool);
+    std::size_t begin = 0;
+    std::size_t batch_size = 0;
+    auto const flush = [&](std::size_t end) {
+      if (begin < end) {
+        group.run([&, begin, end] {
+          for (auto i = begin; i < end; i++) {
+            children[i] = node::from_slice(values[i]);
+          }
+        });
+      }
+      begin = end;
+      batch_size = 0;
+    };
+
+    for (std::size_t i = 0; i < values.size(); i++) {
+      auto const size = values[i].byteSize();
+      if (size >= parallel_import_min_size) {
+        flush(i);
+        group.run([&, i] { children[i] = parallel_from_slice(values[i], pool); });
+        begin = i + 1;
+      } else {
+        batch_size += size;
+        if (batch_size >= parallel_import_min_size) {
+          flush(i + 1);
+        }
+      }
+    }
+    flush(values.size());
+    group.wait();
+  }
+
+  // keys are interned in the same order as by the serial import
+  std::size_t next = 0;
+  return container_from_slice(s, [&](Slice) { return std::move(children[next++]); });
+}
+
+}  // namespace
+
+node_ptr node::from_slice(arangodb::velocypack::Slice s, node_work_pool& pool) {
+#if AGENCY_NODE_ATOMIC_REFCOUNT
+  if (pool.concurrency() > 1) {
+    return parallel_from_slice(s, pool);
+  }
+#endif
+  // plain reference counts, e.g. of the shared null node, must not be
+  // touched by multiple threads
+  return from_slice(s);
+}
+
+node_ptr node::lazy_from_slice(arangodb::velocypack::Slice s) {
+  if (!is_lazy_container(s)) {
+    return from_slice(s);
+  }
+
+  auto buffer = std::make_shared<Buffer<uint8_t>>(s.byteSize());
+  buffer->append(s.start(), s.byteSize());
+  return lazy_from_buffer(std::move(buffer));
+}
+
+node_ptr node::lazy_from_buffer(node_slice::buffer_ptr buffer) {
+  auto const s = Slice(buffer->data());
+  return slice_node(buffer, s);
+}
+
+node_ptr node_slice::get(immut_list<std::string> const& path) const {
+  auto current = slice;
+  for (auto e = path.head.get(); e != nullptr; e = e->next.get()) {
+    auto const& key = e->value;
+    if (current.isObject()) {
+      current = current.get(key.data(), key.size());
+      if (current.isNone()) {
+        return nullptr;
+      }
+    } else if (current.isArray()) {
+      auto const index = string_to_number<std::size_t>(key);
+      if (!index.has_value() || index.value() >= current.length()) {
+        return nullptr;
+      }
+      current = current.at(index.value());
+    } else {
+      return nullptr;
     }
-    return make_node_ptr(node_object{std::move(container)});
+  }
+
+  return slice_node(buffer, current);
+}
+
+node_ptr node_slice::get(node_path_view path) const {
+  auto current = slice;
+  for (auto const& segment : path) {
+    if (current.isObject()) {
+      auto const name = segment.name();
+      current = current.get(name.data(), name.size());
+      if (current.isNone()) {
+        return nullptr;
+      }
+    } else if (current.isArray()) {
+      if (!segment.is_index() || segment.index >= current.length()) {
+        return nullptr;
+      }
+      current = current.at(segment.index);
+    } else {
+      return nullptr;
+    }
+  }
+
+  return slice_node(buffer, current);
+}
+
+node_ptr node_slice::materialize() const {
+  return container_from_slice(slice, [&](Slice child) { return slice_node(buffer, child); });
+}
+
+namespace {
+
+bool slice_equals(Slice left, Slice right) noexcept {
+  if (left.isNumber() || right.isNumber()) {
+    return left.isNumber() && right.isNumber() &&
+           left.getNumber<double>() == right.getNumber<double>();
+  } else if (left.isString() || right.isString()) {
+    return left.isString() && right.isString() && left.stringView() == right.stringView();
+  } else if (left.isBool() || right.isBool()) {
+    return left.isBool() && right.isBool() && left.getBool() == right.getBool();
+  } else if (left.isArray()) {
+    if (!right.isArray() || left.length() != right.length()) {
+      return false;
+    }
+    auto it = ArrayIterator(right);
+    for (auto const& member : ArrayIterator(left)) {
+      if (!slice_equals(member, *it)) {
+        return false;
+      }
+      it.next();
+    }
+    return true;
+  } else if (left.isObject()) {
+    if (!right.isObject() || left.length() != right.length()) {
+      return false;
+    }
+    for (auto const& member : ObjectIterator(left)) {
+      auto const key = member.key.stringView();
+      auto const other = right.get(key.data(), key.size());
+      if (other.isNone() || !slice_equals(member.value, other)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  return left.isNull() && right.isNull();
+}
+
+}  // namespace
+
+bool node_slice::operator==(node_slice const& other) const noexcept {
+  return slice_equals(slice, other.slice);
+}
+
+bool node_slice::contains(node_ptr const& needle) const noexcept {
+  if (needle == nullptr || !slice.isArray()) {
+    return false;
+  }
+  // hashing an element costs as much as comparing it
+  for (auto const& member : ArrayIterator(slice)) {
+    if (node_slice{nullptr, member}.equals(*needle)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool node_slice::equals(node const& other) const noexcept {
+  return std::visit(
+      visitor{
+          [&](node_double const& v) {
+            return slice.isNumber() && slice.getNumber<double>() == v.value;
+          },
+          [&](node_string const& v) {
+            return slice.isString() && slice.stringView() == v.value;
+          },
+          [&](node_bool const& v) { return slice.isBool() && slice.getBool() == v.value; },
+          [&](node_null const&) { return slice.isNull(); },
+          [&](node_array const& a) {
+            if (!slice.isArray() || slice.length() != a.size()) {
+              return false;
+            }
+            std::size_t i = 0;
+            for (auto const& member : ArrayIterator(slice)) {
+              if (!node_slice{nullptr, member}.equals(*a.at(i++))) {
+                return false;
+              }
+            }
+            return true;
+          },
+          [&](node_object const& o) {
+            if (!slice.isObject() || slice.length() != o.size()) {
+              return false;
+            }
+            for (auto const& member : ObjectIterator(slice)) {
+              auto const key = member.key.stringView();
+              auto const found = o.find(key, node_key::hash_of(key));
+              if (found == nullptr || !node_slice{nullptr, member.value}.equals(**found)) {
+                return false;
+              }
+            }
+            return true;
+          },
+          [&](node_slice const& s) { return *this == s; },
+      },
+      other.value);
+}
+
+namespace {
+
+// distinct seeds per type, so e.g. `[]` and `{}` do not collide
+constexpr std::uint64_t hash_seed_null = 0x6e756c6c00000001;
+constexpr std::uint64_t hash_seed_bool = 0x626f6f6c00000002;
+constexpr std::uint64_t hash_seed_number = 0x6e756d6200000003;
+constexpr std::uint64_t hash_seed_string = 0x7374726900000004;
+constexpr std::uint64_t hash_seed_array = 0x6172726100000005;
+constexpr std::uint64_t hash_seed_object = 0x6f626a6500000006;
+// children of overlay nodes may be `nullptr`
+constexpr std::uint64_t hash_of_nullptr = 0x6e756c6c70747207;
+
+std::uint64_t hash_mix(std::uint64_t x) noexcept {
+  // splitmix64 finalizer
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111eb;
+  x ^= x >> 31;
+  return x;
+}
+
+std::uint64_t hash_bool(bool v) noexcept { return hash_mix(hash_seed_bool + v); }
+
+std::uint64_t hash_number(double v) noexcept {
+  if (v == 0.0) {
+    v = 0.0;  // -0.0 == 0.0
+  }
+  std::uint64_t bits;
+  static_assert(sizeof(bits) == sizeof(v));
+  std::memcpy(&bits, &v, sizeof(v));
+  return hash_mix(hash_seed_number ^ bits);
+}
+
+std::uint64_t hash_string(std::string_view v) noexcept {
+  return hash_mix(hash_seed_string ^ node_key::hash_of(v));
+}
+
+struct array_hasher {
+  std::uint64_t state = hash_seed_array;
+  std::uint64_t size = 0;
+
+  void add(std::uint64_t element) noexcept {
+    state = hash_mix(state + element);
+    size += 1;
+  }
+  [[nodiscard]] std::uint64_t finish() const noexcept {
+    return hash_mix(state ^ size);
+  }
+};
+
+struct object_hasher {
+  std::uint64_t sum = 0;
+  std::uint64_t size = 0;
+
+  void add(std::uint64_t key, std::uint64_t value) noexcept {
+    sum += hash_mix(key ^ hash_mix(value + hash_seed_object));
+    size += 1;
+  }
+  [[nodiscard]] std::uint64_t finish() const noexcept {
+    return hash_mix(hash_seed_object ^ hash_mix(sum + size));
+  }
+};
+
+std::uint64_t hash_of(node_ptr const& n) noexcept {
+  return n == nullptr ? hash_of_nullptr : n->hash();
+}
+
+std::uint64_t slice_hash(Slice s) noexcept {
+  if (s.isNumber()) {
+    return hash_number(s.getNumber<double>());
+  } else if (s.isString()) {
+    return hash_string(s.stringView());
+  } else if (s.isBool()) {
+    return hash_bool(s.getBool());
   } else if (s.isArray()) {
-    node_array::container_type container;
-    auto result = container.transient();
+    array_hasher hasher;
     for (auto const& member : ArrayIterator(s)) {
-      result.push_back(node::from_slice(member));
+      hasher.add(slice_hash(member));
     }
-    return make_node_ptr(node_array{result.persistent()});
-  } else if (s.isNull()) {
-    return node::null_node();
+    return hasher.finish();
+  } else if (s.isObject()) {
+    object_hasher hasher;
+    for (auto const& member : ObjectIterator(s)) {
+      hasher.add(node_key::hash_of(member.key.stringView()), slice_hash(member.value));
+    }
+    return hasher.finish();
+  }
+  return hash_mix(hash_seed_null);
+}
+
+}  // namespace
+
+std::uint64_t node::hash() const noexcept {
+  if (auto const h = cached_hash.load(std::memory_order_relaxed); h != 0) {
+    return h;
+  }
+
+  auto h = std::visit(
+      visitor{
+          [](node_double const& v) { return hash_number(v.value); },
+          [](node_string const& v) { return hash_string(v.value); },
+          [](node_bool const& v) { return hash_bool(v.value); },
+          [](node_null const&) { return hash_mix(hash_seed_null); },
+          [](node_array const& a) {
+            array_hasher hasher;
+            a.visit_elements([&](auto const& c) {
+              for (auto const& element : c) {
+                hasher.add(hash_of(element));
+              }
+            });
+            return hasher.finish();
+          },
+          [](node_object const& o) {
+            object_hasher hasher;
+            o.visit_members([&](auto const& c) {
+              for (auto const& member : c) {
+                hasher.add(member.first.hash(), hash_of(member.second));
+              }
+            });
+            return hasher.finish();
+          },
+          [](node_slice const& s) { return slice_hash(s.slice); },
+      },
+      value);
+
+  // zero marks a missing hash
+  h += h == 0;
+  // racing threads compute the same value
+  cached_hash.store(h, std::memory_order_relaxed);
+  return h;
+}
+
+bool node::operator==(node const& n) const noexcept {
+  if (this == &n) {
+    return true;
+  } else if (hash() != n.hash()) {
+    return false;
   }
 
-  std::terminate();  // unhandled type
+  auto const* left = std::get_if<node_slice>(&value);
+  auto const* right = std::get_if<node_slice>(&n.value);
+  if (left != nullptr) {
+    return left->equals(n);
+  } else if (right != nullptr) {
+    return right->equals(*this);
+  }
+  return value == n.value;
 }
 
 template <typename P>
@@ -72,7 +936,7 @@ struct node_visitor_get {
   explicit node_visitor_get(P& path) noexcept : path(path) {}
 
   template <typename T>
-  auto operator()(node_container<T> const& c) const noexcept -> node_ptr {
+  auto operator()(node_container<T> const& c) const -> node_ptr {
     auto& [head, tail] = path;
     if (auto child = c.get(head); child != nullptr) {
       return child->get(tail);
@@ -84,170 +948,332 @@ struct node_visitor_get {
   auto operator()(node_value<T> const&) const noexcept -> node_ptr {
     return nullptr;
   }
+
+  auto operator()(node_slice const& s) const -> node_ptr {
+    return s.get(path);
+  }
 };
 
-node_ptr node::get(immut_list<std::string> const& path) const noexcept {
+node_ptr node::get(immut_list<std::string> const& path) const {
   if (path.empty()) {
-    return node_ptr{shared_from_this()};
+    return node_ptr{this};
   }
 
   return std::visit(node_visitor_get{path}, value);
 }
 
-void node_object::into_builder(Builder& builder) const {
-  ObjectBuilder object_builder(&builder);
-  for (auto const& member : value) {
-    builder.add(Value(member.first));
-    member.second->into_builder(builder);
+node_ptr node::get(node_path_view path) const {
+  // walks raw pointers, only the result is referenced
+  auto current = this;
+  for (auto segment = path.begin(); segment != path.end(); ++segment) {
+    node_ptr const* child = nullptr;
+    if (auto const* o = std::get_if<node_object>(&current->value); o != nullptr) {
+      child = o->find(segment->name(), segment->hash);
+    } else if (auto const* a = std::get_if<node_array>(&current->value); a != nullptr) {
+      if (segment->is_index() && segment->index < a->size()) {
+        child = &a->at(segment->index);
+      }
+    } else if (auto const* s = std::get_if<node_slice>(&current->value); s != nullptr) {
+      return s->get(node_path_view{segment, path.end()});
+    }
+
+    if (child == nullptr || *child == nullptr) {
+      return nullptr;
+    }
+    current = child->get();
   }
+  return node_ptr{current};
 }
 
-node_object node_object::overlay_impl(node_object const& ov) const noexcept {
-  /*
-   * Copy all values from the base node. If the overlay contains a member that
-   * has `nullptr` as value, remove the value from the result.
-   * If the key is not set in the current node, just add it.
-   * Otherwise overlay the base child by the overlay child.
-   */
-  auto result = value;
-  for (auto const& member : ov.value) {
-    if (member.second == nullptr) {
-      result = result.erase(member.first);
-    } else {
-      auto& store = result[member.first];
-      if (store == nullptr) {
-        result = result.set(member.first, member.second);
-      } else {
-        result = result.set(member.first, store->overlay(member.second));
-      }
+node const* node::anchor(path_slice const& path) const noexcept {
+  auto current = this;
+  for (auto e = path.head.get(); e != nullptr; e = e->next.get()) {
+    if (std::holds_alternative<node_slice>(current->value)) {
+      return current;
+    }
+    // the parent keeps the child alive
+    auto const child = std::visit(visitor{
+                                      [&](node_object const& o) { return o.get(e->value); },
+                                      [&](node_array const& a) { return a.get(e->value); },
+                                      [](auto const&) { return node_ptr{}; },
+                                  },
+                                  current->value);
+    if (child == nullptr) {
+      return nullptr;
     }
+    current = child.get();
   }
-  return node_object{std::move(result)};
+  return current;
+}
+
+void node_object::into_builder(Builder& builder) const {
+  ObjectBuilder object_builder(&builder);
+  visit_members([&](auto const& c) {
+    for (auto const& member : c) {
+      auto const name = member.first.view();
+      builder.add(ValuePair(name.data(), name.size(), ValueType::String));
+      member.second->into_builder(builder);
+    }
+  });
 }
 
-node_ptr node_object::set_impl(std::string const& key, node_ptr const& v) const {
-  auto result = value;
+node_ptr node_object::set_impl(std::string_view key, node_ptr const& v) const {
   if (v == nullptr) {
-    result = result.erase(key);
-  } else {
-    result = result.set(key, v);
+    // removing a name that is not interned is a no-op
+    if (auto interned = node_key::find(key); interned) {
+      return set_impl(interned, v);
+    }
+    return make_node_ptr(transient().persistent());
+  }
+  return set_impl(node_key{key}, v);
+}
+
+node_ptr node_object::set_impl(node_key const& key, node_ptr const& v) const {
+  if (!is_compact()) {
+    auto const& map = std::get<container_type>(value);
+    if (v == nullptr) {
+      return make_node_ptr(node_object{map.erase(key)});
+    }
+    return make_node_ptr(node_object{map.set(key, v)});
   }
 
-  return make_node_ptr(node_object{std::move(result)});
+  auto result = transient();
+  result.set(key, v);
+  return make_node_ptr(std::move(result).persistent());
 }
-node_object::node_object(std::string const& key, node_ptr const& v) : value{} {
-  value = value.set(key, v);
+
+node_object::node_object(node_key key, node_ptr const& v) {
+  transient_type result;
+  result.set(std::move(key), v);
+  *this = std::move(result).persistent();
 }
 
 bool node_object::operator==(node_object const& other) const noexcept {
-  auto const& left = value;
-  auto const& right = other.value;
-  using value_type = node_object::container_type::value_type;
+  if (size() != other.size()) {
+    return false;
+  }
 
-  return std::equal(left.begin(), left.end(), right.begin(), right.end(),
-                    [](value_type const& left, value_type const& right) {
-                      return left.first == right.first && *left.second == *right.second;
-                    });
+  if (is_compact() && other.is_compact()) {
+    // both are sorted the same way
+    auto const& left = std::get<small_container_type>(value);
+    auto const& right = std::get<small_container_type>(other.value);
+    return std::equal(left.begin(), left.end(), right.begin(), right.end(),
+                      [](member_type const& left, member_type const& right) {
+                        return left.first == right.first && *left.second == *right.second;
+                      });
+  }
+
+  return visit_members([&](auto const& c) {
+    return std::all_of(c.begin(), c.end(), [&](auto const& member) {
+      auto found = other.find(member.first);
+      return found != nullptr && **found == *member.second;
+    });
+  });
 }
 
 void node_array::into_builder(Builder& builder) const {
   ArrayBuilder array_builder(&builder);
-  for (auto const& member : value) {
-    assert(member != nullptr);
-    member->into_builder(builder);
-  }
+  visit_elements([&](auto const& c) {
+    for (auto const& member : c) {
+      assert(member != nullptr);
+      member->into_builder(builder);
+    }
+  });
 }
 
-node_ptr node_array::set_impl(std::string const& key, node_ptr const& v) const {
-  if (auto const parsed_value = string_to_number<std::size_t>(key);
-      parsed_value.has_value()) {
-    size_t const index = parsed_value.value();
-    auto result = value.transient();
-
+node_ptr node_array::set_at(std::size_t index, node_ptr const& v) const {
+  if (is_compact() && index < node_small_container_limit) {
+    auto result = std::get<small_container_type>(value);
     while (index >= result.size()) {
       result.push_back(node::null_node());
     }
+    result[index] = v;
+    return make_node_ptr(node_array{std::move(result)});
+  }
+
+  auto const old_size = size();
+  auto result = visit_elements([](auto const& c) {
+    if constexpr (std::is_same_v<std::decay_t<decltype(c)>, container_type>) {
+      return c.transient();
+    } else {
+      return to_large_array(c).transient();
+    }
+  });
+
+  while (index >= result.size()) {
+    result.push_back(node::null_node());
+  }
+
+  result.set(index, v);
 
-    result.set(index, v);
+  auto next_index = derived_index(*this, [&](auto& i) {
+    if (index < old_size) {
+      i.remove(at(index));
+    }
+    for (auto k = old_size; k < index; k++) {
+      i.add(node::null_node());
+    }
+    i.add(v);
+  });
+  return make_node_ptr(node_array{result.persistent(), std::move(next_index)});
+}
 
-    return make_node_ptr(node_array{result.persistent()});
+node_ptr node_array::set_impl(std::string_view key, node_ptr const& v) const {
+  if (auto const parsed_value = string_to_number<std::size_t>(key);
+      parsed_value.has_value()) {
+    return set_at(parsed_value.value(), v);
   } else {
-    node_object::container_type result;
+    node_object::transient_type result;
 
-    for (size_t i = 0; i < value.size(); ++i) {
-      result = result.set(std::to_string(i), value[i]);
+    for (size_t i = 0; i < size(); ++i) {
+      result.set(node_key{std::to_string(i)}, at(i));
     }
 
-    result = result.set(key, v);
+    result.set(node_key{key}, v);
 
-    return make_node_ptr(node_object{std::move(result)});
+    return make_node_ptr(std::move(result).persistent());
   }
 }
 
 node_array node_array::overlay_impl(node_array const& ov) const noexcept {
-  auto result = value.transient();
-  while (ov.value.size() > result.size()) {
-    result.push_back(node::null_node());
-  }
+  auto const new_size = std::max(size(), ov.size());
 
   // possible values:
   // null - insert null into array
   // nullptr - do not override
-  for (size_t i = 0; i < ov.value.size(); ++i) {
-    auto const& v = ov.value[i];
-    if (v != nullptr) {
-      result.set(i, v);
+  auto const apply = [&](auto& result) {
+    while (new_size > result.size()) {
+      result.push_back(node::null_node());
+    }
+    for (size_t i = 0; i < ov.size(); ++i) {
+      auto const& v = ov.at(i);
+      if (v != nullptr && (i >= size() || v.get() != at(i).get())) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(result)>, small_container_type>) {
+          result[i] = v;
+        } else {
+          result.set(i, v);
+        }
+      }
     }
+  };
+
+  if (new_size <= node_small_container_limit) {
+    auto result = visit_elements([](auto const& c) { return to_small_array(c); });
+    apply(result);
+    return node_array{std::move(result)};
   }
 
+  auto result = visit_elements([](auto const& c) {
+    if constexpr (std::is_same_v<std::decay_t<decltype(c)>, container_type>) {
+      return c.transient();
+    } else {
+      return to_large_array(c).transient();
+    }
+  });
+  apply(result);
   return node_array{result.persistent()};
 }
 
-node_array::node_array(node_ptr const& node) : value{node} {}
+node_array::node_array(node_ptr const& node) : node_array(small_container_type{node}) {}
 
 node_array node_array::prepend(node_ptr const& node) const {
-  return node_array{value.push_front(node)};
+  if (is_compact()) {
+    auto result = small_container_type{};
+    auto const& c = std::get<small_container_type>(value);
+    result.reserve(c.size() + 1);
+    result.push_back(node);
+    result.insert(result.end(), c.begin(), c.end());
+    return node_array{std::move(result)};
+  }
+  return node_array{large_elements().push_front(node),
+                    derived_index(*this, [&](auto& i) { i.add(node); })};
 }
 
 node_array node_array::pop() const {
-  if (value.empty()) {
-    return node_array{value};
+  if (is_compact()) {
+    auto const& c = std::get<small_container_type>(value);
+    if (c.empty()) {
+      return node_array{c};
+    }
+    return node_array{small_container_type(c.begin(), c.end() - 1)};
   }
 
-  return node_array{value.take(value.size() - 1)};
+  auto const& c = large_elements();
+  return node_array{c.take(c.size() - 1), derived_index(*this, [&](auto& i) { i.remove(c.back()); })};
 }
 
 node_array node_array::shift() const {
-  if (value.empty()) {
-    return node_array{value};
+  if (is_compact()) {
+    auto const& c = std::get<small_container_type>(value);
+    if (c.empty()) {
+      return node_array{c};
+    }
+    return node_array{small_container_type(c.begin() + 1, c.end())};
   }
 
-  return node_array{value.drop(1)};
+  auto const& c = large_elements();
+  return node_array{c.drop(1), derived_index(*this, [&](auto& i) { i.remove(c.front()); })};
 }
 
 node_array node_array::push(node_ptr const& node) const {
-  return node_array{value.push_back(node)};
+  if (is_compact()) {
+    auto result = std::get<small_container_type>(value);
+    result.push_back(node);
+    return node_array{std::move(result)};
+  }
+  return node_array{large_elements().push_back(node),
+                    derived_index(*this, [&](auto& i) { i.add(node); })};
 }
 
 bool node_array::operator==(node_array const& other) const noexcept {
-  auto const& left = value;
-  auto const& right = other.value;
+  if (size() != other.size()) {
+    return false;
+  }
 
-  return std::equal(left.begin(), left.end(), right.begin(), right.end(),
-                    [](node_ptr const& left, node_ptr const& right) {
-                      return *left == *right;
-                    });
+  return visit_elements([&](auto const& left) {
+    return other.visit_elements([&](auto const& right) {
+      return std::equal(left.begin(), left.end(), right.begin(), right.end(),
+                        [](node_ptr const& left, node_ptr const& right) {
+                          return *left == *right;
+                        });
+    });
+  });
 }
 
 node_array node_array::erase(node_ptr const& node) const {
-  auto it = std::find_if(value.begin(), value.end(), [&node](node_ptr const& current) {
-    return *node == *current;
-  });
-  if (it == value.end()) {
-    return node_array{value};
+  if (auto const* i = index(); i != nullptr) {
+    auto const* found = i->find(node->hash());
+    if (found == nullptr) {
+      return copy_of(*this);
+    }
+    // the position is still searched, but mostly by comparing cached hashes
+    auto const& c = large_elements();
+    auto it = std::find_if(c.begin(), c.end(), [&node](node_ptr const& current) {
+      return current != nullptr && *node == *current;
+    });
+    if (it == c.end()) {
+      return copy_of(*this);
+    }
+    return node_array{c.erase(std::distance(c.begin(), it)),
+                      derived_index(*this, [&](auto& next) { next.remove(*it); })};
   }
-  auto pos = std::distance(value.begin(), it);
-  return node_array{value.erase(pos)};
+
+  return visit_elements([&](auto const& c) {
+    auto it = std::find_if(c.begin(), c.end(), [&node](node_ptr const& current) {
+      return *node == *current;
+    });
+    if (it == c.end()) {
+      return node_array{c};
+    }
+    auto pos = std::distance(c.begin(), it);
+    if constexpr (std::is_same_v<std::decay_t<decltype(c)>, container_type>) {
+      return node_array{c.erase(pos)};
+    } else {
+      auto result = c;
+      result.erase(result.begin() + pos);
+      return node_array{std::move(result)};
+    }
+  });
 }
 
 bool node_array::contains(node_ptr const& needle) const noexcept {
@@ -255,12 +1281,207 @@ bool node_array::contains(node_ptr const& needle) const noexcept {
     return false;
   }
 
-  return std::any_of(value.begin(), value.end(),
-                     [&needle](node_ptr const& node) { return *needle == *node; });
+  if (auto const* i = index(); i != nullptr) {
+    auto const* found = i->find(needle->hash());
+    if (found == nullptr) {
+      return false;
+    } else if (!found->collided) {
+      return *found->witness == *needle;
+    }
+  }
+
+  return visit_elements([&](auto const& c) {
+    return std::any_of(c.begin(), c.end(),
+                       [&needle](node_ptr const& node) { return *needle == *node; });
+  });
+}
+
+struct node_vpack_blob {
+  std::size_t size;
+
+  [[nodiscard]] std::uint8_t* data() noexcept {
+    return reinterpret_cast<std::uint8_t*>(this + 1);
+  }
+};
+
+namespace {
+
+std::atomic<std::size_t> vpack_cache_limit{64 * 1024 * 1024};
+std::atomic<std::size_t> vpack_cache_min_size{1024};
+std::atomic<std::size_t> vpack_cache_used{0};
+
+// marks a node that was serialized once but is not yet cached
+node_vpack_blob vpack_serialized_once{0};
+
+node_vpack_blob* make_vpack_blob(std::uint8_t const* data, std::size_t size) {
+  auto const limit = vpack_cache_limit.load(std::memory_order_relaxed);
+  if (vpack_cache_used.fetch_add(size, std::memory_order_relaxed) + size > limit) {
+    vpack_cache_used.fetch_sub(size, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  auto memory = ::operator new(sizeof(node_vpack_blob) + size, std::nothrow);
+  if (memory == nullptr) {
+    // the cache is an optimization, failing to fill it is fine
+    vpack_cache_used.fetch_sub(size, std::memory_order_relaxed);
+    return nullptr;
+  }
+  auto blob = new (memory) node_vpack_blob{size};
+  std::memcpy(blob->data(), data, size);
+  return blob;
+}
+
+void free_vpack_blob(node_vpack_blob* blob) noexcept {
+  vpack_cache_used.fetch_sub(blob->size, std::memory_order_relaxed);
+  blob->~node_vpack_blob();
+  ::operator delete(blob);
+}
+
+}  // namespace
+
+void node_vpack_cache::set_limit(std::size_t bytes) noexcept {
+  vpack_cache_limit.store(bytes, std::memory_order_relaxed);
+}
+
+void node_vpack_cache::set_min_size(std::size_t bytes) noexcept {
+  vpack_cache_min_size.store(bytes, std::memory_order_relaxed);
+}
+
+std::size_t node_vpack_cache::limit() noexcept {
+  return vpack_cache_limit.load(std::memory_order_relaxed);
+}
+
+std::size_t node_vpack_cache::min_size() noexcept {
+  return vpack_cache_min_size.load(std::memory_order_relaxed);
+}
+
+std::size_t node_vpack_cache::used() noexcept {
+  return vpack_cache_used.load(std::memory_order_relaxed);
+}
+
+node::~node() {
+  if (auto blob = cached_vpack.load(std::memory_order_relaxed);
+      blob != nullptr && blob != &vpack_serialized_once) {
+    free_vpack_blob(blob);
+  }
+}
+
+namespace {
+
+/*
+ * Nodes released on this thread that are not destroyed yet. A dead node does
+ * not need its hash anymore, the list is linked through `cached_hash`. Both
+ * are trivially destructible, nodes are still released while other thread
+ * locals are destroyed.
+ */
+thread_local node const* pending_destruction = nullptr;
+thread_local bool destroying = false;
+
+}  // namespace
+
+void node_ptr::destroy(node const* n) noexcept {
+  n->cached_hash.store(reinterpret_cast<std::uintptr_t>(pending_destruction),
+                       std::memory_order_relaxed);
+  pending_destruction = n;
+  if (!destroying) {
+    destroy_deferred(std::numeric_limits<std::size_t>::max());
+  }
+}
+
+void node_ptr::defer(node_ptr n) noexcept {
+  auto const was_destroying = std::exchange(destroying, true);
+  n = nullptr;
+  destroying = was_destroying;
+}
+
+std::size_t node_ptr::destroy_deferred(std::size_t budget) noexcept {
+  auto const was_destroying = std::exchange(destroying, true);
+  std::size_t count = 0;
+  std::size_t spent = 0;
+  while (pending_destruction != nullptr) {
+    auto const* n = pending_destruction;
+    auto const cost = 1 + std::visit(visitor{
+                                         [](node_array const& a) { return a.size(); },
+                                         [](node_object const& o) { return o.size(); },
+                                         [](auto const&) { return std::size_t{0}; },
+                                     },
+                                     n->value);
+    if (count > 0 && spent + cost > budget) {
+      break;
+    }
+    pending_destruction =
+        reinterpret_cast<node const*>(n->cached_hash.load(std::memory_order_relaxed));
+    n->~node();
+    node_pool::deallocate(const_cast<node*>(n), sizeof(node));
+    count += 1;
+    spent += cost;
+  }
+  destroying = was_destroying;
+  return count;
+}
+
+bool node_ptr::has_deferred() noexcept { return pending_destruction != nullptr; }
+
+node const* node_ptr::take_deferred() noexcept {
+  return std::exchange(pending_destruction, nullptr);
+}
+
+void node_ptr::adopt_deferred(node const* list) noexcept {
+  while (list != nullptr) {
+    auto const* next = reinterpret_cast<node const*>(list->cached_hash.load(std::memory_order_relaxed));
+    list->cached_hash.store(reinterpret_cast<std::uintptr_t>(pending_destruction),
+                            std::memory_order_relaxed);
+    pending_destruction = list;
+    list = next;
+  }
+}
+
+void node::clear_caches() noexcept {
+  cached_hash.store(0, std::memory_order_relaxed);
+  if (auto blob = cached_vpack.exchange(nullptr, std::memory_order_relaxed);
+      blob != nullptr && blob != &vpack_serialized_once) {
+    free_vpack_blob(blob);
+  }
 }
 
 void node::into_builder(Builder& builder) const {
+  auto const cacheable = builder.options == &arangodb::velocypack::Options::Defaults &&
+                         (std::holds_alternative<node_object>(value) ||
+                          std::holds_alternative<node_array>(value));
+  if (!cacheable) {
+    std::visit([&](auto const& v) { v.into_builder(builder); }, value);
+    return;
+  }
+
+  auto blob = cached_vpack.load(std::memory_order_acquire);
+  if (blob != nullptr && blob != &vpack_serialized_once) {
+    builder.add(Slice(blob->data()));
+    return;
+  }
+
+  // the builder appends to its buffer, after closing the value it is found
+  // at the end
+  auto& buffer = builder.bufferRef();
+  auto const begin = buffer.size();
   std::visit([&](auto const& v) { v.into_builder(builder); }, value);
+  auto const size = buffer.size() - begin;
+  if (size < vpack_cache_min_size.load(std::memory_order_relaxed) ||
+      node_vpack_cache::limit() == 0) {
+    return;
+  }
+
+  // A node is only cached when it is serialized for the second time. After
+  // a write the new path to the root is usually replaced by the next write
+  // before it is read again, copying it into the cache would be wasted.
+  if (blob == nullptr) {
+    cached_vpack.compare_exchange_strong(blob, &vpack_serialized_once, std::memory_order_relaxed);
+  } else if (auto copy = make_vpack_blob(buffer.data() + begin, size); copy != nullptr) {
+    if (!cached_vpack.compare_exchange_strong(blob, copy, std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+      // another thread was faster
+      free_vpack_blob(copy);
+    }
+  }
 }
 
 struct node_overlay_visitor {
@@ -287,6 +1508,13 @@ struct node_overlay_visitor {
   /*
    * If the types are different we always take the overlay value.
    */
+  /*
+   * Slices are materialized before, see `node::overlay`.
+   */
+  node_ptr operator()(node_slice const&, node_slice const&) const noexcept {
+    return ov;
+  }
+
   template <typename T, typename S,
             typename = std::enable_if_t<!std::is_same_v<std::decay_t<T>, std::decay_t<S>>>>
   auto operator()(T const&, S const&) const noexcept {
@@ -295,6 +1523,33 @@ struct node_overlay_visitor {
 };
 
 node_ptr node::overlay(node_ptr const& ov) const {
+  if (ov.get() == this) {
+    return ov;
+  }
+  // only two containers of the same kind are merged, otherwise the overlay
+  // value wins, thus only materialize if it is required
+  auto const* base_slice = std::get_if<node_slice>(&value);
+  auto const* ov_slice = std::get_if<node_slice>(&ov->value);
+  if (base_slice != nullptr || ov_slice != nullptr) {
+    enum class kind { value, object, array };
+    auto const kind_of = [](node const& n) {
+      if (auto const* s = std::get_if<node_slice>(&n.value); s != nullptr) {
+        return s->slice.isObject() ? kind::object : kind::array;
+      } else if (std::holds_alternative<node_object>(n.value)) {
+        return kind::object;
+      } else if (std::holds_alternative<node_array>(n.value)) {
+        return kind::array;
+      }
+      return kind::value;
+    };
+
+    if (auto const k = kind_of(*this); k == kind::value || k != kind_of(*ov)) {
+      return ov;
+    } else if (base_slice != nullptr) {
+      return base_slice->materialize()->overlay(ov);
+    }
+    return overlay(ov_slice->materialize());
+  }
   return std::visit(node_overlay_visitor{ov}, value, ov->value);
 }
 
@@ -315,22 +1570,28 @@ struct node_set_visitor {
   template <typename T>
   auto operator()(node_container<T> const& c) const -> node_ptr {
     auto& [head, tail] = path;
+    // look up the key only once for both get and set
+    auto const key = typename T::key_type{head};
     // head and tail are _not_ variables but local name bindings and
     // thus can not be captured by a lambda, except like doing so:
-    auto new_child = [&, head = head, tail = tail]() {
-      if (auto child = c.get(head); child != nullptr) {
+    auto new_child = [&, tail = tail]() {
+      if (auto child = c.get(key); child != nullptr) {
         return child->set(tail, node);
       }
       return node::node_at_path(tail, node);
     }();
 
-    return c.set(head, new_child);
+    return c.set(key, new_child);
   }
 
   template <typename T>
   auto operator()(node_value<T> const&) const -> node_ptr {
     return node::node_at_path(path, node);
   }
+
+  auto operator()(node_slice const& s) const -> node_ptr {
+    return s.materialize()->set(path, node);
+  }
 };
 
 node_ptr node::set(const node::path_slice& path, node_ptr const& node) const {
@@ -348,35 +1609,420 @@ node_ptr node::node_at_path(immut_list<std::string> const& path, node_ptr const&
 
   auto& [head, tail] = path;
 
-  return make_node_ptr(node_object{head, node_at_path(tail, node)});
+  return make_node_ptr(node_object{node_key{head}, node_at_path(tail, node)});
+}
+
+namespace {
+
+/*
+ * Same as node_set_visitor for flat paths. The segments carry their hash and
+ * parsed index, thus nothing is hashed or parsed twice.
+ */
+struct node_flat_set_visitor {
+  node_path_view path;
+  node_ptr const& node;
+
+  auto operator()(node_object const& o) const -> node_ptr {
+    auto const& head = path.head();
+    auto new_child = [&] {
+      if (auto child = o.find(head.name(), head.hash); child != nullptr) {
+        return (*child)->set(path.tail(), node);
+      }
+      return node::node_at_path(path.tail(), node);
+    }();
+    return o.set(head.key(), new_child);
+  }
+
+  auto operator()(node_array const& a) const -> node_ptr {
+    auto const& head = path.head();
+    if (!head.is_index()) {
+      // turns the array into an object, see node_array::set_impl
+      return a.set(head.name(), [&] {
+        return node::node_at_path(path.tail(), node);
+      }());
+    }
+    auto new_child = [&] {
+      if (head.index < a.size()) {
+        return a.at(head.index)->set(path.tail(), node);
+      }
+      return node::node_at_path(path.tail(), node);
+    }();
+    return a.set_at(head.index, new_child);
+  }
+
+  template <typename T>
+  auto operator()(node_value<T> const&) const -> node_ptr {
+    return node::node_at_path(path, node);
+  }
+
+  auto operator()(node_slice const& s) const -> node_ptr {
+    return s.materialize()->set(path, node);
+  }
+};
+
+}  // namespace
+
+node_ptr node::set(node_path_view path, node_ptr const& node) const {
+  if (path.empty()) {
+    return node;
+  }
+
+  return std::visit(node_flat_set_visitor{path, node}, value);
+}
+
+node_ptr node::node_at_path(node_path_view path, node_ptr const& node) {
+  if (path.empty()) {
+    return node;
+  }
+
+  return make_node_ptr(node_object{path.head().key(), node_at_path(path.tail(), node)});
+}
+
+namespace {
+
+using path_pointer = immut_list<std::string>::element_pointer;
+
+/*
+ * The transform engine is written against a cursor into the remaining path,
+ * thus the same code serves path_slices and node_paths.
+ */
+struct list_cursor {
+  path_pointer const* rest;
+
+  [[nodiscard]] bool at_end() const noexcept { return *rest == nullptr; }
+  [[nodiscard]] std::string_view name() const noexcept { return (*rest)->value; }
+  [[nodiscard]] node_key key() const { return node_key{name()}; }
+  [[nodiscard]] std::optional<std::size_t> index() const noexcept {
+    return string_to_number<std::size_t>(name());
+  }
+  [[nodiscard]] list_cursor next() const noexcept { return {&(*rest)->next}; }
+  [[nodiscard]] node::path_slice path() const { return node::path_slice{*rest}; }
+};
+
+struct flat_cursor {
+  node_path_view rest;
+
+  [[nodiscard]] bool at_end() const noexcept { return rest.empty(); }
+  [[nodiscard]] std::string_view name() const noexcept { return rest.head().name(); }
+  [[nodiscard]] node_key key() const { return rest.head().key(); }
+  [[nodiscard]] std::optional<std::size_t> index() const noexcept {
+    if (rest.head().is_index()) {
+      return rest.head().index;
+    }
+    return std::nullopt;
+  }
+  [[nodiscard]] flat_cursor next() const noexcept { return {rest.tail()}; }
+  [[nodiscard]] node_path_view path() const noexcept { return rest; }
+};
+
+/*
+ * A transformation that still has to descend along `rest`. An empty `rest`
+ * targets the current node.
+ */
+template <typename C>
+struct pending_transformation {
+  C rest;
+  node::transformation const* op;
+};
+
+template <typename C>
+using pending_list = std::vector<pending_transformation<C>>;
+
+template <typename C>
+node_ptr transform_node(node_ptr current, pending_list<C> const& ops);
+
+template <typename C>
+struct child_transformations {
+  // points at the segment that selects the child
+  C head;
+  pending_list<C> ops;
+};
+
+/*
+ * Groups the transformations in [begin, end) by their next path segment,
+ * keeping their relative order.
+ */
+template <typename C>
+std::vector<child_transformations<C>> group_by_child(pending_list<C> const& ops,
+                                                     std::size_t begin, std::size_t end) {
+  std::vector<child_transformations<C>> groups;
+  std::unordered_map<std::string_view, std::size_t> index;
+  for (auto i = begin; i < end; i++) {
+    auto const& head = ops[i].rest;
+    auto const key = head.name();
+
+    std::size_t group = groups.size();
+    if (groups.size() < 8) {
+      // few groups, a linear scan is cheaper than hashing
+      for (std::size_t g = 0; g < groups.size(); g++) {
+        if (groups[g].head.name() == key) {
+          group = g;
+          break;
+        }
+      }
+    } else {
+      if (index.empty()) {
+        for (std::size_t g = 0; g < groups.size(); g++) {
+          index.emplace(groups[g].head.name(), g);
+        }
+      }
+      group = index.emplace(key, groups.size()).first->second;
+    }
+
+    if (group == groups.size()) {
+      groups.push_back(child_transformations<C>{head, {}});
+    }
+    groups[group].ops.push_back(pending_transformation<C>{head.next(), ops[i].op});
+  }
+  return groups;
+}
+
+/*
+ * Applies the transformations in [begin, end), all of them target a
+ * descendant of `current`. Every child is transformed once and `current` is
+ * rebuilt once.
+ */
+template <typename C>
+node_ptr transform_children(node_ptr const& current, pending_list<C> const& ops,
+                            std::size_t begin, std::size_t end) {
+  auto const transform_object = [&](node_object::transient_type result) {
+    for (auto& group : group_by_child(ops, begin, end)) {
+      auto key = group.head.key();
+      auto const* child = result.find(key);
+      auto new_child = transform_node(child == nullptr ? nullptr : *child, group.ops);
+      result.set(std::move(key), std::move(new_child));
+    }
+    return make_node_ptr(std::move(result).persistent());
+  };
+
+  auto const transform_array = [&](node_array const& array) {
+    // Indexes that are out of bounds grow the array and segments that are
+    // not an index turn it into an object. Both depend on the order of the
+    // transformations, so those are applied one by one.
+    auto const all_in_bounds = std::all_of(ops.begin() + begin, ops.begin() + end, [&](auto const& t) {
+      auto const index = t.rest.index();
+      return index.has_value() && index.value() < array.size();
+    });
+    if (!all_in_bounds) {
+      // only the first set copies the spine, later ones edit that copy
+      node_editor result{current};
+      for (auto i = begin; i < end; i++) {
+        auto const path = ops[i].rest.path();
+        result.set(path, (*ops[i].op)(result.root()->get(path)));
+      }
+      return std::move(result).finish();
+    }
+
+    return array.visit_elements([&](auto const& c) {
+      using container = std::decay_t<decltype(c)>;
+      auto result = [&] {
+        if constexpr (std::is_same_v<container, node_array::container_type>) {
+          return c.transient();
+        } else {
+          return c;
+        }
+      }();
+      for (auto& group : group_by_child(ops, begin, end)) {
+        auto const index = group.head.index().value();
+        auto new_child = transform_node(array.at(index), group.ops);
+        if constexpr (std::is_same_v<container, node_array::container_type>) {
+          result.set(index, std::move(new_child));
+        } else {
+          result[index] = std::move(new_child);
+        }
+      }
+      if constexpr (std::is_same_v<container, node_array::container_type>) {
+        return make_node_ptr(node_array{result.persistent()});
+      } else {
+        return make_node_ptr(node_array{std::move(result)});
+      }
+    });
+  };
+
+  if (current == nullptr) {
+    // like `set`, missing nodes are created as objects
+    return transform_object({});
+  }
+
+  return current->visit(visitor{
+      [&](node_object const& object) { return transform_object(object.transient()); },
+      [&](node_array const& array) { return transform_array(array); },
+      // values are replaced by an object, like `set` does
+      [&](auto const&) { return transform_object({}); },
+  });
+}
+
+template <typename C>
+node_ptr transform_node(node_ptr current, pending_list<C> const& ops) {
+  std::size_t i = 0;
+  while (i < ops.size()) {
+    if (ops[i].rest.at_end()) {
+      current = (*ops[i].op)(current);
+      i += 1;
+      continue;
+    }
+
+    auto j = i;
+    while (j < ops.size() && !ops[j].rest.at_end()) {
+      j += 1;
+    }
+    current = transform_children(current, ops, i, j);
+    i = j;
+  }
+  return current;
 }
 
+}  // namespace
+
 node_ptr node::transform(std::vector<std::pair<path_slice, transformation>> const& operations) const {
-  auto curNode = node_ptr{shared_from_this()};
+  pending_list<list_cursor> ops;
+  ops.reserve(operations.size());
+  for (auto const& [path, op] : operations) {
+    ops.push_back(pending_transformation<list_cursor>{list_cursor{&path.head}, &op});
+  }
+
+  return transform_node(node_ptr{this}, ops);
+}
+
+node_ptr node::transform(std::vector<std::pair<node_path, transformation>> const& operations) const {
+  pending_list<flat_cursor> ops;
+  ops.reserve(operations.size());
+  for (auto const& [path, op] : operations) {
+    ops.push_back(pending_transformation<flat_cursor>{flat_cursor{path.view()}, &op});
+  }
+
+  return transform_node(node_ptr{this}, ops);
+}
 
-  for (auto const& it : operations) {
-    auto& [path, op] = it;
-    curNode = curNode->set(path, op(get(path)));
+namespace {
+
+/*
+ * The requested paths of an extract, merged into a trie. The trie nodes are
+ * stored in preorder, the children of a node follow it directly and `end` is
+ * the index past its subtree. Paths that are covered by a shorter path are
+ * dropped, thus a covered node has no children.
+ */
+struct extract_trie {
+  struct trie_node {
+    std::string_view name;
+    std::size_t end = 0;
+    bool covered = false;
+  };
+
+  std::vector<trie_node> nodes;
+
+  template <typename L>
+  explicit extract_trie(L const& list) {
+    std::vector<node::path_slice const*> paths;
+    for (auto const& path : list) {
+      paths.push_back(&path);
+    }
+    // sorted paths share their prefix with the previous one, and a path
+    // comes before all paths it covers
+    std::sort(paths.begin(), paths.end(), [](auto const* a, auto const* b) {
+      auto x = a->head.get(), y = b->head.get();
+      for (; x != nullptr && y != nullptr; x = x->next.get(), y = y->next.get()) {
+        if (auto const c = x->value.compare(y->value); c != 0) {
+          return c < 0;
+        }
+      }
+      return x == nullptr && y != nullptr;
+    });
+
+    nodes.emplace_back();
+    // nodes along the previous path, starting with the root
+    std::vector<std::size_t> stack{0};
+    auto const close = [&](std::size_t depth) {
+      while (stack.size() > depth) {
+        nodes[stack.back()].end = nodes.size();
+        stack.pop_back();
+      }
+    };
+
+    for (auto const* path : paths) {
+      // length of the prefix shared with the previous path
+      std::size_t common = 0;
+      auto e = path->head.get();
+      for (; e != nullptr && common + 1 < stack.size(); e = e->next.get()) {
+        if (nodes[stack[common + 1]].name != e->value) {
+          break;
+        }
+        common += 1;
+      }
+      auto const covered = std::any_of(stack.begin(), stack.begin() + common + 1,
+                                       [&](auto n) { return nodes[n].covered; });
+      if (covered) {
+        continue;
+      }
+
+      close(common + 1);
+      for (; e != nullptr; e = e->next.get()) {
+        stack.push_back(nodes.size());
+        nodes.push_back(trie_node{e->value});
+      }
+      nodes[stack.back()].covered = true;
+    }
+    close(0);
   }
+};
 
-  return curNode;
+/*
+ * Builds the object for trie node `index`. Covered children are taken from
+ * `source` by pointer, all other children are objects again.
+ */
+template <typename F>
+node_ptr extract_node(node_ptr const& source, extract_trie const& trie, std::size_t index,
+                      F const& child_of) {
+  node_object::transient_type result;
+  for (auto i = index + 1; i < trie.nodes[index].end; i = trie.nodes[i].end) {
+    auto const& trie_child = trie.nodes[i];
+    auto key = node_key::find(trie_child.name);
+    auto child = source == nullptr ? nullptr : child_of(*source, trie_child.name, key);
+    if (!trie_child.covered) {
+      child = extract_node(child, trie, i, child_of);
+    } else if (child == nullptr) {
+      continue;
+    }
+    if (!key) {
+      key = node_key{trie_child.name};
+    }
+    result.set(std::move(key), std::move(child));
+  }
+  return make_node_ptr(std::move(result).persistent());
 }
 
+}  // namespace
+
 template <typename L>
 node_ptr node::extract(const L& list) const {
-  // This is a possible implementation, but not optimized
-  auto node = empty_object();
-  for (auto const& path : list) {
-    node = node->set(path, get(path));
+  auto const trie = extract_trie{list};
+  if (trie.nodes.front().covered) {
+    return node_ptr{this};
   }
-  return node;
+
+  auto const child_of = [](node const& n, std::string_view name, node_key const& key) {
+    return std::visit(visitor{
+                          [&](node_object const& o) -> node_ptr {
+                            // a name that is not interned is not a member
+                            return key ? o.get(key) : nullptr;
+                          },
+                          [&](node_array const& a) -> node_ptr { return a.get(name); },
+                          [&](node_slice const& s) -> node_ptr {
+                            return s.get(path_slice{std::string{name}});
+                          },
+                          [](auto const&) -> node_ptr { return nullptr; },
+                      },
+                      n.value);
+  };
+  return extract_node(node_ptr{this}, trie, 0, child_of);
 }
 
+template node_ptr node::extract(std::vector<node::path_slice> const&) const;
+
 std::ostream& operator<<(std::ostream& os, node const& n) {
-  // let keep things simple
-  arangodb::velocypack::Builder builder;
-  n.into_builder(builder);
-  os << builder.toJson();
+  // same output as velocypack's toJson
+  node_json_ostream_sink sink{os};
+  write_json(n, sink, node_json_options{true, false});
   return os;
 }
 
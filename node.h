@@ -1,10 +1,13 @@
 #ifndef AGENCY_NODE_H
 #define AGENCY_NODE_H
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <variant>
 #include <vector>
 
+#include "immer/box.hpp"
 #include "immer/flex_vector.hpp"
 #include "immer/map.hpp"
 
@@ -12,6 +15,9 @@
 #include "velocypack/Slice.h"
 
 #include "helper-immut.h"
+#include "node-allocator.h"
+#include "node-key.h"
+#include "node-path.h"
 
 struct null_type {};
 
@@ -69,21 +75,65 @@ using node_null = node_value<null_type>;
 
 struct node_array;
 struct node_object;
+struct node_slice;
 
 struct node;
-
-class node_ptr : private std::shared_ptr<node const> {
+struct node_diff;
+struct node_memory_usage;
+class node_work_pool;
+
+/*
+ * Intrusive reference counted pointer to an immutable node. The count lives in
+ * the node itself, see `node_refcount`.
+ */
+class node_ptr {
  public:
-  using std::shared_ptr<node const>::shared_ptr;
-  using std::shared_ptr<node const>::operator*;
-  using std::shared_ptr<node const>::operator->;
-  using std::shared_ptr<node const>::operator=;
-  using std::shared_ptr<node const>::operator bool;
-
-  explicit node_ptr(std::shared_ptr<node const>&& r) noexcept
-      : std::shared_ptr<node const>(std::move(r)){};
-  explicit node_ptr(std::shared_ptr<node const> const& r) noexcept
-      : std::shared_ptr<node const>(r){};
+  node_ptr() noexcept = default;
+  node_ptr(std::nullptr_t) noexcept {}
+  explicit node_ptr(node const* p) noexcept;
+
+  node_ptr(node_ptr const& other) noexcept;
+  node_ptr(node_ptr&& other) noexcept : ptr(other.ptr) { other.ptr = nullptr; }
+  node_ptr& operator=(node_ptr const& other) noexcept;
+  node_ptr& operator=(node_ptr&& other) noexcept;
+  ~node_ptr();
+
+  [[nodiscard]] node const& operator*() const noexcept { return *ptr; }
+  [[nodiscard]] node const* operator->() const noexcept { return ptr; }
+  [[nodiscard]] node const* get() const noexcept { return ptr; }
+  explicit operator bool() const noexcept { return ptr != nullptr; }
+
+  [[nodiscard]] std::uint32_t use_count() const noexcept;
+
+  void swap(node_ptr& other) noexcept { std::swap(ptr, other.ptr); }
+
+ private:
+  friend class node_reclaimer;
+
+  /*
+   * Destroys a node after its last reference was dropped. The nodes released
+   * by its destructor are queued and destroyed afterwards by the same loop,
+   * thus dropping a deep tree does not recurse.
+   */
+  static void destroy(node const* n) noexcept;
+
+  // drops `n`, its nodes are queued until `destroy_deferred` is called
+  static void defer(node_ptr n) noexcept;
+
+  /*
+   * Destroys nodes queued on this thread, including the ones released
+   * meanwhile, until the next one would exceed `budget`, returns their
+   * number. A node costs one plus the number of its elements or members, at
+   * least one node is destroyed.
+   */
+  static std::size_t destroy_deferred(std::size_t budget) noexcept;
+  [[nodiscard]] static bool has_deferred() noexcept;
+
+  // hands the nodes queued on this thread over to another one
+  [[nodiscard]] static node const* take_deferred() noexcept;
+  static void adopt_deferred(node const* list) noexcept;
+
+  node const* ptr = nullptr;
 };
 
 bool operator==(node_ptr const& other, std::nullptr_t);
@@ -92,24 +142,23 @@ bool operator!=(node_ptr const& other, std::nullptr_t);
 bool operator!=(std::nullptr_t, node_ptr const& other);
 
 template <typename... T>
-auto inline make_node_ptr(T&&... t) -> node_ptr {
-  return node_ptr{std::make_shared<node const>(std::forward<T>(t)...)};
-}
+auto make_node_ptr(T&&... t) -> node_ptr;
 
 using node_value_variant =
-    std::variant<node_string, node_double, node_bool, node_array, node_object, node_null>;
+    std::variant<node_string, node_double, node_bool, node_array, node_object, node_null, node_slice>;
 
 template <typename T>
 struct node_container : public node_type<T> {
   template <typename K>
   [[nodiscard]] node_ptr get(K&& key) const
-      noexcept(std::is_nothrow_invocable_v<decltype(&T::get_impl), T, decltype(std::forward<K>(key))>) {
+      noexcept(noexcept(std::declval<T const&>().get_impl(std::forward<K>(key)))) {
     return node_type<T>::self().get_impl(std::forward<K>(key));
   };
 
-  [[nodiscard]] node_ptr set(std::string const& key, node_ptr const& v) const
-      noexcept(std::is_nothrow_invocable_v<decltype(&T::set_impl), T, std::string const&, node_ptr const&>) {
-    return node_type<T>::self().set_impl(key, v);
+  template <typename K>
+  [[nodiscard]] node_ptr set(K&& key, node_ptr const& v) const
+      noexcept(noexcept(std::declval<T const&>().set_impl(std::forward<K>(key), v))) {
+    return node_type<T>::self().set_impl(std::forward<K>(key), v);
   };
 
   [[nodiscard]] T overlay(node_container<T> const& t) const
@@ -131,22 +180,74 @@ template <typename T>
 constexpr const bool node_container_is_nothrow_overlay =
     std::is_nothrow_invocable_v<decltype(&T::overlay), node_container<T>, node_container<T> const&>;
 
+/*
+ * Containers with at most `node_small_container_limit` elements are stored
+ * as a flat vector, larger ones as immer HAMT or RRB vector. A container is
+ * promoted as soon as it grows beyond the limit and only demoted again once
+ * it shrank to half of the limit. Set to zero to always use immer containers.
+ */
+#ifndef AGENCY_NODE_SMALL_CONTAINER_LIMIT
+#define AGENCY_NODE_SMALL_CONTAINER_LIMIT 8
+#endif
+
+constexpr std::size_t node_small_container_limit = AGENCY_NODE_SMALL_CONTAINER_LIMIT;
+
 struct node_array final : public node_container<node_array> {
-  using container_type = immer::flex_vector<node_ptr>;
-  container_type value;
+  using container_type = immer::flex_vector<node_ptr, node_memory_policy>;
+  using small_container_type = std::vector<node_ptr, node_pool_allocator<node_ptr>>;
 
-  node_array() noexcept(std::is_nothrow_constructible_v<container_type>) = default;
-  explicit node_array(container_type value) : value(std::move(value)) {}
+  /*
+   * Large arrays are boxed together with an index of their element hashes,
+   * thus `contains` is a lookup and `erase` of a missing value does not scan
+   * the array. The index is built by the first query on arrays with at least
+   * `index_size_limit` elements and is then maintained by the arrays derived
+   * with `push`, `prepend`, `pop`, `shift`, `erase` and `set_at`. Other
+   * changes drop it. Boxing keeps the node as small as the largest other
+   * value.
+   */
+  static constexpr std::size_t index_size_limit = 32;
+  struct element_index;
+  struct large_type {
+    container_type elements;
+    // built on demand by const queries, owned by this array
+    mutable std::atomic<element_index const*> index = nullptr;
+
+    explicit large_type(container_type elements) noexcept;
+    large_type(container_type elements, std::unique_ptr<element_index const> index) noexcept;
+    large_type(large_type&&) noexcept;
+    large_type& operator=(large_type&&) noexcept;
+    ~large_type();
+
+    // for changes that do not maintain the index
+    void drop_index() noexcept;
+  };
+  using large_box = immer::box<large_type, node_memory_policy>;
+
+  std::variant<small_container_type, large_box> value;
+
+  node_array() noexcept = default;
+  explicit node_array(container_type value);
+  node_array(container_type value, std::unique_ptr<element_index const> index);
+  explicit node_array(small_container_type value);
   explicit node_array(node_ptr const&);
 
   node_array(node_array const&) = delete;
   node_array& operator=(node_array const&) = delete;
-  node_array(node_array&&) noexcept(std::is_nothrow_move_constructible_v<container_type>) = default;
-  node_array& operator=(node_array&&) noexcept(std::is_nothrow_move_assignable_v<container_type>) = default;
+  node_array(node_array&&) noexcept = default;
+  node_array& operator=(node_array&&) noexcept = default;
 
-  [[nodiscard]] node_ptr get_impl(std::string const& key) const noexcept;
+  // arrays are indexed by the plain segment
+  using key_type = std::string_view;
+
+  [[nodiscard]] node_ptr get_impl(std::string_view key) const noexcept;
+  [[nodiscard]] node_ptr get_impl(node_key const& key) const noexcept {
+    return get_impl(key.view());
+  }
   [[nodiscard]] node_array overlay_impl(node_array const& ov) const noexcept;
-  [[nodiscard]] node_ptr set_impl(std::string const& key, node_ptr const& v) const;
+  [[nodiscard]] node_ptr set_impl(std::string_view key, node_ptr const& v) const;
+  [[nodiscard]] node_ptr set_impl(node_key const& key, node_ptr const& v) const {
+    return set_impl(key.view(), v);
+  }
   void into_builder(arangodb::velocypack::Builder& builder) const;
 
   [[nodiscard]] node_array push(node_ptr const&) const;
@@ -157,58 +258,252 @@ struct node_array final : public node_container<node_array> {
 
   [[nodiscard]] bool contains(node_ptr const& value) const noexcept;
 
+  [[nodiscard]] std::size_t size() const noexcept;
+  [[nodiscard]] bool empty() const noexcept { return size() == 0; }
+  [[nodiscard]] node_ptr const& at(std::size_t i) const noexcept;
+  [[nodiscard]] bool is_compact() const noexcept { return value.index() == 0; }
+
+  // sets element `index`, the array is filled up with nulls if required
+  [[nodiscard]] node_ptr set_at(std::size_t index, node_ptr const& v) const;
+
+  /*
+   * Calls `f` with the underlying container, either representation is an
+   * iterable range of node_ptrs.
+   */
+  template <typename F>
+  decltype(auto) visit_elements(F&& f) const {
+    return std::visit([&](auto const& c) -> decltype(auto) { return f(elements_of(c)); }, value);
+  }
+
+  [[nodiscard]] container_type const& large_elements() const noexcept {
+    return std::get<large_box>(value)->elements;
+  }
+
   [[nodiscard]] bool operator==(node_array const&) const noexcept;
+
+ private:
+  static small_container_type const& elements_of(small_container_type const& c) noexcept {
+    return c;
+  }
+  static container_type const& elements_of(large_box const& c) noexcept {
+    return c->elements;
+  }
+
+  [[nodiscard]] element_index const* index() const noexcept;
 };
 
 struct node_object final : public node_container<node_object> {
-  using container_type = immer::map<std::string, node_ptr>;
+  using key_type = node_key;
+  using container_type =
+      immer::map<node_key, node_ptr, node_key_hash, node_key_equal, node_memory_policy>;
+  using member_type = std::pair<node_key, node_ptr>;
+  // sorted by `member_less`
+  using small_container_type = std::vector<member_type, node_pool_allocator<member_type>>;
 
-  container_type value;
+  std::variant<small_container_type, container_type> value;
 
-  node_object() noexcept(std::is_nothrow_constructible_v<container_type>) = default;
-  explicit node_object(container_type value) : value(std::move(value)) {}
-  explicit node_object(std::string const& key, node_ptr const& v);
+  node_object() noexcept = default;
+  explicit node_object(container_type value);
+  explicit node_object(node_key key, node_ptr const& v);
 
   node_object(node_object const&) = delete;
   node_object& operator=(node_object const&) = delete;
-  node_object(node_object&&) noexcept(std::is_nothrow_move_constructible_v<container_type>) = default;
-  node_object& operator=(node_object&&) noexcept(std::is_nothrow_move_assignable_v<container_type>) = default;
+  node_object(node_object&&) noexcept = default;
+  node_object& operator=(node_object&&) noexcept = default;
 
   [[nodiscard]] node_object overlay_impl(node_object const& ov) const noexcept;
-  [[nodiscard]] node_ptr get_impl(std::string const& key) const noexcept;
-  [[nodiscard]] node_ptr set_impl(std::string const& key, node_ptr const& v) const;
+  [[nodiscard]] node_ptr get_impl(std::string_view key) const noexcept;
+  [[nodiscard]] node_ptr get_impl(node_key const& key) const noexcept;
+  [[nodiscard]] node_ptr set_impl(std::string_view key, node_ptr const& v) const;
+  [[nodiscard]] node_ptr set_impl(node_key const& key, node_ptr const& v) const;
   void into_builder(arangodb::velocypack::Builder& builder) const;
 
+  [[nodiscard]] std::size_t size() const noexcept;
+  [[nodiscard]] bool empty() const noexcept { return size() == 0; }
+  [[nodiscard]] node_ptr const* find(node_key const& key) const noexcept;
+  // for names that are not interned, reads the intern table only for long names
+  [[nodiscard]] node_ptr const* find(std::string_view name, std::uint64_t hash) const noexcept;
+  [[nodiscard]] bool is_compact() const noexcept { return value.index() == 0; }
+
+  /*
+   * Calls `f` with the underlying container, either representation is an
+   * iterable range of key/node_ptr pairs.
+   */
+  template <typename F>
+  decltype(auto) visit_members(F&& f) const {
+    return std::visit(std::forward<F>(f), value);
+  }
+
+  static bool member_less(node_key const& left, node_key const& right) noexcept {
+    return left.hash() < right.hash() ||
+           (left.hash() == right.hash() && left.view() < right.view());
+  }
+
+  /*
+   * Mutable builder for objects. Starts out flat and switches to the HAMT
+   * once the size limit is exceeded.
+   */
+  class transient_type {
+   public:
+    transient_type() noexcept = default;
+    explicit transient_type(node_object const& base);
+    // takes over the members of `base`, which is left empty
+    explicit transient_type(node_object&& base) noexcept;
+
+    [[nodiscard]] node_ptr const* find(node_key const& key) const noexcept;
+    // setting `nullptr` removes the key
+    void set(node_key key, node_ptr v);
+    // stores `v` even if it is `nullptr`, i.e. a deletion in an overlay
+    void put(node_key key, node_ptr v);
+    void erase(node_key const& key);
+    [[nodiscard]] std::size_t size() const noexcept;
+
+    [[nodiscard]] node_object persistent() &&;
+
+   private:
+    void promote();
+
+    bool compact = true;
+    small_container_type small;
+    container_type large;
+  };
+
+  [[nodiscard]] transient_type transient() const {
+    return transient_type{*this};
+  }
+
   [[nodiscard]] bool operator==(node_object const&) const noexcept;
+
+ private:
+  explicit node_object(small_container_type value) : value(std::move(value)) {}
+};
+
+/*
+ * A velocypack object or array that was not yet turned into nodes. It shares
+ * ownership of the buffer it points into. Reads descend directly into the
+ * slice and `into_builder` copies the raw slice. Modifications materialize
+ * one level at a time, the children of a materialized container are again
+ * node_slices. Scalars are never stored as node_slice.
+ *
+ * `node::visit` never passes a node_slice to the visitor, it materializes
+ * the value first.
+ */
+struct node_slice final {
+  using buffer_ptr = std::shared_ptr<arangodb::velocypack::Buffer<uint8_t>>;
+
+  buffer_ptr buffer;
+  arangodb::velocypack::Slice slice;
+
+  node_slice(buffer_ptr buffer, arangodb::velocypack::Slice slice) noexcept
+      : buffer(std::move(buffer)), slice(slice) {}
+
+  node_slice(node_slice const&) = delete;
+  node_slice& operator=(node_slice const&) = delete;
+  node_slice(node_slice&&) noexcept = default;
+  node_slice& operator=(node_slice&&) noexcept = default;
+
+  // allocates the node for the result
+  [[nodiscard]] node_ptr get(immut_list<std::string> const& path) const;
+  [[nodiscard]] node_ptr get(node_path_view path) const;
+
+  /*
+   * Returns the equivalent object or array node, its children are node_slices
+   * or scalar values.
+   */
+  [[nodiscard]] node_ptr materialize() const;
+
+  void into_builder(arangodb::velocypack::Builder& builder) const {
+    builder.add(slice);
+  }
+
+  /*
+   * Structural comparison, numbers are compared as doubles like node_double.
+   */
+  [[nodiscard]] bool equals(node const& other) const noexcept;
+  [[nodiscard]] bool operator==(node_slice const& other) const noexcept;
+  [[nodiscard]] bool operator!=(node_slice const& other) const noexcept {
+    return !(*this == other);
+  }
+
+  // same as `node_array::contains` without materializing, false for objects
+  [[nodiscard]] bool contains(node_ptr const& needle) const noexcept;
+};
+
+/*
+ * Limits of the serialization cache. `node::into_builder` keeps the
+ * velocypack of objects and arrays of at least `min_size` bytes attached to
+ * the node, later calls copy it with a single memcpy. Nodes are immutable,
+ * thus an entry is valid until the node is destroyed. No entries are added
+ * while `used` would exceed `limit`, a limit of zero disables the cache.
+ * Only builders with the default options use the cache.
+ */
+struct node_vpack_cache {
+  static void set_limit(std::size_t bytes) noexcept;
+  static void set_min_size(std::size_t bytes) noexcept;
+  [[nodiscard]] static std::size_t limit() noexcept;
+  [[nodiscard]] static std::size_t min_size() noexcept;
+  [[nodiscard]] static std::size_t used() noexcept;
 };
 
+struct node_vpack_blob;
+
 static_assert(node_container_is_nothrow_get<node_array>);
 static_assert(node_container_is_nothrow_overlay<node_array>);
 static_assert(node_container_is_nothrow_get<node_object>);
 static_assert(node_container_is_nothrow_overlay<node_object>);
 
-struct node : public std::enable_shared_from_this<node> {
+struct node {
  private:
+  mutable node_refcount refcount;
+  // zero until computed, see `hash`
+  mutable std::atomic<std::uint64_t> cached_hash{0};
+  // serialized velocypack owned by this node, see `node_vpack_cache`
+  mutable std::atomic<node_vpack_blob*> cached_vpack{nullptr};
   node_value_variant value;
 
+  /*
+   * Nodes are only created by `make_node_ptr`, thus they always live on the
+   * node pool and are owned by node_ptrs.
+   */
+  template <typename T>
+  explicit node(T&& v) : value(std::forward<T>(v)){};
+
+  template <typename... T>
+  friend auto make_node_ptr(T&&... t) -> node_ptr;
+  friend class node_ptr;
+  friend struct node_slice;
+  friend class node_json_writer;
+  friend class node_editor;
+  friend class node_memory_walker;
+  friend class node_interner;
+  friend class node_overlay_view;
+  friend class node_transaction_plan;
+
+  // called before a node is changed in place
+  void clear_caches() noexcept;
+
  public:
   using path_slice = immut_list<std::string>;
 
+  ~node();
+
   node(node const&) = delete;
   node(node&&) = delete;
   node& operator=(node const&) = delete;
   node& operator=(node&&) = delete;
 
-  /*
-   * TODO this constructor needs to be public because of make_shared. Maybe
-   * we can add some friends to make this constructor private. (and only allow
-   * shared_ptr nodes)
-   */
-  template <typename T>
-  explicit node(T&& v) : value(std::forward<T>(v)){};
-
   template <typename F>
   auto visit(F&& f) const {
+    if (auto const* s = std::get_if<node_slice>(&value); s != nullptr) {
+      auto const materialized = s->materialize();
+      return std::visit(std::forward<F>(f), materialized->value);
+    }
+    return std::visit(std::forward<F>(f), value);
+  }
+
+  // same as `visit`, but a lazy node is passed as node_slice
+  template <typename F>
+  auto visit_lazy(F&& f) const {
     return std::visit(std::forward<F>(f), value);
   }
 
@@ -218,32 +513,72 @@ struct node : public std::enable_shared_from_this<node> {
   }
 
   static node_ptr from_slice(arangodb::velocypack::Slice s);
+
+  /*
+   * Same as `from_slice`, large subtrees are imported in parallel on `pool`.
+   * Falls back to the serial import if reference counts are not atomic.
+   */
+  static node_ptr from_slice(arangodb::velocypack::Slice s, node_work_pool& pool);
+
+  /*
+   * Like `from_slice` but objects and arrays are kept as node_slice, see
+   * there. The first variant copies the slice into a new buffer, the second
+   * one shares `buffer`.
+   */
+  static node_ptr lazy_from_slice(arangodb::velocypack::Slice s);
+  static node_ptr lazy_from_buffer(node_slice::buffer_ptr buffer);
   static node_ptr const& empty_object() { return empty_object_node; };
   static node_ptr const& null_node() { return null_value_node; }
   static node_ptr const& empty_array() { return empty_array_node; }
   static node_ptr const& node_or_null(node_ptr const& node);
 
   node_ptr static node_at_path(immut_list<std::string> const& path, node_ptr const& node);
+  node_ptr static node_at_path(node_path_view path, node_ptr const& node);
 
+  // the interned node while interning is enabled, see node_intern_table
   template <typename T>
   node_ptr static value_node(T&& t) {
+    if (interning()) {
+      return interned_value(t);
+    }
     return make_node_ptr(node_value<T>{std::forward<T>(t)});
   }
 
   node_ptr set(path_slice const& path, node_ptr const& node) const;
-  node_ptr get(path_slice const& path) const noexcept;
+  // allocates if the path leads into a lazy node
+  node_ptr get(path_slice const& path) const;
 
   bool has(path_slice const& path) const { return get(path) != nullptr; }
   node_ptr remove(path_slice const& path) const { return set(path, nullptr); }
 
+  /*
+   * Same as above for flat paths, see node_path. Does not allocate for the
+   * path while descending.
+   */
+  node_ptr set(node_path_view path, node_ptr const& node) const;
+  node_ptr get(node_path_view path) const;
+
+  /*
+   * The node that determines the value at `path`: the node at `path`, or
+   * its closest lazy ancestor, whose children are created anew on every
+   * access. Trees with the same anchor for a path hold the same value at
+   * it, as long as the anchor is alive. `nullptr` if the path does not
+   * exist.
+   */
+  [[nodiscard]] node const* anchor(path_slice const& path) const noexcept;
+
   using transformation = std::function<node_ptr(node_ptr const&)>;
   using transform_action = std::pair<path_slice, transformation>;
 
   /*
-   * Applies the given list of actions and returns the resulting node.
-   * If one path is the prefix of another the result is undefined.
+   * Applies the given list of actions and returns the resulting node. The
+   * actions are applied in order, every action sees the result of the
+   * previous ones, also if one path is the prefix of another. Actions are
+   * grouped by common path prefixes, thus every ancestor is copied only
+   * once.
    */
   node_ptr transform(std::vector<transform_action> const& operations) const;
+  node_ptr transform(std::vector<std::pair<node_path, transformation>> const& operations) const;
 
   template <typename T>
   using fold_operator = std::function<T(node_ptr const&)>;
@@ -261,7 +596,10 @@ struct node : public std::enable_shared_from_this<node> {
 
   /*
    * Extract returns a node that contains all the subtrees of the specified
-   * nodes.
+   * nodes. The subtrees are shared with this node, the nodes above them are
+   * objects containing only the requested members. If one path is the prefix
+   * of another, the whole subtree of the shorter path is contained. Paths
+   * that do not exist are omitted, but their parents are created.
    */
   template <typename L>
   node_ptr extract(L const& list) const;
@@ -272,12 +610,46 @@ struct node : public std::enable_shared_from_this<node> {
    */
   node_ptr overlay(node_ptr const& ov) const;
 
+  /*
+   * Computes the changes that turn `old_node` into `new_node`, see
+   * `node_diff`. Subtrees and HAMT nodes shared by both trees are skipped,
+   * thus the cost is proportional to the size of the change. Objects with
+   * many members are diffed in parallel on `pool`.
+   */
+  static node_diff diff(node_ptr const& old_node, node_ptr const& new_node);
+  static node_diff diff(node_ptr const& old_node, node_ptr const& new_node,
+                        node_work_pool& pool);
+
   void into_builder(arangodb::velocypack::Builder& builder) const;
 
-  bool operator==(node const& n) const noexcept { return value == n.value; }
-  bool operator!=(node const& n) const noexcept { return value != n.value; }
+  /*
+   * Nodes and bytes of this subtree, see node-memory.h. Bytes that are also
+   * referenced from outside of the subtree count as shared.
+   */
+  [[nodiscard]] node_memory_usage memory_usage() const;
+
+  /*
+   * Structural hash of this subtree, computed on first use and cached. It is
+   * combined from the hashes of the children, order sensitive for arrays and
+   * order insensitive for objects. Equal trees have equal hashes, no matter
+   * how they are represented, e.g. as node_slice. The hash is stable across
+   * processes, so trees of two replicas can be compared by their root hash.
+   */
+  [[nodiscard]] std::uint64_t hash() const noexcept;
+
+  /*
+   * Nodes are compared by identity first, then by hash and only if the
+   * hashes are equal by deep comparison.
+   */
+  bool operator==(node const& n) const noexcept;
+  bool operator!=(node const& n) const noexcept { return !(*this == n); }
 
  private:
+  [[nodiscard]] static bool interning() noexcept;
+  static node_ptr interned_value(double v);
+  static node_ptr interned_value(bool v);
+  static node_ptr interned_value(std::string_view v);
+
   static thread_local node_ptr null_value_node;
   static thread_local node_ptr empty_array_node;
   static thread_local node_ptr empty_object_node;
@@ -285,4 +657,70 @@ struct node : public std::enable_shared_from_this<node> {
 
 std::ostream& operator<<(std::ostream& os, node const& n);
 
+/*
+ * Result of `node::diff`. Applying `operations` in order using `node::set`
+ * turns the old tree into the new one, a `nullptr` value removes the path.
+ * `delta` holds the same changes in the format understood by
+ * `node::overlay` and is `nullptr` if the trees are equal.
+ *
+ * Arrays are not diffed but replaced as a whole. An overlay can not shorten
+ * an array, if an array shrank `delta_exact` is false and only `operations`
+ * describe the change correctly.
+ */
+struct node_diff {
+  struct operation {
+    node::path_slice path;
+    node_ptr value;
+  };
+
+  node_ptr delta;
+  std::vector<operation> operations;
+  bool delta_exact = true;
+
+  [[nodiscard]] bool empty() const noexcept { return delta == nullptr; }
+};
+
+template <typename... T>
+auto make_node_ptr(T&&... t) -> node_ptr {
+  void* memory = node_pool::allocate(sizeof(node));
+  try {
+    return node_ptr{new (memory) node(std::forward<T>(t)...)};
+  } catch (...) {
+    node_pool::deallocate(memory, sizeof(node));
+    throw;
+  }
+}
+
+inline node_ptr::node_ptr(node const* p) noexcept : ptr(p) {
+  if (ptr != nullptr) {
+    ptr->refcount.acquire();
+  }
+}
+
+inline node_ptr::node_ptr(node_ptr const& other) noexcept : ptr(other.ptr) {
+  if (ptr != nullptr) {
+    ptr->refcount.acquire();
+  }
+}
+
+inline node_ptr& node_ptr::operator=(node_ptr const& other) noexcept {
+  node_ptr{other}.swap(*this);
+  return *this;
+}
+
+inline node_ptr& node_ptr::operator=(node_ptr&& other) noexcept {
+  node_ptr{std::move(other)}.swap(*this);
+  return *this;
+}
+
+inline node_ptr::~node_ptr() {
+  if (ptr != nullptr && ptr->refcount.release()) {
+    destroy(ptr);
+  }
+}
+
+inline std::uint32_t node_ptr::use_count() const noexcept {
+  return ptr == nullptr ? 0 : ptr->refcount.load();
+}
+
 #endif  // AGENCY_NODE_H
@@ -63,7 +63,7 @@ struct set_operation_factory {
   using constructed_type = set_operator;
 
   constructed_type operator()(arangodb::velocypack::Slice value, double ttl) const {
-    return set_operator(node::from_slice(value));
+    return set_operator(node::lazy_from_slice(value));
   }
 };
 
@@ -102,7 +102,7 @@ struct slice_condition_factory {
   using constructed_type = C;
 
   constructed_type operator()(arangodb::velocypack::Slice s) const {
-    return constructed_type{node::from_slice(s)};
+    return constructed_type{node::lazy_from_slice(s)};
   }
 };
 
@@ -140,8 +140,24 @@ using agency_precondition_deserialzer = deserializer::from_factory<agency_precon
 template <typename K, typename V>
 using vector_map = std::vector<std::pair<K, V>>;
 
-using operation_list = vector_map<std::string_view, node::transformation>;
-using precondition_list = vector_map<std::string_view, node::fold_operator<bool>>;
+/*
+ * Reads the keys of operations and preconditions, parsed once into a
+ * node_path. Repeated and trailing slashes are ignored.
+ */
+struct agency_path_reader {
+  using value_type = node_path;
+  using result_type = deserializer::result<node_path, deserialize_error>;
+  static result_type read(::deserializer::slice_type s) {
+    if (s.isString()) {
+      return result_type{node_path::parse(s.stringView())};
+    }
+
+    return result_type{deserialize_error{"path is not a string"}};
+  }
+};
+
+using operation_list = vector_map<node_path, node::transformation>;
+using precondition_list = vector_map<node_path, node::fold_operator<bool>>;
 
 struct agency_transaction {
   operation_list operations;
@@ -152,11 +168,11 @@ struct agency_transaction {
 using operation_deserializer = deserializer::map_deserializer<
     agency_operation_deserialzer,
     vector_map,
-    value_reader<std::string_view>>;
+    agency_path_reader>;
 using precondition_deserializer = deserializer::map_deserializer<
     agency_precondition_deserialzer,
     vector_map,
-    value_reader<std::string_view>>;
+    agency_path_reader>;
 
 
 using agency_transaction_deserializer = deserializer::utilities::constructing_deserializer<
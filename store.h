@@ -5,20 +5,46 @@
 #ifndef AGENCY_STORE_H
 #define AGENCY_STORE_H
 
+#include "node-editor.h"
 #include "node-operations.h"
+#include "node-path.h"
+#include "node-plan.h"
+#include "node-root.h"
+#include "node-ttl.h"
 #include "node.h"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <ostream>
 #include <queue>
-#include <shared_mutex>
-
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Removes paths from the store once their time to live is over. Expiry
+ * times are kept in a timing wheel with ticks of `ttl_tick`, a path is
+ * removed within one tick after its time is over. `run_queue_thread`
+ * advances the wheel once per tick and removes all paths that expired
+ * meanwhile with a single write.
+ */
 template <typename T>
 struct store_ttl {
-  using clock_type = std::chrono::system_clock;
+  using clock_type = std::chrono::steady_clock;
   using store_type = T;
 
-  store_ttl() noexcept = default;
+  static constexpr clock_type::duration default_ttl_tick = std::chrono::milliseconds{100};
+
+  explicit store_ttl(clock_type::duration ttl_tick = default_ttl_tick) noexcept
+      : ttl_tick(ttl_tick), origin(clock_type::now()) {}
   store_ttl(store_ttl const&) = delete;
   store_ttl& operator=(store_ttl const&) = delete;
   store_ttl(store_ttl&&) noexcept = delete;
@@ -26,23 +52,45 @@ struct store_ttl {
 
   // path *must* be normalized!
   void set_ttl(std::string_view path, clock_type::duration ttl) {
+    // rounded up, a path is never removed early
+    auto const end_of_life = clock_type::now() + ttl - origin;
+    auto const expiry = (end_of_life + ttl_tick - clock_type::duration{1}) / ttl_tick;
+
     std::unique_lock guard(ttl_queue_guard);
+    ttl_wheel.set(path, expiry < 0 ? 0 : static_cast<node_ttl_wheel::tick_type>(expiry));
+  }
 
-    auto at = std::find(ttl_list.begin(), ttl_list.end(),
-                        [&path](ttl_entry const& e) { return e.path == path; });
+  void remove_ttl(std::string_view path) {
+    std::unique_lock guard(ttl_queue_guard);
+    ttl_wheel.remove(path);
+  }
 
-    clock_type::time_point end_of_life = clock_type::now() + ttl;
+  /*
+   * Removes the paths that expired up to `now` with a single write, returns
+   * their number.
+   */
+  std::size_t expire_ttl(clock_type::time_point now) {
+    std::vector<std::string> expired;
+    {
+      std::unique_lock guard(ttl_queue_guard);
+      auto const ticks = (now - origin) / ttl_tick;
+      ttl_wheel.advance(ticks < 0 ? 0 : static_cast<node_ttl_wheel::tick_type>(ticks), expired);
+    }
 
-    if (at == ttl_list.end()) {
-      ttl_list.emplace_back(path, end_of_life);
-    } else {
-      at->end_of_life = end_of_life;
+    if (!expired.empty()) {
+      std::vector<node::transform_action> remove_actions;
+      remove_actions.reserve(expired.size());
+      for (auto const& path : expired) {
+        remove_actions.emplace_back(to_path_slice(path), remove_operator{});
+      }
+      self().write(remove_actions);
     }
+    return expired.size();
   }
 
-  void remove_ttl(std::string_view path) {
+  [[nodiscard]] std::size_t ttl_count() const {
     std::unique_lock guard(ttl_queue_guard);
-    ttl_list.erase(std::remove(ttl_list.begin(), ttl_list.end(), path), ttl_list.end());
+    return ttl_wheel.size();
   }
 
  public:
@@ -54,79 +102,155 @@ struct store_ttl {
 
   void run_queue_thread() {
     while (!stopped.load(std::memory_order_acquire)) {
-      std::unique_lock guard(ttl_queue_guard);
-
-      auto now = clock_type::now();
-
-      std::vector<node::transform_action> remove_actions;
-
-      auto const isExpired = [this, &now, &remove_actions](ttl_entry const& e) {
-        return e.end_of_life > now;
-      };
-
-      for (auto const& it : ttl_list) {
-        if (isExpired(it)) {
-          remove_actions.emplace_back(std::move(it.path), remove_operator{});
-        }
-      }
-
-      ttl_list.erase(std::remove_if(ttl_list.begin(), ttl_list.end(), isExpired),
-                     ttl_list.end());
+      expire_ttl(clock_type::now());
 
-      if (!remove_actions.empty()) {
-        self().modification(remove_actions);
+      std::unique_lock guard(ttl_queue_guard);
+      if (!stopped.load(std::memory_order_acquire)) {
+        wait_for_stopped.wait_for(guard, ttl_tick);
       }
-
-      using namespace std::chrono_literals;
-      wait_for_stopped.wait_for(guard, 1s);
     }
   }
 
  private:
+  static node::path_slice to_path_slice(std::string_view path) {
+    auto const flat = node_path::parse(path);
+    std::vector<std::string> segments;
+    segments.reserve(flat.size());
+    for (auto const& segment : flat) {
+      segments.emplace_back(segment.name());
+    }
+    return node::path_slice(std::make_move_iterator(segments.begin()),
+                            std::make_move_iterator(segments.end()));
+  }
+
   std::atomic<bool> stopped = false;
   std::condition_variable wait_for_stopped;
 
-  struct ttl_entry {
-    std::string path;
-    clock_type::time_point end_of_life;
-
-    explicit ttl_entry(std::string path, clock_type::time_point end_of_life)
-        : path(std::move(path)), end_of_life(end_of_life) {}
-  };
-
-  std::vector<ttl_entry> ttl_list;
+  clock_type::duration const ttl_tick;
+  clock_type::time_point const origin;
+  node_ttl_wheel ttl_wheel;
   mutable std::mutex ttl_queue_guard;
 
-  T& self() { return *dynamic_cast<T*>(this); }
+  T& self() { return static_cast<T&>(*this); }
 };
 
 struct store_base : public store_ttl<store_base> {
   store_base() = default;
   explicit store_base(node_ptr root) : root(std::move(root)) {}
+  store_base(node_ptr root, clock_type::duration ttl_tick)
+      : store_ttl(ttl_tick), root(std::move(root)) {}
 
   store_base(store_base const&) = delete;
   store_base& operator=(store_base const&) = delete;
   store_base(store_base&&) noexcept = delete;
   store_base& operator=(store_base&&) noexcept = delete;
 
+  /*
+   * Writes are committed in groups. A transaction is pushed onto a lock-free
+   * queue, the writer that finds nobody committing becomes the combiner: it
+   * applies all queued transactions in order to one working root, publishes
+   * the result once and fulfils their futures. Transactions queued meanwhile
+   * form the next group, the combiner keeps going until the queue is empty.
+   *
+   * The result of a transaction is the root published by its group, which
+   * may contain later transactions of the group, or `nullptr` if a
+   * precondition failed. If it throws, its future holds the exception and
+   * the other transactions of the group are not affected.
+   */
+  [[nodiscard]] std::future<node_ptr> transact_async(
+      std::vector<node::fold_action<bool>> preconditions,
+      std::vector<node::transform_action> operations) {
+    auto trx = std::make_unique<queued_transaction>();
+    trx->owned_preconditions = std::move(preconditions);
+    trx->owned_operations = std::move(operations);
+    trx->preconditions = &trx->owned_preconditions;
+    trx->operations = &trx->owned_operations;
+    return enqueue(std::move(trx));
+  }
+
+  [[nodiscard]] std::future<node_ptr> write_async(std::vector<node::transform_action> operations) {
+    return transact_async({}, std::move(operations));
+  }
+
   node_ptr transact(std::vector<node::fold_action<bool>> const& preconditions,
                     std::vector<node::transform_action> const& operations) {
-    std::unique_lock modify_guard(root_modify_mutex);
-    // TODO the root_modify_mutex can be unlocked as soon as the first precondition fails
-    bool preconditionsOk = root->fold<bool>(preconditions, std::logical_and{}, true);
-    if (preconditionsOk) {
-      return set_internal(root->transform(operations));
+    // the caller waits, thus the transaction can refer to its arguments
+    auto trx = std::make_unique<queued_transaction>();
+    trx->preconditions = &preconditions;
+    trx->operations = &operations;
+    return enqueue(std::move(trx)).get();
+  }
+
+  /*
+   * A transaction on node paths, e.g. an `agency_transaction`. Its
+   * preconditions are checked by the plan of its shape, see
+   * `node_transaction_plan`, the result names the first precondition that
+   * failed in the order they were given.
+   */
+  node_transaction_plan::result transact(node_transaction_plan::precondition_list const& preconditions,
+                                         node_transaction_plan::operation_list const& operations) {
+    std::optional<std::size_t> failed;
+    auto trx = std::make_unique<queued_transaction>();
+    trx->plan = plans.get(preconditions);
+    trx->path_preconditions = &preconditions;
+    trx->path_operations = &operations;
+    trx->failed_precondition = &failed;
+    auto root = enqueue(std::move(trx)).get();
+    return node_transaction_plan::result{std::move(root), failed};
+  }
+
+  /*
+   * Same as `transact`, but the preconditions are evaluated before the
+   * transaction is queued, on a snapshot of the current root. The combiner
+   * only checks that the subtrees they read are still the same nodes, see
+   * `node::anchor`, thus expensive preconditions, e.g. comparing large
+   * subtrees, do not hold up other writers. If one of them changed, the
+   * transaction is evaluated again on a new snapshot. After
+   * `max_optimistic_retries` conflicts the combiner evaluates the
+   * preconditions itself.
+   *
+   * If a precondition fails on the snapshot, `nullptr` is returned right
+   * away, the snapshot was the current root when it was taken.
+   */
+  node_ptr transact_optimistic(std::vector<node::fold_action<bool>> const& preconditions,
+                               std::vector<node::transform_action> const& operations) {
+    for (std::size_t attempt = 0;; attempt++) {
+      // not written by the combiner if `trx->conflict` is `nullptr`
+      bool conflict = false;
+      auto trx = std::make_unique<queued_transaction>();
+      trx->preconditions = &preconditions;
+      trx->operations = &operations;
+      trx->snapshot = read();
+      if (!evaluate(*trx->snapshot, preconditions)) {
+        return nullptr;
+      }
+      trx->anchors.reserve(preconditions.size());
+      for (auto const& precondition : preconditions) {
+        trx->anchors.push_back(trx->snapshot->anchor(precondition.first));
+      }
+      trx->conflict = attempt < max_optimistic_retries ? &conflict : nullptr;
+
+      auto result = enqueue(std::move(trx)).get();
+      if (!conflict) {
+        return result;
+      }
+      conflicts.fetch_add(1, std::memory_order_relaxed);
     }
-    return nullptr;
+  }
+
+  static constexpr std::size_t max_optimistic_retries = 3;
+
+  // the number of optimistic transactions that had to be evaluated again
+  [[nodiscard]] std::size_t optimistic_conflicts() const noexcept {
+    return conflicts.load(std::memory_order_relaxed);
   }
 
   bool check(std::vector<node::fold_action<bool>> const& conditions) {
-    return read()->fold<bool>(conditions, std::logical_and{}, true);
+    return evaluate(*pin(), conditions);
   }
 
   node_ptr write(std::vector<node::transform_action> const& operations) {
-    std::unique_lock modify_guard(root_modify_mutex);
-    return set_internal(root->transform(operations));
+    return transact({}, operations);
   }
 
   [[deprecated]] node_ptr set(node_ptr new_root) {
@@ -134,25 +258,241 @@ struct store_base : public store_ttl<store_base> {
     return set_internal(std::move(new_root));
   }
 
-  [[nodiscard]] node_ptr read() const {
-    std::shared_lock guard(root_mutex);
-    return root;
-  }
+  [[nodiscard]] node_ptr read() const { return root.load(); }
+
+  // the current root without taking a reference, see `node_root`
+  [[nodiscard]] node_root::pinned pin() const { return root.pin(); }
 
  private:
+  struct queued_transaction {
+    // either the `owned_` vectors or the ones of a caller that waits
+    std::vector<node::fold_action<bool>> const* preconditions = nullptr;
+    std::vector<node::transform_action> const* operations = nullptr;
+    std::vector<node::fold_action<bool>> owned_preconditions;
+    std::vector<node::transform_action> owned_operations;
+    std::promise<node_ptr> result;
+    queued_transaction* next = nullptr;
+
+    // a transaction on node paths, checked by `plan` instead
+    std::shared_ptr<node_transaction_plan const> plan;
+    node_transaction_plan::precondition_list const* path_preconditions = nullptr;
+    node_transaction_plan::operation_list const* path_operations = nullptr;
+    std::optional<std::size_t>* failed_precondition = nullptr;
+
+    // an optimistic transaction, see `preconditions_hold`
+    node_ptr snapshot;
+    std::vector<node const*> anchors;
+    bool* conflict = nullptr;
+  };
+
+  std::future<node_ptr> enqueue(std::unique_ptr<queued_transaction> trx) {
+    auto result = trx->result.get_future();
+    auto* head = trx.release();
+    head->next = queue.load(std::memory_order_relaxed);
+    while (!queue.compare_exchange_weak(head->next, head)) {
+    }
+    combine();
+    return result;
+  }
+
+  using transaction_group = std::vector<std::unique_ptr<queued_transaction>>;
+
+  /*
+   * The queue and the flag are accessed sequentially consistent: a writer
+   * that pushed and saw the flag set relies on the combiner to see its
+   * transaction after clearing the flag. The futures are fulfilled after
+   * clearing it, thus a woken writer commits its next transaction itself
+   * instead of waiting for this thread again.
+   */
+  void combine() {
+    while (queue.load() != nullptr) {
+      if (combining.exchange(true)) {
+        return;
+      }
+      auto* const taken = queue.exchange(nullptr);
+      transaction_group group;
+      std::vector<node_ptr> results;
+      try {
+        std::size_t size = 0;
+        for (auto* trx = taken; trx != nullptr; trx = trx->next) {
+          size++;
+        }
+        group.reserve(size);
+      } catch (...) {
+        combining.store(false);
+        fail(taken, std::current_exception());
+        continue;
+      }
+      // the queue is a stack, reverse it to get the order of arrival
+      for (auto* trx = taken; trx != nullptr; trx = trx->next) {
+        group.emplace_back(trx);
+      }
+      std::reverse(group.begin(), group.end());
+      try {
+        results = commit(group);
+      } catch (...) {
+        // e.g. out of memory before the root was published, nothing of the
+        // group is committed
+        combining.store(false);
+        auto const error = std::current_exception();
+        for (auto const& trx : group) {
+          if (trx != nullptr) {
+            trx->result.set_exception(error);
+          }
+        }
+        continue;
+      }
+      combining.store(false);
+
+      for (std::size_t i = 0; i < group.size(); i++) {
+        if (group[i] != nullptr) {
+          group[i]->result.set_value(std::move(results[i]));
+        }
+      }
+    }
+  }
+
+  // fails and frees a list taken from the queue
+  static void fail(queued_transaction* list, std::exception_ptr const& error) {
+    while (list != nullptr) {
+      std::unique_ptr<queued_transaction> trx{list};
+      list = trx->next;
+      trx->result.set_exception(error);
+    }
+  }
+
+  /*
+   * Returns the result of each transaction, a transaction that threw is
+   * removed from the group. Throws only before the new root is published.
+   */
+  std::vector<node_ptr> commit(transaction_group& group) {
+    std::vector<node_ptr> results(group.size());
+    std::unique_lock modify_guard(root_modify_mutex);
+    auto const current = root.load();
+
+    if (group.size() == 1) {
+      auto& trx = group.front();
+      try {
+        if (preconditions_hold(current, *trx)) {
+          results.front() = set_internal(trx->plan != nullptr
+                                             ? current->transform(*trx->path_operations)
+                                             : current->transform(*trx->operations));
+        }
+      } catch (...) {
+        trx->result.set_exception(std::current_exception());
+        trx.reset();
+      }
+      return results;
+    }
+
+    // The first transaction copies the spine, the following ones edit that
+    // copy in place. If one throws, the editor may have lost changes of the
+    // others, thus the group is applied again without it.
+    std::vector<bool> applied(group.size(), false);
+    node_ptr published;
+    while (published == nullptr) {
+      node_editor editor{current};
+      std::size_t i = 0;
+      try {
+        for (; i < group.size(); i++) {
+          if (group[i] != nullptr) {
+            applied[i] = apply(editor, *group[i]);
+          }
+        }
+      } catch (...) {
+        group[i]->result.set_exception(std::current_exception());
+        group[i].reset();
+        continue;
+      }
+      published = std::move(editor).finish();
+    }
+    if (published.get() != current.get()) {
+      set_internal(published);
+    }
+    for (std::size_t i = 0; i < group.size(); i++) {
+      if (applied[i]) {
+        results[i] = published;
+      }
+    }
+    return results;
+  }
+
+  /*
+   * An optimistic transaction evaluated its preconditions on `snapshot`, they
+   * still hold if the anchors of their paths are the same. The snapshot
+   * keeps the anchors alive, thus their addresses are not reused. Otherwise
+   * the transaction conflicts, or its preconditions are evaluated here if
+   * the caller does not retry.
+   */
+  static bool preconditions_hold(node_ptr const& root, queued_transaction const& trx) {
+    if (trx.plan != nullptr) {
+      // set on every attempt, the group may be applied again
+      *trx.failed_precondition = trx.plan->check(root, *trx.path_preconditions);
+      return !trx.failed_precondition->has_value();
+    }
+    if (trx.snapshot != nullptr) {
+      auto const& preconditions = *trx.preconditions;
+      bool unchanged = true;
+      for (std::size_t i = 0; unchanged && i < preconditions.size(); i++) {
+        unchanged = root->anchor(preconditions[i].first) == trx.anchors[i];
+      }
+      if (trx.conflict != nullptr) {
+        // set on every attempt, the group may be applied again
+        *trx.conflict = !unchanged;
+        return unchanged;
+      }
+      if (unchanged) {
+        return true;
+      }
+    }
+    return evaluate(*root, *trx.preconditions);
+  }
+
+  // same as `fold` with `std::logical_and`
+  static bool evaluate(node const& root, std::vector<node::fold_action<bool>> const& preconditions) {
+    return std::all_of(preconditions.begin(), preconditions.end(), [&](auto const& precondition) {
+      return precondition.second(root.get(precondition.first));
+    });
+  }
+
+  // same as `evaluate` followed by `transform`
+  static bool apply(node_editor& editor, queued_transaction const& trx) {
+    if (!preconditions_hold(editor.root(), trx)) {
+      return false;
+    }
+    if (trx.plan != nullptr) {
+      apply_operations(editor, *trx.path_operations);
+    } else {
+      apply_operations(editor, *trx.operations);
+    }
+    return true;
+  }
+
+  template <typename Operations>
+  static void apply_operations(node_editor& editor, Operations const& operations) {
+    for (auto const& [path, operation] : operations) {
+      editor.set(path, operation(editor.root()->get(path)));
+    }
+  }
+
   node_ptr set_internal(node_ptr new_root) {
     // TODO assert that this thread holds root_modify_mutex
-    std::unique_lock guard(root_mutex);
-    return root = std::move(new_root);
+    root.store(new_root);
+    return new_root;
   }
 
   mutable std::mutex root_modify_mutex;
-  mutable std::shared_mutex root_mutex;
 
-  node_ptr root;
+  // transactions not yet committed, newest first
+  std::atomic<queued_transaction*> queue = nullptr;
+  std::atomic<bool> combining = false;
+  std::atomic<std::size_t> conflicts = 0;
+  node_plan_cache plans;
+
+  node_root root;
 };
 
-std::ostream& operator<<(std::ostream& ostream, store_base const& store) {
+inline std::ostream& operator<<(std::ostream& ostream, store_base const& store) {
   return ostream << *store.read();
 }
 
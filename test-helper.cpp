@@ -1,12 +1,20 @@
 #include "test-helper.h"
 
+#include "node-work-pool.h"
+
 #include "deserialize/deserializer.h"
 
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <memory>
 
-node_ptr node_from_file(std::string const& filename) {
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+node_ptr node_from_file(std::string const& filename, std::size_t threads) {
   std::string str;
 
   auto const readTime = timed([&] {
@@ -21,8 +29,9 @@ node_ptr node_from_file(std::string const& filename) {
   auto const parseJson = timed([&] { data = Parser::fromJson(str); });
 
   auto nodePtr = node_ptr{};
+  node_work_pool pool{threads};
   auto const parseSlice =
-      timed([&] { nodePtr = node::from_slice(data->slice()); });
+      timed([&] { nodePtr = node::from_slice(data->slice(), pool); });
 
   auto const readTime_s =
       std::chrono::duration_cast<std::chrono::duration<double>>(readTime).count();
@@ -34,7 +43,25 @@ node_ptr node_from_file(std::string const& filename) {
   std::cout << "Read file: " << readTime_s << "s, "
             << "parse json: " << jsonTime_s << "s, "
             << "parse slice: " << sliceTime_s << "s"
+            << " (" << pool.concurrency() << " threads)"
             << "\n";
 
   return nodePtr;
 }
+
+std::uint64_t cycle_counter() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+std::size_t resident_set_size() {
+  std::ifstream statm("/proc/self/statm");
+  std::size_t size = 0, resident = 0;
+  if (statm >> size >> resident) {
+    return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  }
+  return 0;
+}
@@ -4,9 +4,16 @@
 
 #include "node.h"
 
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <thread>
 
-node_ptr node_from_file(std::string const& filename);
+/*
+ * Reads a JSON snapshot, the import runs on `threads` threads.
+ */
+node_ptr node_from_file(std::string const& filename,
+                        std::size_t threads = std::thread::hardware_concurrency());
 
 template <typename F>
 auto timed(F&& lambda) {
@@ -17,4 +24,16 @@ auto timed(F&& lambda) {
   return end - start;
 }
 
+/*
+ * Returns the value of the cpu time stamp counter or zero if the platform
+ * does not provide one.
+ */
+std::uint64_t cycle_counter() noexcept;
+
+/*
+ * Returns the resident set size of this process in bytes or zero if it is not
+ * available.
+ */
+std::size_t resident_set_size();
+
 #endif  // AGENCY_NODE_TEST_HELPER_H